@@ -0,0 +1,181 @@
+// records 100k draws into one command buffer through the loader
+// trampolines and through the device dispatch table of VKContext, and
+// prints the recording time per draw of each. headless, nothing is
+// submitted
+
+#include "vk_context.h"
+#include "vk_pipeline.h"
+#include "vk_shader.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+
+namespace {
+
+constexpr uint32_t DRAW_COUNT = 100000;
+// the fastest of these runs counts, the first ones warm the pool up
+constexpr uint32_t RUN_COUNT = 10;
+
+// void main() { gl_Position = vec4(0.0); }
+constexpr uint32_t VERTEX_SPIRV[] = {
+    0x07230203, 0x00010000, 0x00000000, 0x0000000a, 0x00000000,
+    0x00020011, 0x00000001, 0x0003000e, 0x00000000, 0x00000001,
+    0x0006000f, 0x00000000, 0x00000001, 0x6e69616d, 0x00000000,
+    0x00000002, 0x00040047, 0x00000002, 0x0000000b, 0x00000000,
+    0x00020013, 0x00000003, 0x00030021, 0x00000004, 0x00000003,
+    0x00030016, 0x00000005, 0x00000020, 0x00040017, 0x00000006,
+    0x00000005, 0x00000004, 0x00040020, 0x00000007, 0x00000003,
+    0x00000006, 0x0004003b, 0x00000007, 0x00000002, 0x00000003,
+    0x0003002e, 0x00000006, 0x00000008, 0x00050036, 0x00000003,
+    0x00000001, 0x00000000, 0x00000004, 0x000200f8, 0x00000009,
+    0x0003003e, 0x00000002, 0x00000008, 0x000100fd, 0x00010038,
+};
+
+// the hot path of VKRender, with PFN pointers of either kind
+struct DrawCalls {
+  PFN_vkCmdBeginRendering beginRendering;
+  PFN_vkCmdEndRendering endRendering;
+  PFN_vkCmdBindPipeline bindPipeline;
+  PFN_vkCmdSetViewport setViewport;
+  PFN_vkCmdSetScissor setScissor;
+  PFN_vkCmdDraw draw;
+};
+
+// nanoseconds per draw of the fastest run
+double timeDraws(const MAI::VKDispatch &vkd, VkCommandBuffer commandBuffer,
+                 VkPipeline pipeline, const DrawCalls &calls) {
+  using clock = std::chrono::steady_clock;
+
+  const VkExtent2D extent = {1, 1};
+  const VkViewport viewport = {
+      .width = 1.0f,
+      .height = 1.0f,
+      .maxDepth = 1.0f,
+  };
+  const VkRect2D scissor = {.extent = extent};
+  // no attachments, the draws are never rasterized anywhere
+  const VkRenderingInfo renderingInfo = {
+      .sType = VK_STRUCTURE_TYPE_RENDERING_INFO,
+      .renderArea = scissor,
+      .layerCount = 1,
+  };
+  const VkCommandBufferBeginInfo beginInfo{
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+      .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+  };
+
+  clock::duration fastest = clock::duration::max();
+  for (uint32_t run = 0; run < RUN_COUNT; run++) {
+    // begin resets the buffer, the pool memory is reused
+    vkd.vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+    const clock::time_point start = clock::now();
+    calls.beginRendering(commandBuffer, &renderingInfo);
+    calls.bindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                       pipeline);
+    calls.setViewport(commandBuffer, 0, 1, &viewport);
+    calls.setScissor(commandBuffer, 0, 1, &scissor);
+    for (uint32_t i = 0; i < DRAW_COUNT; i++)
+      calls.draw(commandBuffer, 3, 1, 0, i);
+    calls.endRendering(commandBuffer);
+    fastest = std::min(fastest, clock::now() - start);
+
+    vkd.vkEndCommandBuffer(commandBuffer);
+  }
+
+  return std::chrono::duration<double, std::nano>(fastest).count() /
+         DRAW_COUNT;
+}
+
+} // namespace
+
+int main() {
+  MAI::VKContext *vkContext = new MAI::VKContext({
+      .appName = "mai_dispatch_bench",
+      .validation = MAI::MAI_VALIDATION_OFF,
+  });
+  const MAI::VKDispatch &vkd = vkContext->getDispatch();
+  VkDevice device = vkContext->getDevice();
+
+  // VKShader loads SPIR-V from a file only
+  const std::filesystem::path shaderPath =
+      std::filesystem::temp_directory_path() / "mai_dispatch_bench.vert.spv";
+  {
+    std::ofstream file(shaderPath, std::ios::binary);
+    file.write(reinterpret_cast<const char *>(VERTEX_SPIRV),
+               sizeof(VERTEX_SPIRV));
+  }
+  const std::string shaderFile = shaderPath.string();
+  MAI::VKShader *vert = new MAI::VKShader(vkContext, shaderFile.c_str(),
+                                          VK_SHADER_STAGE_VERTEX_BIT);
+  std::filesystem::remove(shaderPath);
+
+  MAI::VKPipeline *pipeline = new MAI::VKPipeline(
+      vkContext, nullptr,
+      {
+          .vert = vert,
+          .cullMode = VK_CULL_MODE_NONE,
+          .attachments = MAI::AttachmentFormats{},
+      });
+
+  VkCommandPoolCreateInfo poolInfo{
+      .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+      .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+      .queueFamilyIndex = vkContext->getFamilyIndices().graphcisFamily.value(),
+  };
+  VkCommandPool commandPool;
+  if (vkd.vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) !=
+      VK_SUCCESS)
+    throw std::runtime_error("failed to create command pool");
+
+  VkCommandBufferAllocateInfo allocInfo{
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+      .commandPool = commandPool,
+      .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+      .commandBufferCount = 1,
+  };
+  VkCommandBuffer commandBuffer;
+  if (vkd.vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer) !=
+      VK_SUCCESS)
+    throw std::runtime_error("failed to allocate command buffer");
+
+  // the exported symbols of the Vulkan loader, as before the dispatch table
+  const DrawCalls loader = {
+      .beginRendering = vkCmdBeginRendering,
+      .endRendering = vkCmdEndRendering,
+      .bindPipeline = vkCmdBindPipeline,
+      .setViewport = vkCmdSetViewport,
+      .setScissor = vkCmdSetScissor,
+      .draw = vkCmdDraw,
+  };
+  const DrawCalls table = {
+      .beginRendering = vkd.vkCmdBeginRendering,
+      .endRendering = vkd.vkCmdEndRendering,
+      .bindPipeline = vkd.vkCmdBindPipeline,
+      .setViewport = vkd.vkCmdSetViewport,
+      .setScissor = vkd.vkCmdSetScissor,
+      .draw = vkd.vkCmdDraw,
+  };
+
+  const VkPipeline handle = pipeline->getPipeline();
+  const double loaderNs = timeDraws(vkd, commandBuffer, handle, loader);
+  const double tableNs = timeDraws(vkd, commandBuffer, handle, table);
+
+  std::printf("%s, %u draws, fastest of %u runs\n",
+              vkContext->getCapabilities().properties.deviceName, DRAW_COUNT,
+              RUN_COUNT);
+  std::printf("loader trampoline: %8.2f ns/draw %8.3f ms\n", loaderNs,
+              loaderNs * DRAW_COUNT / 1e6);
+  std::printf("dispatch table:    %8.2f ns/draw %8.3f ms\n", tableNs,
+              tableNs * DRAW_COUNT / 1e6);
+  std::printf("saving:            %8.2f ns/draw (%.1f%%)\n",
+              loaderNs - tableNs, 100.0 * (loaderNs - tableNs) / loaderNs);
+
+  vkd.vkDestroyCommandPool(device, commandPool, nullptr);
+  delete pipeline;
+  delete vert;
+  delete vkContext;
+  return 0;
+}
@@ -3,13 +3,23 @@
 #include "vk_buffer.h"
 #include "vk_cmd.h"
 #include "vk_context.h"
+#include "vk_defragmenter.h"
 #include "vk_descriptor.h"
+#include "vk_frame_allocator.h"
 #include "vk_image.h"
+#include "vk_ktx.h"
 #include "vk_pipeline.h"
+#include "vk_profiler.h"
 #include "vk_render.h"
+#include "vk_residency.h"
+#include "vk_resource_tracker.h"
+#include "vk_sampler.h"
 #include "vk_shader.h"
+#include "vk_staging.h"
 #include "vk_swapchain.h"
 #include "vk_sync.h"
+#include "vk_texture_loader.h"
+#include "vk_texture_streamer.h"
 #include <functional>
 
 namespace MAI {
@@ -19,11 +29,59 @@ struct TextureModule {
   VkDeviceSize imageSize;
 };
 
+// one draw of a vertex pulling pipeline, read by the shader as an std430
+// array element:
+//
+//   layout(buffer_reference, std430) readonly buffer DrawRecords {
+//     DrawRecord records[];
+//   };
+//   layout(push_constant) uniform Draws { DrawRecords draws; };
+//   DrawRecord record = draws.records[gl_InstanceIndex];
+//
+// the shader loads index gl_VertexIndex from indexAddress, or uses it as
+// is when indexAddress is 0, and the vertex from vertexAddress
+struct DrawRecord {
+  VkDeviceAddress vertexAddress = 0;
+  // uint32_t indices
+  VkDeviceAddress indexAddress = 0;
+  // per draw constants, e.g. from allocateFrameData()
+  VkDeviceAddress userAddress = 0;
+  uint32_t vertexStride = 0;
+  // indices, or vertices when not indexed
+  uint32_t count = 0;
+};
+
 struct MAIRendererInfo {
   uint32_t width, height;
   const char *appName;
   float clearColor[4] = {0.25f, 0.25f, 0.25f, 1.0f};
   bool isFullScreen;
+  // render into a ring of device images instead of a window swapchain
+  bool headless = false;
+  // number of frames run() drives before returning in headless mode
+  uint32_t headlessFrameCount = 1;
+  // GPU timestamp / CPU scope profiler, see beginProfileScope()
+  bool enableProfiler = false;
+  bool enablePipelineStatistics = false;
+  // physical device override, see ContextInfo
+  int32_t deviceIndex = -1;
+  const char *deviceName = nullptr;
+  // validation layers are off by default in NDEBUG builds
+  ValidationMode validation = MAI_DEFAULT_VALIDATION;
+  // persistently mapped ring every upload is staged through, larger
+  // uploads are split into quarter-ring chunks
+  VkDeviceSize stagingBufferSize = 64ull << 20;
+  // per frame scratch memory behind allocateFrameData()
+  VkDeviceSize frameAllocatorSize = 16ull << 20;
+  // incremental compaction of device local memory, off by default
+  DefragInfo defrag;
+  // streamed texture uploads, see createStreamedTexture()
+  StreamingInfo streaming;
+  // decode threads and upload budget of loadTexture()
+  TextureLoaderInfo textureLoader;
+  // list the buffers and textures still alive when the renderer is
+  // destroyed
+  bool reportLeaks = false;
 };
 
 using DrawFrameFunc = std::function<void(
@@ -40,46 +98,159 @@ struct MAIRenderer {
   VKPipeline *createPipeline(PipelineInfo info);
   VKbuffer *createBuffer(BufferInfo info);
   VKDescriptor *createDescriptor(DescriptorSetInfo info);
+  // sampled through the global set as
+  //   sampler2D(textures[getTextureIndex()], samplers[getSamplerIndex()])
+  // with samplerCube and binding 2 for cubes. 2D arrays are binding 3,
+  // sampled as sampler2DArray with the layer as the third coordinate, so
+  // sprites animated through one flipbook share a slot and pick their
+  // frame per instance. SAMPLER_REPEAT and SAMPLER_CLAMP are always in the
+  // sampler table. attachment usage makes a render target for beginPass()
   VKTexture *createTexture(TextureInfo info);
+  // loads the first of filenames in a format the device can sample, see
+  // pickKTX(), and uploads its levels as stored. throws when none is
+  VKTexture *createTextureKTX(const std::vector<const char *> &filenames,
+                              const char *debugName = nullptr);
+  // a texture with only its smallest levels resident, request finer ones
+  // through getTextureStreamer()->requestLevel() as the camera approaches.
+  // sample it through getTextureIndex(), the image behind it changes
+  VKStreamedTexture *createStreamedTexture(StreamedTextureInfo info);
+  void destroyStreamedTexture(VKStreamedTexture *texture) {
+    textureStreamer->destroyTexture(texture);
+  }
+  VKTextureStreamer *getTextureStreamer() const { return textureStreamer; }
+  // returns at once, the image is decoded on a worker and uploaded at the
+  // start of a later frame. until then getTextureIndex() samples a grey
+  // placeholder, so it can be drawn with right away
+  VKAsyncTexture *loadTexture(AsyncTextureInfo info);
+  void destroyAsyncTexture(VKAsyncTexture *texture) {
+    textureLoader->destroyTexture(texture);
+  }
+  VKTextureLoader *getTextureLoader() const { return textureLoader; }
+
+  // buffers and textures created between these two calls record their
+  // copies and barriers into one command buffer pair that is submitted once
+  // by endUploadBatch(). they may be drawn with in any frame submitted
+  // after endUploadBatch(), the returned id only tells when the staging
+  // memory and command buffers are back
+  void beginUploadBatch() { vkCmd->beginUploadBatch(); }
+  uint64_t endUploadBatch();
+  bool isUploadComplete(uint64_t id) { return vkCmd->isUploadComplete(id); }
+  void waitForUpload(uint64_t id) { vkCmd->waitForUpload(id); }
 
   void bindRenderPipeline(VKPipeline *pipeline);
   void bindVertexBuffer(uint32_t firstBinding, VKbuffer *buffer,
                         uint32_t offset = 0);
   void bindIndexBuffer(VKbuffer *buffer, VkDeviceSize offset,
                        VkIndexType indexType);
+  void bindVertexBuffer(uint32_t firstBinding,
+                        const FrameAllocation &allocation);
+  void bindIndexBuffer(const FrameAllocation &allocation,
+                       VkIndexType indexType);
   void bindDescriptorSet(VKPipeline *pipeline,
                          const std::vector<VkDescriptorSet> &sets);
 
+  // an offscreen pass into render targets, drawn with pipelines whose
+  // PipelineInfo::attachments match. every pass of a frame comes before
+  // its first draw into the swapchain image, later passes sample the
+  // targets through their texture index
+  void beginPass(const RenderPassInfo &info) { vkRender->beginPass(info); }
+  void endPass() { vkRender->endPass(); }
+
   void cmdDraw(uint32_t vertexCount, uint32_t instanceCount = 1,
                uint32_t firstIndex = 0, uint32_t firstIntance = 0);
 
   void cmdDrawIndex(uint32_t indexCount, uint32_t instanceCount = 1,
                     uint32_t firstIndex = 0, int32_t vertexOffset = 0,
                     uint32_t firstInstance = 0);
+  // draws every record with the bound vertex pulling pipeline, without
+  // binding any buffer. the records are copied to frame memory, their
+  // address goes in the first 8 bytes of the push constants and draw i
+  // runs with firstInstance i. one multi draw indirect call when the device
+  // supports it, one draw per record otherwise
+  void cmdDrawRecords(const DrawRecord *records, uint32_t count);
   void updateBuffer(VKbuffer *buffer, void *data, size_t size);
+  // writes part of a non uniform buffer. device local buffers see the
+  // write from the next beginFrame() on, earlier frames keep the old data
+  void updateBufferRange(VKbuffer *buffer, VkDeviceSize offset,
+                         VkDeviceSize size, const void *data);
+  // transient per draw constants, vertices or indices for the frame being
+  // recorded. pass allocation.address through a push constant or bind it
+  // as a vertex/index buffer, the memory is reused MAX_FRAMES_IN_FLIGHT
+  // frames later
+  FrameAllocation allocateFrameData(VkDeviceSize size,
+                                    VkDeviceSize alignment = 0);
+  FrameAllocation allocateFrameData(const void *data, VkDeviceSize size,
+                                    VkDeviceSize alignment = 0);
   void updatePushConstant(uint32_t size, const void *value);
 
+  // named GPU scopes around groups of draws, nesting is allowed
+  void beginProfileScope(const char *name);
+  void endProfileScope();
+  bool writeProfilerTrace(const char *filename) const;
+  VKProfiler *getProfiler() const { return profiler; }
+
+  // textures are sampled through the bindless table, the renderer cannot
+  // see which ones a frame uses. unmarked textures are the first to leave
+  // device memory when a heap runs over its budget
+  void markTextureUsed(VKTexture *texture) { residency->touch(texture); }
+  HeapBudget getHeapBudget(uint32_t heap) const {
+    return vkContext->getAllocator()->getHeapBudget(heap);
+  }
+  // VkDeviceMemory objects and allocations by memory type, heap and usage
+  MemoryStats getMemoryStats() const {
+    return vkContext->getAllocator()->getStats();
+  }
+  // live buffers and textures, by kind and debug name
+  ResourceStats getResourceStats() const {
+    return vkContext->getResourceTracker()->getStats();
+  }
+  FragmentationStats getFragmentation() const {
+    return vkContext->getAllocator()->getFragmentation();
+  }
+  // null unless MAIRendererInfo::defrag is enabled
+  VKDefragmenter *getDefragmenter() const { return defragmenter; }
+
   void waitForDevice() { vkContext->waitForDevice(); }
   void BindDepthState(DepthInfo info);
 
   GLFWwindow *getWindow() const { return window; }
+  bool isHeadless() const { return info_.headless; }
+  // average frame rate of the last headless run()
+  float getFramesPerSecond() const { return framesPerSecond; }
 
 private:
   uint32_t lastTextureCount = -1;
   uint32_t lastCubemapCount = -1;
+  uint32_t lastTextureArrayCount = -1;
 
   GLFWwindow *window = nullptr;
   VKContext *vkContext;
   VKSwapchain *vkSwapchain;
   VKSync *vkSyncObj;
   VKCmd *vkCmd;
+  VKStagingRing *stagingRing;
+  VKFrameAllocator *frameAllocator;
+  VKResidency *residency;
+  VKDefragmenter *defragmenter = nullptr;
+  VKTextureStreamer *textureStreamer;
+  VKTextureLoader *textureLoader;
+  // created inside the open upload batch, tracked once it is submitted
+  std::vector<VKTexture *> batchTextures;
+  std::vector<VKbuffer *> batchBuffers;
   VKRender *vkRender;
-  VKTexture *depthTexture;
+  VKRenderTargetPool *renderTargets;
   MAIRendererInfo info_;
   VKPipeline *lastBindPipeline_ = nullptr;
   VKDescriptor *globalDescriptor = nullptr;
+  VKProfiler *profiler = nullptr;
+  float framesPerSecond = 0.0f;
 
   GLFWwindow *initWindow();
+  void runHeadless(DrawFrameFunc &drawFrame);
   void createGlobalDescriptor();
+  // next free slot in the global set binding of format
+  uint32_t nextTextureIndex(TextureFormat format);
+  void trackResidency(VKTexture *texture);
+  void trackResidency(VKbuffer *buffer);
 };
 }; // namespace MAI
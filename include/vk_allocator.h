@@ -0,0 +1,221 @@
+#pragma once
+
+#include "vk_dispatch.h"
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <vector>
+
+namespace MAI {
+
+struct VKContext;
+
+// blocks are cut into power of two buddies between these two sizes, heaps
+// smaller than 8 blocks get proportionally smaller blocks
+constexpr VkDeviceSize ALLOCATOR_BLOCK_SIZE = 64ull << 20;
+constexpr VkDeviceSize ALLOCATOR_MIN_ALLOCATION = 256;
+// share of a heap assumed usable when VK_EXT_memory_budget is missing, in
+// percent
+constexpr VkDeviceSize ALLOCATOR_FALLBACK_BUDGET = 80;
+
+// buffers and linear images never share a block with optimal images, which
+// keeps every block clear of bufferImageGranularity conflicts
+enum AllocationKind : uint8_t {
+  MAI_ALLOCATION_LINEAR,
+  MAI_ALLOCATION_OPTIMAL,
+};
+
+// what the memory is for, VKAllocator::findMemoryType turns it into a
+// memory type
+enum MemoryUsage : uint8_t {
+  // device local, only written through transfers
+  MAI_MEMORY_GPU_ONLY,
+  // host visible staging, written once by the CPU, stays out of VRAM
+  MAI_MEMORY_UPLOAD,
+  // host visible and preferably cached, written by the GPU
+  MAI_MEMORY_READBACK,
+  // rewritten by the CPU and read by the GPU, device local when the device
+  // exposes host visible VRAM
+  MAI_MEMORY_DYNAMIC,
+  // system memory the GPU reads over the bus, where GPU_ONLY and DYNAMIC
+  // resources go when device local memory runs out
+  MAI_MEMORY_HOST_FALLBACK,
+  // attachments whose contents never leave the GPU's tile memory, lazily
+  // allocated where the device has such memory and device local otherwise.
+  // the image needs TRANSIENT_ATTACHMENT usage for lazy types to qualify
+  MAI_MEMORY_TRANSIENT,
+};
+constexpr uint32_t MEMORY_USAGE_COUNT = MAI_MEMORY_TRANSIENT + 1;
+
+struct Allocation {
+  VkDeviceMemory memory = VK_NULL_HANDLE;
+  VkDeviceSize offset = 0;
+  VkDeviceSize size = 0;
+  // persistent mapping, null unless the memory is host visible
+  void *mapped = nullptr;
+  uint32_t memoryType = UINT32_MAX;
+  // UINT32_MAX for dedicated allocations
+  uint32_t block = UINT32_MAX;
+  AllocationKind kind = MAI_ALLOCATION_LINEAR;
+  MemoryUsage usage = MAI_MEMORY_GPU_ONLY;
+  uint8_t order = 0;
+
+  bool isDedicated() const { return block == UINT32_MAX; }
+  // bytes taken from the block, buddies round up to a power of two
+  VkDeviceSize footprint() const {
+    return isDedicated() ? size : ALLOCATOR_MIN_ALLOCATION << order;
+  }
+};
+
+struct HeapBudget {
+  // bytes of device memory this allocator holds on the heap
+  VkDeviceSize usage = 0;
+  // VK_EXT_memory_budget estimate of what the process may use, a fixed
+  // share of the heap without the extension
+  VkDeviceSize budget = 0;
+};
+
+// free space of the device local pools that is stranded between
+// allocations, what a defragmentation pass can give back
+struct FragmentationStats {
+  // bytes taken from blocks
+  VkDeviceSize used = 0;
+  // free bytes in blocks that still hold allocations
+  VkDeviceSize stranded = 0;
+  // stranded / (used + stranded), 0 when every block is full or empty
+  float ratio = 0.0f;
+};
+
+// live objects and their bytes, with the highest values seen
+struct MemoryCounter {
+  uint64_t count = 0;
+  VkDeviceSize bytes = 0;
+  uint64_t peakCount = 0;
+  VkDeviceSize peakBytes = 0;
+
+  void add(VkDeviceSize size) {
+    count++;
+    bytes += size;
+    peakCount = std::max(peakCount, count);
+    peakBytes = std::max(peakBytes, bytes);
+  }
+  void remove(VkDeviceSize size) {
+    count--;
+    bytes -= size;
+  }
+};
+
+// a snapshot of VKAllocator::getStats()
+struct MemoryStats {
+  // VkDeviceMemory objects, pool blocks and dedicated allocations, per
+  // memory type and per heap
+  std::vector<MemoryCounter> deviceMemoryTypes;
+  std::vector<MemoryCounter> deviceMemoryHeaps;
+  // allocations handed out, per memory type and per MemoryUsage
+  std::vector<MemoryCounter> allocationTypes;
+  MemoryCounter allocationUsages[MEMORY_USAGE_COUNT];
+};
+
+// asked to free at least size bytes of heap, returns false when nothing
+// could be moved
+using EvictFunc = std::function<bool(uint32_t heap, VkDeviceSize size)>;
+
+struct VKAllocator {
+  VKAllocator(VKContext *vkContext);
+  ~VKAllocator();
+
+  // allocate, bind and (for host visible memory) map in one go
+  Allocation allocateBuffer(VkBuffer buffer, MemoryUsage usage);
+  Allocation allocateImage(VkImage image, MemoryUsage usage,
+                           VkImageTiling tiling = VK_IMAGE_TILING_OPTIMAL);
+  void free(Allocation &allocation);
+
+  // best type for usage among typeFilter
+  uint32_t findMemoryType(uint32_t typeFilter, MemoryUsage usage) const;
+  VkMemoryPropertyFlags getMemoryFlags(const Allocation &allocation) const;
+  uint32_t getHeapIndex(uint32_t memoryType) const;
+
+  // re-reads the VK_EXT_memory_budget numbers, once per frame is enough
+  void updateBudget();
+  HeapBudget getHeapBudget(uint32_t heap);
+  // device local allocations that would exceed the budget, or that fail,
+  // call this before falling back to system memory
+  void setEvictCallback(EvictFunc func) { evictCallback = func; }
+
+  MemoryStats getStats();
+
+  // defragmentation, see VKDefragmenter
+  FragmentationStats getFragmentation();
+  // bytes taken from the block holding allocation
+  VkDeviceSize getBlockUsage(const Allocation &allocation);
+  // free bytes in the other blocks of the allocation's pool that are in use
+  // and not draining, the room a move out of its block may land in
+  VkDeviceSize getPoolSpareSpace(const Allocation &allocation);
+  // nothing new lands in a draining block, and it is released as soon as it
+  // is empty
+  void setDraining(const Allocation &allocation, bool draining);
+  // bind buffer or image to free space of from's pool outside draining
+  // blocks, without creating a block. false when there is no such room
+  bool moveBuffer(VkBuffer buffer, const Allocation &from,
+                  Allocation &allocation);
+  bool moveImage(VkImage image, const Allocation &from,
+                 Allocation &allocation);
+
+private:
+  struct Block {
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    void *mapped = nullptr;
+    VkDeviceSize used = 0;
+    bool draining = false;
+    // free buddy offsets per order
+    std::vector<std::set<VkDeviceSize>> freeLists;
+  };
+
+  struct Pool {
+    VkDeviceSize blockSize = 0;
+    uint8_t maxOrder = 0;
+    std::vector<Block> blocks;
+  };
+
+  VKContext *vkContext;
+  const VKDispatch &vkd;
+  std::mutex mutex;
+  // memoryTypeCount * 2 pools, one per memory type and kind
+  std::vector<Pool> pools;
+  // guards the budgets and stats
+  std::mutex budgetMutex;
+  std::vector<HeapBudget> heapBudgets;
+  MemoryStats stats;
+  EvictFunc evictCallback;
+
+  Allocation allocate(const VkMemoryRequirements &requirements,
+                      MemoryUsage usage, AllocationKind kind, bool dedicated,
+                      VkBuffer buffer, VkImage image);
+  // without grow only free space in existing blocks is used
+  bool tryAllocate(const VkMemoryRequirements &requirements,
+                   uint32_t memoryType, AllocationKind kind, bool dedicated,
+                   bool grow, VkBuffer buffer, VkImage image,
+                   Allocation &allocation);
+  // moving leaves empty blocks alone, a move into one frees nothing
+  bool allocateFromPool(Pool &pool, uint32_t memoryType, AllocationKind kind,
+                        uint8_t order, bool grow, Allocation &allocation,
+                        bool moving = false);
+  bool allocateDedicated(VkDeviceSize size, uint32_t memoryType,
+                         AllocationKind kind, VkBuffer buffer, VkImage image,
+                         Allocation &allocation);
+  uint32_t createBlock(Pool &pool, uint32_t memoryType, AllocationKind kind);
+  void destroyBlock(Pool &pool, uint32_t memoryType, Block &block);
+  bool allocateMove(const VkMemoryRequirements &requirements,
+                    const Allocation &from, Allocation &allocation);
+  bool isDeviceLocalType(uint32_t memoryType) const;
+  void countAllocation(const Allocation &allocation, bool added);
+  VkDeviceMemory allocateMemory(VkDeviceSize size, uint32_t memoryType,
+                                AllocationKind kind, const void *pNext,
+                                void **mapped);
+  void freeMemory(VkDeviceMemory memory, VkDeviceSize size,
+                  uint32_t memoryType);
+};
+
+}; // namespace MAI
@@ -1,14 +1,25 @@
 #pragma once
 
+#include "vk_allocator.h"
 #include "vk_cmd.h"
 #include "vk_context.h"
+#include "vk_frame_allocator.h"
+#include <map>
 namespace MAI {
 
+// pending writes up to this size are recorded inline with vkCmdUpdateBuffer
+// instead of being staged
+constexpr VkDeviceSize BUFFER_INLINE_UPDATE_SIZE = 4096;
+
 struct BufferInfo {
   VkDeviceSize size;
   const void *data;
   VkBufferUsageFlags usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
                              VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+  // anything but GPU_ONLY lives in host visible memory and stays mapped
+  MemoryUsage memoryUsage = MAI_MEMORY_GPU_ONLY;
+  // shows up in the memory stats and the leak report
+  const char *debugName = nullptr;
 };
 
 struct VKbuffer {
@@ -18,38 +29,82 @@ struct VKbuffer {
   VkBuffer getBufferModule() const { return buffer; }
   VkBufferUsageFlags getBufferUsage() const { return info_.usage; };
   VkDeviceSize getBufferSize() const { return info_.size; };
+  // null for buffers in memory the CPU cannot see
+  void *getMappedData() const { return allocation.mapped; }
 
   void updateUniformBuffer(uint32_t curreImage, void *data, size_t size);
 
+  // host visible buffers are written in place. device local ones keep the
+  // write until the next frame begins, overlapping and adjacent writes are
+  // merged first
+  void update(VkDeviceSize offset, VkDeviceSize size, const void *data);
+  // records the pending writes into commandBuffer, staging the larger ones
+  // in frameAllocator. must run outside rendering
+  void recordUpdates(VkCommandBuffer commandBuffer,
+                     VKFrameAllocator *frameAllocator);
+
   const std::vector<VkBuffer> &getUniformBuffers() const {
     return uniformBuffers;
   }
 
+  // memory comes from the context allocator, host visible memory is
+  // returned already mapped in allocation.mapped
   static void createBuffer(VKContext *vkContext, VkDeviceSize size,
                            VkBufferUsageFlags usage,
-                           VkMemoryPropertyFlags properties, VkBuffer &buffer,
-                           VkDeviceMemory &bufferMemory,
-                           bool isStorageBuffer = false);
+                           MemoryUsage memoryUsage, VkBuffer &buffer,
+                           Allocation &allocation);
+  static void destroyBuffer(VKContext *vkContext, VkBuffer buffer,
+                            Allocation &allocation);
 
   void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size);
+  // hands dstBuffer over from the transfer to the graphics queue
+  void releaseToGraphics(UploadCmd &cmd, VkBuffer dstBuffer);
 
-  static uint32_t findMemoryType(VKContext *vkContext, uint32_t typeFilter,
-                                 VkMemoryPropertyFlags properties);
   uint64_t gpuAddress();
 
+  bool isDeviceLocal() const;
+  uint32_t getMemoryHeap() const;
+  VkDeviceSize getMemorySize() const { return allocation.size; }
+  // moves a GPU_ONLY buffer to system memory and frees its device local
+  // memory. false for buffers whose device address was handed out, which
+  // must not move, and when the buffer cannot live outside device memory
+  bool demote();
+  // GPU_ONLY outside host visible VRAM, not a uniform buffer and no device
+  // address handed out
+  bool isMovable() const;
+  // moves a GPU_ONLY buffer to another place in its memory pool, outside
+  // draining blocks, with a copy recorded into commandBuffer. the old buffer
+  // is handed back, the caller destroys it once commandBuffer has executed.
+  // false when the buffer must not move or the pool has no room
+  bool relocate(VkCommandBuffer commandBuffer, VkBuffer &oldBuffer,
+                Allocation &oldAllocation);
+  const Allocation &getAllocation() const { return allocation; }
+
 private:
   VKContext *vkContext;
+  const VKDispatch &vkd;
   VKCmd *vkCmd;
   VkBuffer buffer;
-  VkDeviceMemory bufferMemory;
+  Allocation allocation;
   BufferInfo info_;
   // uniform buffer
 
   std::vector<VkBuffer> uniformBuffers;
-  std::vector<VkDeviceMemory> uniformBufferMemory;
-  std::vector<void *> uniformBufferMapped;
+  std::vector<Allocation> uniformAllocations;
+
+  bool addressTaken = false;
+  // a GPU_ONLY buffer placed in host visible VRAM. written only through
+  // the frame's command buffer like any GPU_ONLY buffer, the mapping fills
+  // it once at creation, but it never moves
+  bool hostVisibleVram = false;
+
+  // coalesced pending writes keyed by buffer offset
+  std::map<VkDeviceSize, std::vector<uint8_t>> pendingWrites;
 
   void initBuffer();
   void createUniformBuffer();
+  // copies the whole buffer to dstBuffer, fenced against earlier writes and
+  // later reads
+  void recordCopy(VkCommandBuffer commandBuffer, VkBuffer dstBuffer);
 };
 }; // namespace MAI
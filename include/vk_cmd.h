@@ -1,13 +1,30 @@
 #pragma once
 
 #include "vk_context.h"
+#include "vk_staging.h"
+#include <deque>
 
 namespace MAI {
+
+struct VKbuffer;
+struct VKFrameAllocator;
+
+// command buffers of one upload: copies are recorded into `transfer` and run
+// on the transfer queue, `acquire` runs on the graphics queue afterwards and
+// takes ownership of the uploaded resources
+struct UploadCmd {
+  VkCommandBuffer transfer = VK_NULL_HANDLE;
+  VkCommandBuffer acquire = VK_NULL_HANDLE;
+  // tags the staging regions this upload reads
+  uint64_t id = 0;
+};
+
 struct VKCmd {
   VKCmd(VKContext *vkContext);
   ~VKCmd();
 
   VkCommandPool getCommandPool() const { return commandPool; }
+  VkCommandPool getTransferCommandPool() const { return transferCommandPool; }
   const std::vector<VkCommandBuffer> &getCommandBuffers() const {
     return commandBuffers;
   }
@@ -15,13 +32,76 @@ struct VKCmd {
   VkCommandBuffer beginSingleCommandBuffer();
   void endSingleCommandBuffer(VkCommandBuffer commandBuffer);
 
+  // inside a batch both return the batch's command buffers and submit
+  // nothing
+  UploadCmd beginUploadCommandBuffers();
+  // submits and waits for this upload only
+  void endUploadCommandBuffers(UploadCmd &cmd);
+
+  // uploads until endUploadBatch() share one command buffer pair and one
+  // submit. returns the id to poll with isUploadComplete()
+  void beginUploadBatch();
+  uint64_t endUploadBatch();
+  bool isUploadBatchOpen() const { return batchOpen; }
+  bool isUploadComplete(uint64_t id);
+  // submits without waiting, returns the id to wait on
+  uint64_t submitUpload(UploadCmd &cmd);
+  void waitForUpload(uint64_t id);
+  // retires every finished upload and its staging regions
+  void pollUploads();
+
+  void setStagingRing(VKStagingRing *ring) { stagingRing = ring; }
+  // staging space read by cmd, waits for older uploads when the ring is
+  // full and submits cmd early when it alone fills the ring
+  StagingRegion stage(UploadCmd &cmd, VkDeviceSize size,
+                      VkDeviceSize alignment = 16);
+  // largest size worth passing to stage(), bigger uploads are split
+  VkDeviceSize getStagingChunkSize() const {
+    return stagingRing->getCapacity() / 4;
+  }
+
+  // buffers with writes waiting for the next frame, see VKbuffer::update()
+  void addDirtyBuffer(VKbuffer *buffer) { dirtyBuffers.push_back(buffer); }
+  void removeDirtyBuffer(VKbuffer *buffer);
+  // records every pending buffer write into the frame's command buffer,
+  // fenced against frames still reading the buffers
+  void recordBufferUpdates(VkCommandBuffer commandBuffer,
+                           VKFrameAllocator *frameAllocator);
+
 private:
   VKContext *vkContext;
+  const VKDispatch &vkd;
 
   VkCommandPool commandPool;
+  VkCommandPool transferCommandPool;
   std::vector<VkCommandBuffer> commandBuffers;
 
+  // the semaphore links the transfer and acquire submits of one upload,
+  // the fence tells when both are done
+  struct UploadSync {
+    VkFence fence;
+    VkSemaphore semaphore;
+  };
+
+  struct PendingUpload {
+    uint64_t id;
+    UploadSync sync;
+    UploadCmd cmd;
+  };
+
+  VKStagingRing *stagingRing = nullptr;
+  uint64_t nextUploadId = 1;
+  bool batchOpen = false;
+  UploadCmd batchCmd;
+  // submitted uploads in submission order
+  std::deque<PendingUpload> pendingUploads;
+  std::vector<UploadSync> freeUploadSyncs;
+  std::vector<VKbuffer *> dirtyBuffers;
+
   void createCommandPool();
   void createCommandBuffers();
+  UploadCmd allocateUploadCmd();
+  UploadSync acquireUploadSync();
+  void retireUpload(PendingUpload &upload);
 };
 }; // namespace MAI
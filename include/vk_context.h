@@ -1,9 +1,12 @@
 #pragma once
 #define GLFW_INCLUDE_VULKAN
+#include "vk_debug.h"
+#include "vk_dispatch.h"
 #include <GLFW/glfw3.h>
 #include <cassert>
 #include <iostream>
 #include <optional>
+#include <unordered_map>
 #include <vector>
 
 namespace MAI {
@@ -11,9 +14,17 @@ namespace MAI {
 constexpr uint32_t MAX_FRAMES_IN_FLIGHT = 2;
 constexpr uint32_t MAX_TEXTURES = 4060;
 
+struct VKAllocator;
+struct VKResourceTracker;
+struct VKSamplerCache;
+struct VKResidency;
+struct VKDefragmenter;
+
 struct QueueFamilyIndices {
   std::optional<uint32_t> graphcisFamily;
   std::optional<uint32_t> presentFamily;
+  // transfer-only family when the device has one, graphics otherwise
+  std::optional<uint32_t> transferFamily;
   bool isComplete() const {
     return graphcisFamily.has_value() && presentFamily.has_value();
   }
@@ -30,45 +41,141 @@ const std::vector<const char *> deviceExtensions = {
     VK_KHR_CREATE_RENDERPASS_2_EXTENSION_NAME,
 };
 
+enum ValidationMode : uint8_t {
+  // no layers, no messenger: nothing is paid per vkCmd* call
+  MAI_VALIDATION_OFF,
+  MAI_VALIDATION_ERRORS,
+  // errors, warnings and performance warnings
+  MAI_VALIDATION_FULL,
+  // full plus GPU-assisted validation of shader accesses
+  MAI_VALIDATION_GPU_ASSISTED,
+};
+
+#ifdef NDEBUG
+constexpr ValidationMode MAI_DEFAULT_VALIDATION = MAI_VALIDATION_OFF;
+#else
+constexpr ValidationMode MAI_DEFAULT_VALIDATION = MAI_VALIDATION_FULL;
+#endif
+
+struct ContextInfo {
+  const char *appName;
+  // nullptr creates a headless context: no surface, no present queue and no
+  // VK_KHR_swapchain
+  GLFWwindow *window = nullptr;
+  // force a physical device by enumeration index or by a substring of its
+  // name, the MAI_DEVICE environment variable (index or name) wins over both
+  int32_t deviceIndex = -1;
+  const char *deviceName = nullptr;
+  ValidationMode validation = MAI_DEFAULT_VALIDATION;
+};
+
+// everything the library needs to know about the picked physical device,
+// probed once so hot paths never go back to the driver
+struct DeviceCapabilities {
+  VkPhysicalDeviceProperties properties;
+  VkPhysicalDeviceFeatures features;
+  VkPhysicalDeviceMemoryProperties memoryProperties;
+  std::vector<VkQueueFamilyProperties> queueFamilies;
+  VkDeviceSize deviceLocalBytes = 0;
+  // a DEVICE_LOCAL | HOST_VISIBLE type on a heap larger than the legacy
+  // 256 MiB BAR window: resizable BAR or unified memory, the CPU can write
+  // resources in place
+  bool hostVisibleVram = false;
+  // VK_EXT_memory_budget is supported and enabled
+  bool memoryBudget = false;
+  VkFormat depthFormat = VK_FORMAT_UNDEFINED;
+  // filled on first use through VKContext::getFormatProperties
+  std::unordered_map<VkFormat, VkFormatProperties> formats;
+
+  const VkPhysicalDeviceLimits &limits() const { return properties.limits; }
+};
+
 struct VKContext {
 
   GLFWwindow *window;
-  bool enableValidationLayers = true;
+  bool enableValidationLayers = false;
   bool frameRsized = false;
-  VKContext(const char *appName, GLFWwindow *window);
+  VKContext(ContextInfo info);
   ~VKContext();
 
+  bool isHeadless() const { return window == nullptr; }
+
   VkInstance getInstance() const { return instance; }
   VkPhysicalDevice getPhysicalDevice() const { return physicalDevice; }
   VkDevice getDevice() const { return device; }
   VkSurfaceKHR getSurface() const { return surface; }
   VkQueue getGraphicsQueue() const { return graphicsQueue; }
   VkQueue getPresentQueue() const { return presentQueue; }
+  VkQueue getTransferQueue() const { return transferQueue; }
   QueueFamilyIndices getFamilyIndices() const { return indices; }
+  const VkPhysicalDeviceFeatures &getEnabledFeatures() const {
+    return enabledFeatures;
+  }
+  const DeviceCapabilities &getCapabilities() const { return capabilities; }
+  // device-level entry points, valid once the constructor returns
+  const VKDispatch &getDispatch() const { return dispatch; }
+  // sub-allocates device memory for every buffer and image of the library
+  VKAllocator *getAllocator() const { return allocator; }
+  // live buffers and textures, for stats and the leak report
+  VKResourceTracker *getResourceTracker() const { return resourceTracker; }
+  // samplers shared by every texture of the context
+  VKSamplerCache *getSamplerCache() const { return samplerCache; }
+  // least recently used tracking for eviction, null until a renderer sets
+  // one up
+  VKResidency *getResidency() const { return residency; }
+  void setResidency(VKResidency *tracker) { residency = tracker; }
+  // moves resources out of sparse blocks, null unless the renderer enables
+  // it
+  VKDefragmenter *getDefragmenter() const { return defragmenter; }
+  void setDefragmenter(VKDefragmenter *defrag) { defragmenter = defrag; }
+  const VkFormatProperties &getFormatProperties(VkFormat format);
+  ValidationMode getValidationMode() const { return info_.validation; }
+
+  // prints validation messages queued by the driver threads, cheap when
+  // there are none
+  void drainDebugMessages() {
+    if (enableValidationLayers)
+      debugLog.drain();
+  }
+  bool hasDedicatedTransferQueue() const {
+    return indices.transferFamily != indices.graphcisFamily;
+  }
 
   void waitForDevice() {
-    if (vkDeviceWaitIdle(device) != VK_SUCCESS) {
+    if (dispatch.vkDeviceWaitIdle(device) != VK_SUCCESS) {
       std::cerr << "failed to wait for device" << std::endl;
       assert(false);
     }
   }
 
 private:
+  ContextInfo info_;
   VkInstance instance;
-  VkPhysicalDevice physicalDevice;
+  VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
   VkDevice device;
   VkQueue graphicsQueue;
   VkQueue presentQueue;
-  VkSurfaceKHR surface;
+  VkQueue transferQueue;
+  VkSurfaceKHR surface = VK_NULL_HANDLE;
   QueueFamilyIndices indices;
+  VkPhysicalDeviceFeatures enabledFeatures{};
+  DeviceCapabilities capabilities;
+  VKDispatch dispatch;
+  VKAllocator *allocator = nullptr;
+  VKResourceTracker *resourceTracker = nullptr;
+  VKSamplerCache *samplerCache = nullptr;
+  VKResidency *residency = nullptr;
+  VKDefragmenter *defragmenter = nullptr;
 
-  VkDebugUtilsMessengerEXT debugMessenger;
+  VkDebugUtilsMessengerEXT debugMessenger = VK_NULL_HANDLE;
+  VKDebugLog debugLog;
 
   void windowCallbacks();
   void createInstance(const char *appName);
   void setupDebugMessenger();
   void createSurfaceKHR();
   void pickPhysicalDevice();
+  void probeCapabilities();
   void createLogicalDevice();
 };
 
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vulkan/vulkan.h>
+
+namespace MAI {
+
+// both capacities must be powers of two
+constexpr uint32_t DEBUG_LOG_CAPACITY = 256;
+constexpr uint32_t DEBUG_LOG_SEEN_CAPACITY = 1024;
+constexpr uint32_t DEBUG_MESSAGE_LENGTH = 512;
+// messages per second that make it into the ring, the rest is counted
+constexpr uint32_t DEBUG_LOG_RATE_LIMIT = 64;
+
+struct DebugMessage {
+  VkDebugUtilsMessageSeverityFlagBitsEXT severity;
+  int32_t messageId;
+  char text[DEBUG_MESSAGE_LENGTH];
+};
+
+// lock-free multi-producer / single-consumer ring for validation messages.
+// push() runs on whatever thread the driver calls back from: it never
+// blocks, allocates or does I/O. identical messages are reported once and
+// counted afterwards, bursts are rate limited. drain() prints from the
+// render loop
+struct VKDebugLog {
+  VKDebugLog();
+
+  void push(VkDebugUtilsMessageSeverityFlagBitsEXT severity, int32_t messageId,
+            const char *text);
+  void drain();
+
+  uint64_t getDroppedCount() const { return dropped.load(); }
+
+private:
+  struct Slot {
+    std::atomic<uint64_t> sequence;
+    DebugMessage message;
+  };
+
+  Slot slots[DEBUG_LOG_CAPACITY];
+  std::atomic<uint64_t> head{0};
+  uint64_t tail = 0;
+
+  // open addressed set of message hashes with their repeat counts
+  std::atomic<uint64_t> seenHashes[DEBUG_LOG_SEEN_CAPACITY];
+  std::atomic<uint32_t> seenRepeats[DEBUG_LOG_SEEN_CAPACITY];
+  std::atomic<int32_t> seenIds[DEBUG_LOG_SEEN_CAPACITY];
+
+  std::atomic<int64_t> windowStart{0};
+  std::atomic<uint32_t> windowCount{0};
+  std::atomic<uint64_t> dropped{0};
+  uint64_t reportedDropped = 0;
+
+  // bucket is the one claimed for a new message, DEBUG_LOG_SEEN_CAPACITY if
+  // none was
+  bool isRepeat(uint64_t hash, int32_t messageId, uint32_t &bucket);
+  // releases the bucket of a message that was dropped, so a later copy of
+  // it is printed instead of counted as a repeat
+  void forget(uint32_t bucket);
+  bool isRateLimited();
+};
+}; // namespace MAI
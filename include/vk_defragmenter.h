@@ -0,0 +1,108 @@
+#pragma once
+
+#include "vk_allocator.h"
+#include "vk_context.h"
+#include <functional>
+#include <vector>
+
+namespace MAI {
+
+struct VKbuffer;
+struct VKTexture;
+
+struct DefragInfo {
+  bool enabled = false;
+  // a pass starts once this share of the device local pools is stranded,
+  // see FragmentationStats
+  float minRatio = 0.25f;
+  // per frame limits, the GPU copies stay as small as the CPU side
+  uint32_t maxMovesPerFrame = 8;
+  VkDeviceSize maxBytesPerFrame = 32ull << 20;
+  // CPU time of one step. a move is only started while the slowest move of
+  // the step still fits, the first one always runs so a pass moves on
+  float budgetMs = 0.5f;
+};
+
+// the numbers of one finished pass
+struct DefragStats {
+  float ratioBefore = 0.0f;
+  float ratioAfter = 0.0f;
+  uint32_t moves = 0;
+  VkDeviceSize bytesMoved = 0;
+};
+
+// points the bindless slot of texture at its current view, in the
+// descriptor set of frameIndex only
+using DescriptorFixupFunc =
+    std::function<void(VKTexture *texture, uint32_t frameIndex)>;
+
+// empties sparsely used device local blocks a few resources per frame so
+// their memory goes back to the driver. the copies are recorded into the
+// frame's command buffer, nothing waits on the GPU. the old resources are
+// destroyed MAX_FRAMES_IN_FLIGHT frames later, and the descriptor set of
+// each frame is repointed when that frame begins, never while a pending
+// frame reads it. only resources tracked by VKResidency move
+struct VKDefragmenter {
+  VKDefragmenter(VKContext *vkContext, VKResidency *residency,
+                 DefragInfo info);
+  ~VKDefragmenter();
+
+  // runs at the start of frame frameIndex, outside rendering and after its
+  // fence has signalled
+  void step(VkCommandBuffer commandBuffer, uint32_t frameIndex);
+
+  void removeTexture(VKTexture *texture);
+  void removeBuffer(VKbuffer *buffer);
+
+  void setDescriptorFixupCallback(DescriptorFixupFunc func) {
+    descriptorFixup = func;
+  }
+  bool isPassRunning() const { return passRunning; }
+  const DefragStats &getLastPass() const { return lastPass; }
+
+private:
+  // handles replaced by a move, freed once the frame that copied them is
+  // done
+  struct Retired {
+    uint64_t frame;
+    VkBuffer buffer = VK_NULL_HANDLE;
+    VkImage image = VK_NULL_HANDLE;
+    VkImageView view = VK_NULL_HANDLE;
+    Allocation allocation;
+  };
+  struct Fixup {
+    VKTexture *texture;
+    // frames in flight whose descriptor set still has the old view
+    uint32_t frames;
+  };
+
+  VKContext *vkContext;
+  VKResidency *residency;
+  DefragInfo info_;
+  DescriptorFixupFunc descriptorFixup;
+  uint64_t frame = 0;
+
+  bool passRunning = false;
+  DefragStats pass;
+  DefragStats lastPass;
+  // any allocation of the block being drained, memory is null when none is
+  Allocation source;
+  std::vector<VKTexture *> sourceTextures;
+  std::vector<VKbuffer *> sourceBuffers;
+  // blocks given up on in this pass
+  std::vector<VkDeviceMemory> skipped;
+
+  std::vector<Retired> retired;
+  std::vector<Fixup> fixups;
+
+  void release(bool all);
+  void fixDescriptors(uint32_t frameIndex);
+  // the smallest block whose content can all move to the rest of its pool
+  bool pickSource();
+  // drained blocks stay draining until their last allocation is freed
+  void endSource(bool drained);
+  bool moveNext(VkCommandBuffer commandBuffer, uint32_t frameIndex,
+                VkDeviceSize &bytes);
+};
+
+}; // namespace MAI
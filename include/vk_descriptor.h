@@ -5,6 +5,8 @@
 #include "vk_image.h"
 namespace MAI {
 
+// every binding is partially bound and updatable after bind, the last one
+// has a variable count allocated at its descriptorCount
 struct DescriptorSetInfo {
   std::vector<VkDescriptorSetLayoutBinding> uboLayout;
 };
@@ -21,11 +23,23 @@ struct VKDescriptor {
     return descriptorSets;
   }
 
-  void updateDescriptorImageWrite(VkImageView imageView, VkSampler sampler,
-                                  uint32_t imageIndex, bool isCubemap = false);
+  // slot imageIndex of the binding of format in the global set layout:
+  // 0 for 2D, 2 for cubes and 3 for 2D arrays
+  void updateDescriptorImageWrite(VkImageView imageView, uint32_t imageIndex,
+                                  TextureFormat format = MAI_TEXTURE_2D);
+  // same, in the set of one frame in flight only. the others may still be
+  // read by pending command buffers
+  void updateFrameDescriptorImageWrite(uint32_t frameIndex,
+                                       VkImageView imageView,
+                                       uint32_t imageIndex,
+                                       TextureFormat format = MAI_TEXTURE_2D);
+  // fills slot index of the sampler table in every set, slots are written
+  // once before anything samples through them
+  void updateDescriptorSamplerWrite(VkSampler sampler, uint32_t index);
 
 private:
   VKContext *vkContext;
+  const VKDispatch &vkd;
   VkDescriptorSetLayout descriptorSetLayout;
   VkDescriptorPool descriptorPool;
   std::vector<VkDescriptorSet> descriptorSets;
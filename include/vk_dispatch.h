@@ -0,0 +1,103 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+namespace MAI {
+
+// device-level entry points used by the library, loaded straight from the
+// driver so calls skip the loader trampoline
+#define MAI_DEVICE_FUNCTIONS(X)                                                \
+  X(vkDestroyDevice)                                                           \
+  X(vkDeviceWaitIdle)                                                          \
+  X(vkGetDeviceQueue)                                                          \
+  X(vkQueueSubmit)                                                             \
+  X(vkQueueWaitIdle)                                                           \
+  X(vkAllocateMemory)                                                          \
+  X(vkFreeMemory)                                                              \
+  X(vkMapMemory)                                                               \
+  X(vkCreateBuffer)                                                            \
+  X(vkDestroyBuffer)                                                           \
+  X(vkBindBufferMemory)                                                        \
+  X(vkGetBufferMemoryRequirements2)                                            \
+  X(vkGetBufferDeviceAddress)                                                  \
+  X(vkCreateImage)                                                             \
+  X(vkDestroyImage)                                                            \
+  X(vkBindImageMemory)                                                         \
+  X(vkGetImageMemoryRequirements2)                                             \
+  X(vkCreateImageView)                                                         \
+  X(vkDestroyImageView)                                                        \
+  X(vkCreateSampler)                                                           \
+  X(vkDestroySampler)                                                          \
+  X(vkCreateShaderModule)                                                      \
+  X(vkDestroyShaderModule)                                                     \
+  X(vkCreatePipelineLayout)                                                    \
+  X(vkDestroyPipelineLayout)                                                   \
+  X(vkCreateGraphicsPipelines)                                                 \
+  X(vkDestroyPipeline)                                                         \
+  X(vkCreateDescriptorSetLayout)                                               \
+  X(vkDestroyDescriptorSetLayout)                                              \
+  X(vkCreateDescriptorPool)                                                    \
+  X(vkDestroyDescriptorPool)                                                   \
+  X(vkAllocateDescriptorSets)                                                  \
+  X(vkUpdateDescriptorSets)                                                    \
+  X(vkCreateQueryPool)                                                         \
+  X(vkDestroyQueryPool)                                                        \
+  X(vkGetQueryPoolResults)                                                     \
+  X(vkCreateSemaphore)                                                         \
+  X(vkDestroySemaphore)                                                        \
+  X(vkCreateFence)                                                             \
+  X(vkDestroyFence)                                                            \
+  X(vkWaitForFences)                                                           \
+  X(vkResetFences)                                                             \
+  X(vkGetFenceStatus)                                                          \
+  X(vkCreateCommandPool)                                                       \
+  X(vkDestroyCommandPool)                                                      \
+  X(vkAllocateCommandBuffers)                                                  \
+  X(vkFreeCommandBuffers)                                                      \
+  X(vkBeginCommandBuffer)                                                      \
+  X(vkEndCommandBuffer)                                                        \
+  X(vkCmdPipelineBarrier)                                                      \
+  X(vkCmdPipelineBarrier2)                                                     \
+  X(vkCmdCopyBuffer)                                                           \
+  X(vkCmdUpdateBuffer)                                                         \
+  X(vkCmdCopyBufferToImage)                                                    \
+  X(vkCmdCopyImage)                                                            \
+  X(vkCmdBlitImage)                                                            \
+  X(vkCmdBeginRendering)                                                       \
+  X(vkCmdEndRendering)                                                         \
+  X(vkCmdSetViewport)                                                          \
+  X(vkCmdSetScissor)                                                           \
+  X(vkCmdSetDepthWriteEnable)                                                  \
+  X(vkCmdSetDepthTestEnable)                                                   \
+  X(vkCmdBindPipeline)                                                         \
+  X(vkCmdBindDescriptorSets)                                                   \
+  X(vkCmdBindVertexBuffers)                                                    \
+  X(vkCmdBindIndexBuffer)                                                      \
+  X(vkCmdPushConstants)                                                        \
+  X(vkCmdDraw)                                                                 \
+  X(vkCmdDrawIndexed)                                                          \
+  X(vkCmdDrawIndirect)                                                         \
+  X(vkCmdResetQueryPool)                                                       \
+  X(vkCmdWriteTimestamp)                                                       \
+  X(vkCmdBeginQuery)                                                           \
+  X(vkCmdEndQuery)
+
+// only present when VK_KHR_swapchain is enabled, left null when headless
+#define MAI_SWAPCHAIN_FUNCTIONS(X)                                             \
+  X(vkCreateSwapchainKHR)                                                      \
+  X(vkDestroySwapchainKHR)                                                     \
+  X(vkGetSwapchainImagesKHR)                                                   \
+  X(vkAcquireNextImageKHR)                                                     \
+  X(vkQueuePresentKHR)
+
+struct VKDispatch {
+#define MAI_DECLARE_FUNCTION(name) PFN_##name name = nullptr;
+  MAI_DEVICE_FUNCTIONS(MAI_DECLARE_FUNCTION)
+  MAI_SWAPCHAIN_FUNCTIONS(MAI_DECLARE_FUNCTION)
+#undef MAI_DECLARE_FUNCTION
+
+  // throws when a core entry point is missing
+  void load(VkDevice device, bool swapchain);
+};
+
+}; // namespace MAI
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "vk_allocator.h"
+#include "vk_context.h"
+
+namespace MAI {
+
+// a sub-range of the frame buffer, written through data and read by the GPU
+// through address or buffer + offset
+struct FrameAllocation {
+  VkBuffer buffer = VK_NULL_HANDLE;
+  VkDeviceSize offset = 0;
+  VkDeviceSize size = 0;
+  void *data = nullptr;
+  VkDeviceAddress address = 0;
+};
+
+// bump allocator over one persistently mapped buffer split into
+// MAX_FRAMES_IN_FLIGHT slices. a slice is rewound in beginFrame(), after
+// the draw fence of its frame has signalled, so nothing is ever freed
+// one by one
+struct VKFrameAllocator {
+  VKFrameAllocator(VKContext *vkContext, VkDeviceSize frameSize);
+  ~VKFrameAllocator();
+
+  void beginFrame(uint32_t frameIndex);
+  // alignment 0 picks the strictest uniform/storage offset alignment
+  FrameAllocation allocate(VkDeviceSize size, VkDeviceSize alignment = 0);
+
+  VkBuffer getBuffer() const { return buffer; }
+  VkDeviceSize getFrameSize() const { return frameSize; }
+  // bytes handed out in the current frame
+  VkDeviceSize getFrameUsage() const { return head - frameBegin; }
+
+private:
+  VKContext *vkContext;
+  VkDeviceSize frameSize;
+  VkDeviceSize defaultAlignment;
+  VkBuffer buffer = VK_NULL_HANDLE;
+  Allocation allocation;
+  VkDeviceAddress baseAddress = 0;
+  VkDeviceSize frameBegin = 0;
+  VkDeviceSize head = 0;
+};
+
+}; // namespace MAI
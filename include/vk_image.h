@@ -3,22 +3,78 @@
 #include "vk_buffer.h"
 #include "vk_cmd.h"
 #include "vk_context.h"
+#include "vk_sampler.h"
 #include "vk_swapchain.h"
+#include "vk_texel_convert.h"
 #include <cstdint>
 namespace MAI {
 
 enum TextureFormat : uint8_t {
   MAI_TEXTURE_2D,
   MAI_TEXTURE_CUBE,
+  // layerCount layers of one size, format and sampler
+  MAI_TEXTURE_2D_ARRAY,
   MAI_DEPTH_TEXTURE,
 };
 
+// how TextureInfo::data is laid out, converted to the image format while
+// it is staged
+enum TexelLayout : uint8_t {
+  // already in the image format
+  MAI_TEXELS_NATIVE,
+  MAI_TEXELS_RGBA8,
+  MAI_TEXELS_RGB8,
+  MAI_TEXELS_RGBA32F,
+  MAI_TEXELS_RGB32F,
+};
+
+// numMipLevels value asking for every level down to 1x1
+constexpr uint32_t TEXTURE_FULL_MIP_CHAIN = 0;
+
+// texels covered by one block of a format and its size in bytes, 1x1 for
+// uncompressed formats. bytes is 0 for formats textures cannot be
+// uploaded in
+struct FormatBlock {
+  uint32_t width = 1;
+  uint32_t height = 1;
+  uint32_t bytes = 0;
+};
+FormatBlock getFormatBlock(VkFormat format);
+// bytes of one array layer of a width x height image, whole blocks
+VkDeviceSize getImageSize(VkFormat format, uint32_t width, uint32_t height);
+
 struct TextureInfo {
   uint32_t width;
   uint32_t height;
   const void *data = nullptr;
   TextureFormat format = MAI_TEXTURE_2D;
+  // layers of a MAI_TEXTURE_2D_ARRAY
+  uint32_t layerCount = 1;
+  // levels of the mip chain, generated on the GPU from level 0 by a blit
+  // chain unless data already holds them all
   uint32_t numMipLevels = 1;
+  // data holds every level back to back, largest first, each with all of
+  // its layers
+  bool mipsIncluded = false;
+  // the image format, block compressed formats included. UNDEFINED picks
+  // RGBA8 sRGB for 2D and RGBA32F for cubes
+  VkFormat vkFormat = VK_FORMAT_UNDEFINED;
+  // RGB8 expands to the 8 bit RGBA formats. RGBA32F and RGB32F go to
+  // RGBA32F, RGBA16F, B10G11R11 and E5B9G9R9, the last two 4 bytes a texel
+  // for HDR cubes. other pairs throw
+  TexelLayout dataLayout = MAI_TEXELS_NATIVE;
+  // color times alpha while staging, for 8 bit RGBA and float RGBA formats
+  bool premultiplyAlpha = false;
+  // COLOR_ATTACHMENT or DEPTH_STENCIL_ATTACHMENT makes a 2D render target:
+  // no data and one level, drawn into by VKRender::beginPass() and sampled
+  // in between. UNDEFINED vkFormat picks the device's depth format for
+  // depth targets. SAMPLED is always added
+  VkImageUsageFlags usage = 0;
+  // read while the texture is created only. null picks the defaults,
+  // clamped to the edge for cubes and render targets
+  const SamplerInfo *sampler = nullptr;
+  // shows up in the memory stats and the leak report
+  const char *debugName = nullptr;
 };
 
 struct VKTexture {
@@ -28,43 +84,102 @@ struct VKTexture {
 
   void createImage(uint32_t width, uint32_t height, VkImageType type,
                    VkFormat format, VkImageTiling tiling,
-                   VkImageUsageFlags usage, VkMemoryPropertyFlags properties,
-                   VkImage &image, VkDeviceMemory &imageMemory);
+                   VkImageUsageFlags usage, MemoryUsage memoryUsage,
+                   VkImage &image, Allocation &imageAllocation);
 
   VkImage getTextureImage() const { return texture; }
   VkImageView getTextureImageView() const { return textureView; }
   VkSampler getTextureImageSamper() const { return textureSampler; }
+  // slot of the sampler in the global sampler table
+  uint32_t getSamplerIndex() const { return samplerIndex; }
   TextureFormat getTextureFormat() const { return info_.format; }
   VkFormat getDepthFormat() const { return depthFormat; }
+  // the image format, for PipelineInfo::attachments
+  VkFormat getFormat() const;
+  bool isRenderTarget() const;
+  VkExtent2D getExtent() const { return {info_.width, info_.height}; }
 
   static VkFormat findDepthFormat(VKContext *vkContext);
 
   void setTextureIndex(uint32_t count) { textureIndex = count; }
   uint32_t getTextureIndex() const { return textureIndex; }
+  uint32_t getMipLevels() const { return mipLevels; }
+
+  bool isDeviceLocal() const;
+  uint32_t getMemoryHeap() const;
+  VkDeviceSize getMemorySize() const { return textureAllocation.size; }
+  // moves the image to system memory and frees its device local memory,
+  // the view changes so descriptors have to be written again. false when
+  // the image cannot live outside device memory
+  bool demote();
+  // moves the image to another place in its memory pool, outside draining
+  // blocks, with a copy recorded into commandBuffer. the old image and view
+  // are handed back, the caller destroys them once no frame reads them
+  // anymore and points the descriptors at the new view. false when the pool
+  // has no room
+  bool relocate(VkCommandBuffer commandBuffer, VkImage &oldImage,
+                VkImageView &oldView, Allocation &oldAllocation);
+  const Allocation &getAllocation() const { return textureAllocation; }
 
 private:
   TextureInfo info_;
   VKContext *vkContext;
+  const VKDispatch &vkd;
   VKSwapchain *vkSwapChain;
   VKCmd *vkCmd;
   VkImage texture;
   VkImageView textureView;
+  // owned by the context's sampler cache
   VkSampler textureSampler = VK_NULL_HANDLE;
-  VkDeviceMemory textureMemory;
+  uint32_t samplerIndex = SAMPLER_REPEAT;
+  Allocation textureAllocation;
   VkFormat depthFormat;
   uint32_t textureIndex;
+  uint32_t mipLevels = 1;
 
   void createTextureImage();
+  // left in SHADER_READ_ONLY_OPTIMAL, the layout passes return it to
+  void createRenderTarget();
+  VkImage createImageHandle(uint32_t width, uint32_t height, VkImageType type,
+                            VkFormat format, VkImageTiling tiling,
+                            VkImageUsageFlags usage);
+  VkFormat getColorFormat() const;
+  VkImageAspectFlags getAspect() const;
+  uint32_t getLayerCount() const;
+  VkImageViewType getViewType() const;
+  // null when data is copied as is
+  TexelConvertFunc pickTexelConvert(VkFormat format) const;
+  // levels that will be uploaded or generated, 1 when the format cannot be
+  // blitted
+  uint32_t pickMipLevels(VkFormat format) const;
+  // builds levels 1 and up from level 0, every level in
+  // TRANSFER_DST_OPTIMAL on entry and SHADER_READ_ONLY_OPTIMAL on return
+  void generateMipmaps(VkCommandBuffer commandBuffer, VkFormat format);
+  // copies every layer of texture to image, which ends up ready to sample
+  void recordCopy(VkCommandBuffer commandBuffer, VkImage image);
   void createTextureImageView(VkFormat format, VkImageViewType viewType,
                               VkImageAspectFlags aspect);
   void createTextureSampler();
 
   void createDepthResources();
 
-  void transitionImageLayout(VkImage image, VkFormat format,
-                             VkImageLayout oldLayout, VkImageLayout newLayout);
-  void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width,
-                         uint32_t height);
+  void transitionImageLayout(VkCommandBuffer commandBuffer, VkImage image,
+                             VkFormat format, VkImageLayout oldLayout,
+                             VkImageLayout newLayout);
+  // texel rows [firstRow, firstRow + rows) of layerCount array layers of
+  // one level, tightly packed in the buffer from bufferOffset on
+  VkBufferImageCopy getCopyRegion(VkDeviceSize bufferOffset, uint32_t level,
+                                  uint32_t layer, uint32_t layerCount,
+                                  uint32_t firstRow, uint32_t width,
+                                  uint32_t rows) const;
+  void copyBufferToImage(VkCommandBuffer commandBuffer, VkBuffer buffer,
+                         VkImage image,
+                         const std::vector<VkBufferImageCopy> &regions);
+  // hands the image over from the transfer to the graphics queue and moves
+  // it to newLayout, SHADER_READ_ONLY_OPTIMAL or TRANSFER_DST_OPTIMAL for
+  // the mip chain to be generated
+  void releaseToGraphics(UploadCmd &cmd, VkImage image,
+                         VkImageLayout newLayout);
   static VkFormat findSupportedFormat(VKContext *vkContext,
                                       const std::vector<VkFormat> &candidates,
                                       VkImageTiling tiling,
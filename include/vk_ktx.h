@@ -0,0 +1,56 @@
+#pragma once
+
+#include "vk_context.h"
+#include "vk_image.h"
+#include <vector>
+
+namespace MAI {
+
+// a KTX2 file read into memory. data holds every level largest first, each
+// with all of its faces, the layout TextureInfo::data expects, in the
+// file's own format: block compressed data is never decoded
+struct KTXTexture {
+  VkFormat format = VK_FORMAT_UNDEFINED;
+  uint32_t width = 0;
+  uint32_t height = 0;
+  // 6 for cubemaps
+  uint32_t faceCount = 1;
+  // layers of an array texture, 0 when it is not one
+  uint32_t layerCount = 0;
+  // levels in data, 0 when the file asks for the chain to be generated and
+  // data holds level 0 only
+  uint32_t levelCount = 1;
+  // where each level starts in the file, largest first
+  std::vector<VkDeviceSize> levelOffsets;
+  std::vector<char> data;
+
+  // ready for MAIRenderer::createTexture(), data points into this
+  TextureInfo getTextureInfo(const char *debugName = nullptr) const;
+  TextureFormat getTextureFormat() const;
+  // layers of the image, faces count as layers
+  uint32_t getLayerCount() const;
+  // bytes of one level, all layers and faces
+  VkDeviceSize getLevelSize(uint32_t level) const;
+};
+
+// throws on anything but an uncompressed-supercompression 2D, 2D array or
+// cube KTX2 file in a format getFormatBlock() knows. with headerOnly, data
+// stays empty and only the header is read
+KTXTexture loadKTX(const char *filename, bool headerOnly = false);
+// size bytes start with the KTX2 identifier
+bool isKTX(const char *file, size_t size);
+// the same checks on a file already in memory, e.g. mapped. fills
+// levelOffsets, data stays empty
+KTXTexture parseKTX(const char *file, size_t size, const char *filename);
+
+// the device samples format with optimal tiling, and the feature of its
+// compression family is enabled
+bool isTextureFormatSupported(VKContext *vkContext, VkFormat format);
+
+// index of the first file whose format the device supports, -1 when none
+// is. a texture shipped as e.g. BC7, ASTC and ETC2 files, best first, lets
+// every device pick one it samples as is
+int32_t pickKTX(VKContext *vkContext,
+                const std::vector<const char *> &filenames);
+
+}; // namespace MAI
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstddef>
+
+namespace MAI {
+
+// a whole file mapped read only. pages are read from disk on first touch,
+// by whichever thread touches them, and the kernel may drop them again
+// under memory pressure. POSIX only for now
+struct VKMappedFile {
+  VKMappedFile(const char *filename);
+  ~VKMappedFile();
+
+  const char *getData() const { return mapping; }
+  size_t getSize() const { return fileSize; }
+  // asks the kernel to start reading [offset, offset + size) in
+  void prefetch(size_t offset, size_t size) const;
+
+private:
+  const char *mapping = nullptr;
+  size_t fileSize = 0;
+};
+
+}; // namespace MAI
@@ -2,6 +2,7 @@
 #include "vk_context.h"
 #include "vk_shader.h"
 #include "vk_swapchain.h"
+#include <optional>
 namespace MAI {
 
 struct VertexAttribute {
@@ -28,6 +29,12 @@ struct ColorInfo {
   VkBlendFactor dstColorBlend;
 };
 
+// formats of the pass a pipeline draws into, see VKTexture::getFormat()
+struct AttachmentFormats {
+  std::vector<VkFormat> colors;
+  VkFormat depth = VK_FORMAT_UNDEFINED;
+};
+
 struct PipelineInfo {
   VKShader *vert = nullptr;
   VKShader *frag = nullptr;
@@ -39,6 +46,9 @@ struct PipelineInfo {
   VertextInput vertInput;
   ColorInfo color;
   VkPushConstantRange pushConstants;
+  // empty for the swapchain pass. with formats given the pipeline never
+  // reads the swapchain, which may be null
+  std::optional<AttachmentFormats> attachments;
 };
 
 struct VKPipeline {
@@ -50,9 +60,13 @@ struct VKPipeline {
   VkShaderStageFlags getPushConstantShaderStages() const {
     return info_.pushConstants.stageFlags;
   }
+  uint32_t getPushConstantSize() const { return info_.pushConstants.size; }
+  // no vertex input declared: the shaders fetch their own geometry
+  bool isVertexPulling() const { return info_.vertInput.attributes.empty(); }
 
 private:
   VKContext *vkContext;
+  const VKDispatch &vkd;
   VKSwapchain *vkSwapchain;
   VkPipeline pipeline;
   VkPipelineLayout pipelineLayout;
@@ -0,0 +1,107 @@
+#pragma once
+
+#include "vk_context.h"
+#include <chrono>
+#include <deque>
+#include <string>
+#include <vector>
+
+namespace MAI {
+
+struct ProfilerInfo {
+  // collect pipeline statistics for every top-level GPU scope
+  bool pipelineStatistics = false;
+  // GPU scopes per frame, the query pools are sized from this
+  uint32_t maxScopes = 256;
+  // resolved events kept for the trace, oldest are dropped first
+  uint32_t maxEvents = 1 << 20;
+};
+
+struct PipelineStatistics {
+  uint64_t inputAssemblyVertices = 0;
+  uint64_t inputAssemblyPrimitives = 0;
+  uint64_t vertexShaderInvocations = 0;
+  uint64_t clippingInvocations = 0;
+  uint64_t clippingPrimitives = 0;
+  uint64_t fragmentShaderInvocations = 0;
+};
+
+struct ProfilerEvent {
+  std::string name;
+  double startUs;
+  double durationUs;
+  bool gpu;
+  bool hasStatistics = false;
+  PipelineStatistics statistics;
+};
+
+// GPU timestamp and pipeline statistics scopes plus CPU scopes, exported as
+// a Chrome trace (chrome://tracing, Perfetto).
+// every frame in flight owns its own query pools, results of a frame are
+// read back without waiting once its draw fence has been waited on again
+struct VKProfiler {
+  VKProfiler(VKContext *vkContext, ProfilerInfo info);
+  ~VKProfiler();
+
+  // record side, called by VKRender with the frame command buffer
+  void beginFrame(VkCommandBuffer commandBuffer, uint32_t frameIndex);
+  void endFrame(VkCommandBuffer commandBuffer);
+  void markSubmitted();
+
+  void beginScope(VkCommandBuffer commandBuffer, const char *name);
+  void endScope(VkCommandBuffer commandBuffer);
+
+  void beginCpuScope(const char *name);
+  void endCpuScope();
+
+  const std::deque<ProfilerEvent> &getEvents() const { return events; }
+  bool hasPipelineStatistics() const { return statisticsPools.size() > 0; }
+  // resolves the frames whose queries are available first, so the last
+  // frames in flight are not missing from the trace
+  bool writeChromeTrace(const char *filename);
+
+private:
+  struct GpuScope {
+    std::string name;
+    uint32_t beginQuery;
+    uint32_t endQuery = UINT32_MAX;
+    uint32_t statisticsQuery = UINT32_MAX;
+  };
+
+  struct FrameQueries {
+    std::vector<GpuScope> scopes;
+    uint32_t timestampCount = 0;
+    uint32_t statisticsCount = 0;
+    double submitUs = 0.0;
+    bool pending = false;
+  };
+
+  struct CpuScope {
+    std::string name;
+    double startUs;
+  };
+
+  VKContext *vkContext;
+  const VKDispatch &vkd;
+  ProfilerInfo info_;
+  double timestampPeriod;
+  uint64_t timestampMask;
+  std::chrono::steady_clock::time_point startTime;
+
+  std::vector<VkQueryPool> timestampPools;
+  std::vector<VkQueryPool> statisticsPools;
+  std::vector<FrameQueries> frames;
+  std::vector<uint32_t> openScopes;
+  std::vector<CpuScope> openCpuScopes;
+  std::deque<ProfilerEvent> events;
+  uint32_t frameIndex = 0;
+  bool recording = false;
+
+  double nowUs() const;
+  void createQueryPools();
+  // false when the queries are not available yet, the frame stays pending
+  bool resolveFrame(uint32_t frame);
+  void resolvePending();
+  void pushEvent(ProfilerEvent event);
+};
+}; // namespace MAI
@@ -3,24 +3,64 @@
 #include "vk_cmd.h"
 #include "vk_context.h"
 #include "vk_image.h"
+#include "vk_profiler.h"
+#include "vk_render_target.h"
 #include "vk_swapchain.h"
 #include "vk_sync.h"
+#include <functional>
 namespace MAI {
 
+// records into the frame's command buffer before rendering begins
+using FrameUploadFunc = std::function<void(VkCommandBuffer commandBuffer)>;
+
 struct DepthInfo {
   VkCompareOp compareOp;
   bool depthWriteEnable = false;
 };
 
+// a render target texture of an offscreen pass. UNDEFINED is the layout
+// before the pass unless loadOp is LOAD, so the old texels are only kept
+// when asked for
+struct PassAttachment {
+  VKTexture *texture = nullptr;
+  VkAttachmentLoadOp loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+  VkAttachmentStoreOp storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+  VkClearValue clearValue = {};
+};
+
+// every attachment has the extent of the first one. depth.texture may be
+// null
+struct RenderPassInfo {
+  std::vector<PassAttachment> colors;
+  PassAttachment depth;
+};
+
 struct VKRender {
+  // the depth attachment comes from renderTargets and follows the
+  // swapchain extent
   VKRender(VKContext *vkContext, VKSync *vkSyncObj, VKSwapchain *vkSwapchain,
-           VKCmd *vkCmd, VKTexture *texture);
+           VKCmd *vkCmd, VKRenderTargetPool *renderTargets);
   ~VKRender();
 
   void beginFrame(float clearValue[4]);
   void endFrame();
   void submitFrame();
+  // offscreen passes come before the first draw into the swapchain image,
+  // which begins on that draw. the attachments are sampled by the fragment
+  // shaders of later passes once endPass() returns them to
+  // SHADER_READ_ONLY_OPTIMAL
+  void beginPass(const RenderPassInfo &info);
+  void endPass();
   uint32_t getFrameIndex() const { return frameIndex; }
+  uint32_t getImageIndex() const { return imageIndex; }
+  VkCommandBuffer getCommandBuffer() const {
+    return vkCmd->getCommandBuffers()[frameIndex];
+  }
+
+  void setProfiler(VKProfiler *profiler) { vkProfiler = profiler; }
+  void setFrameUploads(FrameUploadFunc func) { frameUploads = func; }
+  void cmdBeginProfileScope(const char *name);
+  void cmdEndProfileScope();
 
   void bindPipline(VkPipelineBindPoint bindPoint, VkPipeline pipeline);
   void
@@ -32,6 +72,8 @@ struct VKRender {
   void cmdDrawIndex(uint32_t indexCount, uint32_t instanceCount,
                     uint32_t firstIndex, int32_t vertexOffset,
                     uint32_t firstInstance);
+  void cmdDrawIndirect(VkBuffer buffer, VkDeviceSize offset,
+                       uint32_t drawCount, uint32_t stride);
 
   void cmdBindVertexBuffers(uint32_t firstBinding, uint32_t bindingCount,
                             const VkBuffer *pBuffers,
@@ -45,15 +87,29 @@ struct VKRender {
 
 private:
   VKContext *vkContext;
+  const VKDispatch &vkd;
   VKSync *vkSync;
   VKSwapchain *vkSwapchain;
   VKCmd *vkCmd;
-  VKTexture *depthTexture;
+  VKRenderTargetPool *renderTargets;
+  RenderTarget *depthTarget = nullptr;
+  VKProfiler *vkProfiler = nullptr;
+  FrameUploadFunc frameUploads;
 
   uint32_t frameIndex = 0;
   uint32_t imageIndex;
   VkFence drawFences;
+  VkClearValue clearColor;
+  RenderPassInfo pass;
+  bool passActive = false;
+  bool mainPassActive = false;
 
   void acquireSwapChainImageIndex();
+  void beginMainPass();
+  // before a draw, begins the swapchain pass outside an offscreen one
+  void ensureRendering();
+  void setViewport(VkExtent2D extent);
+  void recreateSwapChain();
+  void submitHeadlessFrame();
 };
 }; // namespace MAI
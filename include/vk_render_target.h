@@ -0,0 +1,71 @@
+#pragma once
+
+#include "vk_allocator.h"
+#include "vk_context.h"
+#include <vector>
+
+namespace MAI {
+
+// frames a released target stays cached before its memory is freed
+constexpr uint64_t RENDER_TARGET_IDLE_FRAMES = 120;
+// released targets kept per format, usage and transience. a resize drag
+// releases one of another extent every frame, past this the oldest go
+constexpr uint32_t RENDER_TARGET_MAX_CACHED = 4;
+
+struct RenderTargetInfo {
+  VkExtent2D extent;
+  VkFormat format;
+  VkImageUsageFlags usage;
+  // contents never outlive the rendering that writes them (cleared or
+  // don't care on load, STORE_OP_DONT_CARE). such attachments get
+  // TRANSIENT_ATTACHMENT usage and lazily allocated memory where the device
+  // has it, tiled GPUs then never back them with memory at all
+  bool transient = false;
+};
+
+struct RenderTarget {
+  VkImage image = VK_NULL_HANDLE;
+  VkImageView view = VK_NULL_HANDLE;
+  Allocation allocation;
+  RenderTargetInfo info;
+};
+
+// attachment images recycled across frames and swapchain resizes, keyed by
+// extent, format, usage and transience. a resize drag that comes back to
+// a recent size finds its targets still cached
+struct VKRenderTargetPool {
+  VKRenderTargetPool(VKContext *vkContext);
+  ~VKRenderTargetPool();
+
+  // a cached target matching info, or a new one. its contents are undefined
+  RenderTarget *acquire(const RenderTargetInfo &info);
+  // the target is handed out again once the frames in flight that may
+  // still render to it are done, right away when the caller has waited for
+  // the device
+  void release(RenderTarget *target, bool idle = false);
+  // once per submitted frame, frees targets released long ago
+  void nextFrame();
+
+  size_t getCachedCount() const { return cached.size(); }
+
+private:
+  struct Cached {
+    RenderTarget *target;
+    // first frame it may be acquired in
+    uint64_t reuseFrame;
+  };
+
+  VKContext *vkContext;
+  const VKDispatch &vkd;
+  uint64_t frame = 0;
+  // released targets, most recent last
+  std::vector<Cached> cached;
+
+  RenderTarget *createTarget(const RenderTargetInfo &info);
+  // frees the oldest targets of each kind over RENDER_TARGET_MAX_CACHED,
+  // once no frame in flight renders to them
+  void trim();
+  void destroyTarget(RenderTarget *target);
+};
+
+}; // namespace MAI
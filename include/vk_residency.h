@@ -0,0 +1,56 @@
+#pragma once
+
+#include "vk_context.h"
+#include <functional>
+#include <unordered_map>
+
+namespace MAI {
+
+struct VKbuffer;
+struct VKTexture;
+
+// called after a texture moved, its view changed
+using TextureMovedFunc = std::function<void(VKTexture *texture)>;
+
+// least recently used order of the textures and buffers that may leave
+// device local memory. VKAllocator asks evict() for room when a device
+// local heap goes over its budget or runs out
+struct VKResidency {
+  VKResidency(VKContext *vkContext);
+
+  void addTexture(VKTexture *texture) { textures[texture] = frame; }
+  void addBuffer(VKbuffer *buffer) { buffers[buffer] = frame; }
+  void removeTexture(VKTexture *texture) { textures.erase(texture); }
+  void removeBuffer(VKbuffer *buffer) { buffers.erase(buffer); }
+
+  // bindless textures are not seen by the renderer, callers report use
+  void touch(VKTexture *texture);
+  void touch(VKbuffer *buffer);
+  void nextFrame() { frame++; }
+
+  // demotes device local resources on heap to system memory, least
+  // recently used first, until size bytes are freed. resources used in the
+  // frame being recorded are left alone
+  bool evict(uint32_t heap, VkDeviceSize size);
+
+  void setTextureMovedCallback(TextureMovedFunc func) { textureMoved = func; }
+
+  // everything tracked may move, keyed to the frame it was last used in
+  const std::unordered_map<VKTexture *, uint64_t> &getTextures() const {
+    return textures;
+  }
+  const std::unordered_map<VKbuffer *, uint64_t> &getBuffers() const {
+    return buffers;
+  }
+
+private:
+  VKContext *vkContext;
+  uint64_t frame = 0;
+  std::unordered_map<VKTexture *, uint64_t> textures;
+  std::unordered_map<VKbuffer *, uint64_t> buffers;
+  TextureMovedFunc textureMoved;
+  // guards against re-entry through the demotions' own allocations
+  bool evicting = false;
+};
+
+}; // namespace MAI
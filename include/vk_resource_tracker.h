@@ -0,0 +1,55 @@
+#pragma once
+
+#include "vk_allocator.h"
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+
+namespace MAI {
+
+enum ResourceKind : uint8_t {
+  MAI_RESOURCE_BUFFER,
+  MAI_RESOURCE_TEXTURE,
+};
+
+// a snapshot of VKResourceTracker::getStats(), bytes are device memory
+struct ResourceStats {
+  MemoryCounter buffers;
+  MemoryCounter textures;
+  // by debug name, resources without one count as "unnamed"
+  std::map<std::string, MemoryCounter> names;
+};
+
+// every live VKbuffer and VKTexture of a context, with its debug name and
+// the memory behind it. what is still here when the renderer goes away
+// was never deleted
+struct VKResourceTracker {
+  void add(const void *resource, ResourceKind kind, const char *debugName,
+           VkDeviceSize bytes);
+  void remove(const void *resource);
+
+  ResourceStats getStats();
+  // one line per live resource, false when there is none
+  bool reportLeaks(std::ostream &out);
+
+private:
+  struct Record {
+    ResourceKind kind;
+    std::string name;
+    VkDeviceSize bytes;
+    // creation order, so reports list the oldest leak first
+    uint64_t serial;
+  };
+
+  // resources may be created by loader threads
+  std::mutex mutex;
+  std::unordered_map<const void *, Record> records;
+  ResourceStats stats;
+  uint64_t nextSerial = 0;
+
+  MemoryCounter &kindCounter(ResourceKind kind);
+};
+
+}; // namespace MAI
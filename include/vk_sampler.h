@@ -0,0 +1,79 @@
+#pragma once
+
+#include "vk_context.h"
+#include <functional>
+#include <vector>
+
+namespace MAI {
+
+// entries of the sampler table, binding 1 of the global descriptor set
+constexpr uint32_t MAX_SAMPLERS = 64;
+// always in the table: the default texture sampler, and the same clamped
+// to the edge as cubemaps use it
+constexpr uint32_t SAMPLER_REPEAT = 0;
+constexpr uint32_t SAMPLER_CLAMP = 1;
+
+// the full state of a sampler, two equal infos share one VkSampler. the
+// defaults are the texture sampler: trilinear, anisotropic, repeating
+struct SamplerInfo {
+  VkFilter magFilter = VK_FILTER_LINEAR;
+  VkFilter minFilter = VK_FILTER_LINEAR;
+  VkSamplerMipmapMode mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+  VkSamplerAddressMode addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+  VkSamplerAddressMode addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+  VkSamplerAddressMode addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+  float mipLodBias = 0.0f;
+  bool anisotropyEnable = true;
+  // 0 picks the device limit, larger values are clamped to it
+  float maxAnisotropy = 0.0f;
+  bool compareEnable = false;
+  VkCompareOp compareOp = VK_COMPARE_OP_ALWAYS;
+  float minLod = 0.0f;
+  // the image view already limits the levels, so textures with different
+  // mip counts still share a sampler
+  float maxLod = VK_LOD_CLAMP_NONE;
+  VkBorderColor borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
+  bool unnormalizedCoordinates = false;
+
+  bool operator==(const SamplerInfo &) const = default;
+};
+
+// a cached sampler and its slot in the sampler table
+struct Sampler {
+  VkSampler sampler = VK_NULL_HANDLE;
+  uint32_t index = 0;
+};
+
+// writes a new sampler into slot index of the sampler table
+using SamplerAddedFunc = std::function<void(VkSampler sampler, uint32_t index)>;
+
+// one VkSampler per distinct SamplerInfo, shared by every texture asking
+// for it and kept until the context goes. drivers allow few sampler
+// objects (maxSamplerAllocationCount is often 4000), fewer than we have
+// textures, and shaders pick from the small table by index instead of
+// reading one sampler per texture slot
+struct VKSamplerCache {
+  VKSamplerCache(VKContext *vkContext);
+  ~VKSamplerCache();
+
+  // throws once MAX_SAMPLERS distinct samplers exist
+  Sampler getSampler(const SamplerInfo &info);
+  // also called right away for every sampler created so far
+  void setSamplerAddedCallback(SamplerAddedFunc func);
+  uint32_t getSamplerCount() const {
+    return static_cast<uint32_t>(samplers.size());
+  }
+
+private:
+  struct Entry {
+    SamplerInfo info;
+    VkSampler sampler;
+  };
+
+  VKContext *vkContext;
+  // the table slot of a sampler is its position here
+  std::vector<Entry> samplers;
+  SamplerAddedFunc samplerAdded;
+};
+
+}; // namespace MAI
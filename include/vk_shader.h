@@ -13,6 +13,7 @@ struct VKShader {
 private:
   const char *filename;
   VKContext *vkContext;
+  const VKDispatch &vkd;
   VkShaderModule shaderModule = nullptr;
   VkShaderStageFlagBits stage;
 
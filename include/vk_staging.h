@@ -0,0 +1,49 @@
+#pragma once
+
+#include "vk_allocator.h"
+#include <deque>
+
+namespace MAI {
+
+// a slice of the staging ring, data points into the persistent mapping
+struct StagingRegion {
+  VkBuffer buffer = VK_NULL_HANDLE;
+  VkDeviceSize offset = 0;
+  VkDeviceSize size = 0;
+  void *data = nullptr;
+};
+
+// one persistently mapped TRANSFER_SRC buffer shared by every upload.
+// regions are handed out in ring order and tagged with the id of the upload
+// that reads them, VKCmd retires them once that upload's fence signals
+struct VKStagingRing {
+  VKStagingRing(VKContext *vkContext, VkDeviceSize capacity);
+  ~VKStagingRing();
+
+  // false when the ring has no room until older uploads retire
+  bool allocate(VkDeviceSize size, VkDeviceSize alignment, uint64_t uploadId,
+                StagingRegion &region);
+  // frees the regions of uploadId, space is reclaimed in ring order
+  void retire(uint64_t uploadId);
+  // id of the upload holding the oldest region, 0 when the ring is empty
+  uint64_t getOldestUpload() const;
+
+  VkDeviceSize getCapacity() const { return capacity; }
+
+private:
+  struct Entry {
+    uint64_t uploadId;
+    VkDeviceSize begin;
+    VkDeviceSize end;
+    bool retired = false;
+  };
+
+  VKContext *vkContext;
+  VkDeviceSize capacity;
+  VkBuffer buffer = VK_NULL_HANDLE;
+  Allocation allocation;
+  // live regions, oldest first
+  std::deque<Entry> entries;
+};
+
+}; // namespace MAI
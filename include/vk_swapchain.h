@@ -1,5 +1,6 @@
 #pragma once
 
+#include "vk_allocator.h"
 #include "vk_context.h"
 #include <vector>
 
@@ -13,7 +14,9 @@ struct SwapChainSupportDetails {
 
 struct VKSwapchain {
 
-  VKSwapchain(VKContext *vkContext_);
+  // headlessExtent sizes the offscreen image ring of a headless context and
+  // is ignored when presenting to a surface
+  VKSwapchain(VKContext *vkContext_, VkExtent2D headlessExtent = {});
   ~VKSwapchain();
 
   VkSwapchainKHR getSwapchain() const { return swapchain; }
@@ -30,14 +33,19 @@ struct VKSwapchain {
 
 private:
   VKContext *vkContext;
-  VkSwapchainKHR swapchain;
+  const VKDispatch &vkd;
+  VkSwapchainKHR swapchain = VK_NULL_HANDLE;
   VkFormat swapchainImageFormat;
   VkExtent2D swapchainExtent;
+  VkExtent2D headlessExtent;
 
   std::vector<VkImage> swapchainImages;
   std::vector<VkImageView> swapchainImageViews;
+  // backing memory of the headless image ring
+  std::vector<Allocation> headlessImageAllocations;
 
   void createSwapChain();
+  void createHeadlessImages();
 
   void createSwapChainImageViews();
   void cleanupSwapchain();
@@ -18,6 +18,7 @@ struct VKSync {
 
 private:
   VKContext *vkContext;
+  const VKDispatch &vkd;
 
   std::vector<VkSemaphore> imageAvailableSemaphores;
   std::vector<VkSemaphore> renderFinishSemaphores;
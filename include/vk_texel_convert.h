@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace MAI {
+
+// converts texels from the layout an image loader hands out into the one
+// of an image format, straight into the staging mapping. every kernel has
+// a scalar version and an SSE4.1 or AVX2/F16C one picked at runtime on
+// x86, the results are bit identical but for the payload of a NaN times
+// a NaN alpha when premultiplying. NaN and negative values become 0 in
+// the unsigned float formats, values past the largest finite one of a
+// format clamp to it
+using TexelConvertFunc = void (*)(const void *src, void *dst, size_t texels);
+
+// alpha is 255
+void convertRGB8ToRGBA8(const void *src, void *dst, size_t texels);
+// the encoded values are scaled, rounded to nearest
+void premultiplyRGBA8(const void *src, void *dst, size_t texels);
+// alpha is 1
+void convertRGB32FToRGBA32F(const void *src, void *dst, size_t texels);
+void premultiplyRGBA32F(const void *src, void *dst, size_t texels);
+// to VK_FORMAT_R16G16B16A16_SFLOAT, rounded to nearest even
+void convertRGBA32FToRGBA16F(const void *src, void *dst, size_t texels);
+void premultiplyRGBA32FToRGBA16F(const void *src, void *dst, size_t texels);
+void convertRGB32FToRGBA16F(const void *src, void *dst, size_t texels);
+// to VK_FORMAT_B10G11R11_UFLOAT_PACK32, alpha is dropped
+void convertRGBA32FToB10G11R11(const void *src, void *dst, size_t texels);
+void convertRGB32FToB10G11R11(const void *src, void *dst, size_t texels);
+// to VK_FORMAT_E5B9G9R9_UFLOAT_PACK32, alpha is dropped
+void convertRGBA32FToE5B9G9R9(const void *src, void *dst, size_t texels);
+void convertRGB32FToE5B9G9R9(const void *src, void *dst, size_t texels);
+
+}; // namespace MAI
@@ -0,0 +1,192 @@
+#pragma once
+
+#include "vk_context.h"
+#include "vk_defragmenter.h"
+#include "vk_image.h"
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace MAI {
+
+// a decoded image. the loader points info.data at pixels before the texture
+// is created
+struct DecodedTexture {
+  TextureInfo info;
+  std::vector<char> pixels;
+  // set by the loader before decoding, the device's maxImageDimension2D.
+  // larger images are rejected before anything is allocated for them, 0
+  // for no limit
+  uint32_t maxDimension = 0;
+};
+
+// decodes an encoded image of size bytes. false when data is not in the
+// decoder's format, throws when it is but cannot be decoded. runs on every
+// worker at once
+using TextureDecodeFunc =
+    std::function<bool(const char *data, size_t size, DecodedTexture &out)>;
+
+// KTX2 files in any layout loadKTX() takes, levels as stored
+bool decodeKTX(const char *data, size_t size, DecodedTexture &out);
+// Radiance .hdr files, flat or RLE scanlines, as RGB32F texels converted to
+// RGBA16F unless a compact format is asked for
+bool decodeHDR(const char *data, size_t size, DecodedTexture &out);
+
+struct TextureLoaderInfo {
+  // decode threads, 0 for one per core but the render thread's
+  uint32_t workerCount = 0;
+  // decoded bytes uploaded per frame, the first upload of a frame always
+  // runs so a large image cannot stall forever
+  VkDeviceSize maxBytesPerFrame = 32ull << 20;
+};
+
+struct AsyncTextureInfo {
+  // read on a worker, copied by load(). without it data holds size bytes
+  // of an encoded image that stays valid until the texture is ready or has
+  // failed
+  const char *filename = nullptr;
+  const void *data = nullptr;
+  size_t size = 0;
+  // picks the binding of the placeholder, a decoded image of another kind
+  // fails the load
+  TextureFormat format = MAI_TEXTURE_2D;
+  // image format for decoders that hand out plain texels, e.g. E5B9G9R9 for
+  // HDR images. UNDEFINED keeps the decoder's choice, block compressed
+  // data is always uploaded as stored
+  VkFormat vkFormat = VK_FORMAT_UNDEFINED;
+  bool premultiplyAlpha = false;
+  // copied, unlike TextureInfo::sampler. empty picks the defaults
+  std::optional<SamplerInfo> sampler;
+  const char *debugName = nullptr;
+};
+
+enum AsyncTextureState : uint8_t {
+  MAI_TEXTURE_DECODING,
+  // created, the copy has been submitted
+  MAI_TEXTURE_UPLOADING,
+  // the copy is done and the bindless slot points at the image
+  MAI_TEXTURE_READY,
+  MAI_TEXTURE_FAILED,
+};
+
+// a texture whose slot shows a placeholder until its image is decoded and
+// uploaded
+struct VKAsyncTexture {
+  uint32_t getTextureIndex() const { return textureIndex; }
+  TextureFormat getTextureFormat() const { return format; }
+  AsyncTextureState getState() const { return state; }
+  bool isReady() const { return state == MAI_TEXTURE_READY; }
+  // null until the texture is ready
+  VKTexture *getTexture() const { return isReady() ? texture : nullptr; }
+  // why the load failed, the slot keeps the placeholder
+  const std::string &getError() const { return error; }
+
+private:
+  friend struct VKTextureLoader;
+
+  TextureFormat format = MAI_TEXTURE_2D;
+  AsyncTextureState state = MAI_TEXTURE_DECODING;
+  VKTexture *texture = nullptr;
+  uint32_t textureIndex = 0;
+  // upload to wait for while MAI_TEXTURE_UPLOADING
+  uint64_t uploadId = 0;
+  std::string error;
+  // destroyTexture() came while decoding, freed once the decode is back
+  bool destroyed = false;
+};
+
+// decodes textures on a pool of worker threads and uploads them at the
+// start of a frame, one upload batch per frame so nothing waits on the GPU.
+// the texel conversion to the image format happens as the data is staged.
+// once the copy of a texture is complete, the descriptor set of each frame
+// is repointed from the placeholder when that frame begins, the same way
+// VKDefragmenter does
+struct VKTextureLoader {
+  VKTextureLoader(VKContext *vkContext, VKCmd *vkCmd, TextureLoaderInfo info);
+  ~VKTextureLoader();
+
+  // tried before the KTX2 and HDR decoders, the last added first. PNG and
+  // JPEG need one, e.g. wrapping an image library the application links.
+  // only before the first load()
+  void addDecoder(TextureDecodeFunc decoder);
+
+  // queues the decode and returns at once
+  VKAsyncTexture *load(AsyncTextureInfo info);
+  // the bindless slot the texture keeps for its lifetime
+  void setTextureIndex(VKAsyncTexture *texture, uint32_t index);
+  // 1x1 image sampled until a texture of format is ready
+  VKTexture *getPlaceholder(TextureFormat format);
+  // the image goes once no frame in flight reads it
+  void destroyTexture(VKAsyncTexture *texture);
+
+  // runs at the start of frame frameIndex, after its fence has signalled
+  // and outside any upload batch
+  void update(uint32_t frameIndex);
+
+  void setDescriptorFixupCallback(DescriptorFixupFunc func) {
+    descriptorFixup = func;
+  }
+  // textures not ready and not failed
+  size_t getPendingCount() const;
+
+private:
+  struct Job {
+    VKAsyncTexture *texture;
+    AsyncTextureInfo info;
+    // info.filename may not outlive load()
+    std::string filename;
+    // filled by the worker
+    DecodedTexture decoded;
+    std::string error;
+  };
+  struct Retired {
+    uint64_t frame;
+    VKTexture *texture;
+    // the copy into it may still run
+    uint64_t uploadId;
+  };
+  struct Fixup {
+    VKAsyncTexture *texture;
+    // frames in flight whose descriptor set still has the placeholder
+    uint32_t frames;
+  };
+
+  VKContext *vkContext;
+  VKCmd *vkCmd;
+  TextureLoaderInfo info_;
+  DescriptorFixupFunc descriptorFixup;
+  uint64_t frame = 0;
+
+  std::vector<VKAsyncTexture *> textures;
+  std::vector<Retired> retired;
+  std::vector<Fixup> fixups;
+  VKTexture *placeholders[MAI_TEXTURE_2D_ARRAY + 1] = {};
+
+  // shared with the workers
+  std::vector<TextureDecodeFunc> decoders;
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::deque<Job> queued;
+  std::deque<Job> decoded;
+  bool stopping = false;
+  std::vector<std::thread> workers;
+
+  void work();
+  void decode(Job &job) const;
+  // creates the image of a decoded job inside the open upload batch
+  void create(Job &job);
+  // textures whose copy is done get their slot
+  void swapIn(uint32_t frameIndex);
+  void fail(VKAsyncTexture *texture, const std::string &error);
+  // destroyed once no frame reads it and its copy is done
+  void retire(VKAsyncTexture *texture);
+  void release(bool all);
+  void fixDescriptors(uint32_t frameIndex);
+};
+
+}; // namespace MAI
@@ -0,0 +1,155 @@
+#pragma once
+
+#include "vk_context.h"
+#include "vk_defragmenter.h"
+#include "vk_image.h"
+#include "vk_ktx.h"
+#include "vk_mapped_file.h"
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace MAI {
+
+struct StreamedTextureInfo {
+  // KTX2 file with every level stored, see loadKTX()
+  const char *filename;
+  // the smallest levels, resident from creation on and never dropped
+  uint32_t residentLevels = 4;
+  const char *debugName = nullptr;
+};
+
+struct StreamingInfo {
+  // level bytes swapped in per frame, the first swap of a frame always
+  // runs so a large level cannot stall forever
+  VkDeviceSize maxBytesPerFrame = 16ull << 20;
+};
+
+// a texture whose finer levels are paged in from a mapped KTX2 file on
+// demand. the image only holds the resident levels: level 0 of the image
+// is getResidentLevel() of the file, so the image the bindless slot
+// points at grows and shrinks as levels arrive and leave
+struct VKStreamedTexture {
+  // the current image, replaced whenever the resident levels change
+  VKTexture *getTexture() const { return texture; }
+  uint32_t getTextureIndex() const { return textureIndex; }
+  // finest level of the file in the image
+  uint32_t getResidentLevel() const { return residentLevel; }
+  uint32_t getLevelCount() const { return ktx.levelCount; }
+  TextureFormat getTextureFormat() const { return ktx.getTextureFormat(); }
+
+private:
+  friend struct VKTextureStreamer;
+
+  // wanted is finer than resident, or far enough coarser to drop levels
+  bool needsLoad() const {
+    return wantedLevel < residentLevel || wantedLevel >= residentLevel + 2;
+  }
+
+  VKMappedFile *file = nullptr;
+  KTXTexture ktx;
+  const char *debugName = nullptr;
+  VKTexture *texture = nullptr;
+  uint32_t textureIndex = 0;
+  uint32_t residentLevel = 0;
+  // finest of the levels that always stay resident
+  uint32_t lowestLevel = 0;
+  uint32_t wantedLevel = 0;
+  // a load is queued or running, or its data waits to be swapped in
+  bool loading = false;
+  // destroyTexture() came while loading, freed once the load is back
+  bool destroyed = false;
+};
+
+// pages texture levels in on a worker thread and swaps them in at the
+// start of a frame. the worker copies the levels out of the mapping, so
+// disk reads and page faults never happen on the render thread; the
+// upload itself goes through the staging ring in one batch per frame.
+// replaced images are destroyed MAX_FRAMES_IN_FLIGHT frames later and the
+// descriptor set of each frame is repointed when that frame begins, the
+// same way VKDefragmenter does
+struct VKTextureStreamer {
+  VKTextureStreamer(VKContext *vkContext, VKCmd *vkCmd, StreamingInfo info);
+  ~VKTextureStreamer();
+
+  // maps the file and uploads the resident levels
+  VKStreamedTexture *createTexture(StreamedTextureInfo info);
+  // the bindless slot the texture keeps for its lifetime
+  void setTextureIndex(VKStreamedTexture *texture, uint32_t index);
+  // the image goes once no frame in flight reads it
+  void destroyTexture(VKStreamedTexture *texture);
+
+  // finest level the texture should have. finer levels are paged in, and
+  // levels finer than wanted are dropped once it is 2 or more levels
+  // coarser than the resident one, so a camera at a level boundary does
+  // not load and drop the same level every frame
+  void requestLevel(VKStreamedTexture *texture, uint32_t level);
+  // the level to request for a texture seen from distance, when level 0
+  // is needed up to fullDetailDistance: one level coarser per doubling
+  static uint32_t levelForDistance(float distance, float fullDetailDistance);
+
+  // runs at the start of frame frameIndex, after its fence has signalled
+  // and outside any upload batch
+  void update(uint32_t frameIndex);
+
+  void setDescriptorFixupCallback(DescriptorFixupFunc func) {
+    descriptorFixup = func;
+  }
+  // textures with a load queued, running or waiting to be swapped in
+  size_t getPendingCount() const;
+
+private:
+  struct Load {
+    VKStreamedTexture *texture;
+    uint32_t level;
+    // the file's levels from level on, largest first
+    std::vector<char> data;
+  };
+  struct Retired {
+    uint64_t frame;
+    VKTexture *texture;
+  };
+  struct Fixup {
+    VKStreamedTexture *texture;
+    // frames in flight whose descriptor set still has the old view
+    uint32_t frames;
+  };
+
+  VKContext *vkContext;
+  VKCmd *vkCmd;
+  StreamingInfo info_;
+  DescriptorFixupFunc descriptorFixup;
+  uint64_t frame = 0;
+
+  std::vector<VKStreamedTexture *> textures;
+  std::vector<Retired> retired;
+  std::vector<Fixup> fixups;
+
+  // shared with the worker
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::deque<Load> queued;
+  std::deque<Load> loaded;
+  bool stopping = false;
+  std::thread worker;
+
+  void work();
+  void queueLoad(VKStreamedTexture *texture, uint32_t level);
+  // copies the file's levels from level on out of the mapping
+  static std::vector<char> readLevels(const VKStreamedTexture *texture,
+                                      uint32_t level);
+  VKTexture *createImage(VKStreamedTexture *texture, uint32_t level,
+                         const std::vector<char> &data);
+  VKTexture *swapIn(VKStreamedTexture *texture, uint32_t level,
+                    const std::vector<char> &data, uint32_t frameIndex);
+  // no one moves or demotes image anymore, it is destroyed once the frames
+  // in flight are done with it
+  void retire(VKTexture *image);
+  void release(bool all);
+  void fixDescriptors(uint32_t frameIndex);
+  void free(VKStreamedTexture *texture);
+};
+
+}; // namespace MAI
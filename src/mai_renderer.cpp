@@ -1,18 +1,76 @@
 #include "mai_renderer.h"
+#include <algorithm>
+#include <chrono>
 
 namespace MAI {
 
 MAIRenderer::MAIRenderer(MAIRendererInfo info) : info_(info) {
-  window = initWindow();
-  vkContext = new VKContext(info_.appName, window);
-  vkSwapchain = new VKSwapchain(vkContext);
+  if (!info_.headless)
+    window = initWindow();
+  vkContext = new VKContext({
+      .appName = info_.appName,
+      .window = window,
+      .deviceIndex = info_.deviceIndex,
+      .deviceName = info_.deviceName,
+      .validation = info_.validation,
+  });
+  vkSwapchain = new VKSwapchain(vkContext, {info_.width, info_.height});
   vkSyncObj = new VKSync(vkContext);
   vkCmd = new VKCmd(vkContext);
-  depthTexture = new VKTexture(vkContext, vkCmd, vkSwapchain,
-                               {.format = MAI_DEPTH_TEXTURE});
+  stagingRing = new VKStagingRing(vkContext, info_.stagingBufferSize);
+  vkCmd->setStagingRing(stagingRing);
+  frameAllocator = new VKFrameAllocator(vkContext, info_.frameAllocatorSize);
+  residency = new VKResidency(vkContext);
+  vkContext->setResidency(residency);
+  vkContext->getAllocator()->setEvictCallback(
+      [this](uint32_t heap, VkDeviceSize size) {
+        return residency->evict(heap, size);
+      });
+  // demoted textures get a new view, point the bindless slot at it
+  residency->setTextureMovedCallback([this](VKTexture *texture) {
+    globalDescriptor->updateDescriptorImageWrite(
+        texture->getTextureImageView(), texture->getTextureIndex(),
+        texture->getTextureFormat());
+  });
+  // textures whose image was replaced, one frame's descriptor set at a time
+  const DescriptorFixupFunc descriptorFixup = [this](VKTexture *texture,
+                                                     uint32_t frameIndex) {
+    globalDescriptor->updateFrameDescriptorImageWrite(
+        frameIndex, texture->getTextureImageView(), texture->getTextureIndex(),
+        texture->getTextureFormat());
+  };
+  if (info_.defrag.enabled) {
+    defragmenter = new VKDefragmenter(vkContext, residency, info_.defrag);
+    vkContext->setDefragmenter(defragmenter);
+    defragmenter->setDescriptorFixupCallback(descriptorFixup);
+  }
+  textureStreamer = new VKTextureStreamer(vkContext, vkCmd, info_.streaming);
+  textureStreamer->setDescriptorFixupCallback(descriptorFixup);
+  textureLoader = new VKTextureLoader(vkContext, vkCmd, info_.textureLoader);
+  textureLoader->setDescriptorFixupCallback(descriptorFixup);
+  renderTargets = new VKRenderTargetPool(vkContext);
   vkRender =
-      new VKRender(vkContext, vkSyncObj, vkSwapchain, vkCmd, depthTexture);
+      new VKRender(vkContext, vkSyncObj, vkSwapchain, vkCmd, renderTargets);
+  // the frame's fence has been waited on when this runs, so its slice of
+  // the frame allocator is free again
+  vkRender->setFrameUploads([this](VkCommandBuffer commandBuffer) {
+    frameAllocator->beginFrame(vkRender->getFrameIndex());
+    vkCmd->recordBufferUpdates(commandBuffer, frameAllocator);
+    if (defragmenter)
+      defragmenter->step(commandBuffer, vkRender->getFrameIndex());
+    textureStreamer->update(vkRender->getFrameIndex());
+    textureLoader->update(vkRender->getFrameIndex());
+  });
+  if (info_.enableProfiler) {
+    profiler = new VKProfiler(
+        vkContext, {.pipelineStatistics = info_.enablePipelineStatistics});
+    vkRender->setProfiler(profiler);
+  }
   createGlobalDescriptor();
+  vkContext->getSamplerCache()->setSamplerAddedCallback(
+      [this](VkSampler sampler, uint32_t index) {
+        globalDescriptor->updateDescriptorSamplerWrite(sampler, index);
+      });
 }
 
 GLFWwindow *MAIRenderer::initWindow() {
@@ -29,6 +87,10 @@ GLFWwindow *MAIRenderer::initWindow() {
 }
 
 void MAIRenderer::run(DrawFrameFunc drawFrame) {
+  if (info_.headless) {
+    runHeadless(drawFrame);
+    return;
+  }
 
   double timeStamp = glfwGetTime();
   float deltaSeconds = 0.0f;
@@ -51,11 +113,53 @@ void MAIRenderer::run(DrawFrameFunc drawFrame) {
     vkRender->endFrame();
     vkRender->submitFrame();
     lastBindPipeline_ = nullptr;
+    // hand finished uploads' staging space back to the ring
+    vkCmd->pollUploads();
+    vkContext->getAllocator()->updateBudget();
+    residency->nextFrame();
+    renderTargets->nextFrame();
+    vkContext->drainDebugMessages();
   }
 
   waitForDevice();
 }
 
+void MAIRenderer::runHeadless(DrawFrameFunc &drawFrame) {
+  using clock = std::chrono::steady_clock;
+
+  const VkExtent2D extent = vkSwapchain->getSwapchainExtent();
+  const float ratio = extent.width / (float)extent.height;
+
+  const clock::time_point start = clock::now();
+  clock::time_point timeStamp = start;
+  for (uint32_t i = 0; i < info_.headlessFrameCount; i++) {
+    const clock::time_point newTimeStamp = clock::now();
+    const float deltaSeconds =
+        std::chrono::duration<float>(newTimeStamp - timeStamp).count();
+    timeStamp = newTimeStamp;
+
+    vkRender->beginFrame(info_.clearColor);
+    drawFrame(extent.width, extent.height, ratio, deltaSeconds);
+    vkRender->endFrame();
+    vkRender->submitFrame();
+    lastBindPipeline_ = nullptr;
+    // hand finished uploads' staging space back to the ring
+    vkCmd->pollUploads();
+    vkContext->getAllocator()->updateBudget();
+    residency->nextFrame();
+    renderTargets->nextFrame();
+    vkContext->drainDebugMessages();
+  }
+
+  waitForDevice();
+
+  const double elapsed =
+      std::chrono::duration<double>(clock::now() - start).count();
+  framesPerSecond =
+      elapsed > 0.0 ? static_cast<float>(info_.headlessFrameCount / elapsed)
+                    : 0.0f;
+}
+
 bool endsWith(const char *s, const char *e) {
   const size_t sLength = strlen(s);
   const size_t eLength = strlen(e);
@@ -93,6 +197,9 @@ VKPipeline *MAIRenderer::createPipeline(PipelineInfo info) {
 
 VKbuffer *MAIRenderer::createBuffer(BufferInfo info) {
   VKbuffer *buffer = new VKbuffer(vkContext, vkCmd, info);
+  // not buffers that ended up in host visible VRAM, they never move
+  if (buffer->isMovable())
+    trackResidency(buffer);
 
   return buffer;
 }
@@ -105,29 +212,91 @@ VKDescriptor *MAIRenderer::createDescriptor(DescriptorSetInfo info) {
 VKTexture *MAIRenderer::createTexture(TextureInfo info) {
   VKTexture *texture = new VKTexture(vkContext, vkCmd, nullptr, info);
 
-  if (info.format == MAI_TEXTURE_2D) {
-    lastTextureCount++;
+  if (info.format != MAI_DEPTH_TEXTURE) {
+    const uint32_t index = nextTextureIndex(info.format);
+    texture->setTextureIndex(index);
+    globalDescriptor->updateDescriptorImageWrite(
+        texture->getTextureImageView(), index, info.format);
+  }
+  // render targets stay where they are, passes hold their image
+  if (!texture->isRenderTarget())
+    trackResidency(texture);
 
-    assert(lastTextureCount < MAX_TEXTURES);
-    texture->setTextureIndex(lastTextureCount);
+  return texture;
+}
 
-    globalDescriptor->updateDescriptorImageWrite(
-        texture->getTextureImageView(), texture->getTextureImageSamper(),
-        lastTextureCount);
-  } else if (info.format == MAI_TEXTURE_CUBE) {
-    lastCubemapCount++;
+uint32_t MAIRenderer::nextTextureIndex(TextureFormat format) {
+  uint32_t &count = format == MAI_TEXTURE_CUBE       ? lastCubemapCount
+                    : format == MAI_TEXTURE_2D_ARRAY ? lastTextureArrayCount
+                                                     : lastTextureCount;
+  count++;
 
-    assert(lastCubemapCount < MAX_TEXTURES);
-    texture->setTextureIndex(lastCubemapCount);
+  assert(count < MAX_TEXTURES);
+  return count;
+}
 
-    globalDescriptor->updateDescriptorImageWrite(
-        texture->getTextureImageView(), texture->getTextureImageSamper(),
-        lastCubemapCount, true);
-  }
+VKTexture *
+MAIRenderer::createTextureKTX(const std::vector<const char *> &filenames,
+                              const char *debugName) {
+  const int32_t index = pickKTX(vkContext, filenames);
+  if (index < 0)
+    throw std::runtime_error("no KTX2 file in a supported texture format");
+
+  const KTXTexture ktx = loadKTX(filenames[index]);
+  return createTexture(
+      ktx.getTextureInfo(debugName ? debugName : filenames[index]));
+}
+
+uint64_t MAIRenderer::endUploadBatch() {
+  const uint64_t id = vkCmd->endUploadBatch();
+  // submitted: from here on they can be copied out by an eviction
+  for (VKTexture *texture : batchTextures)
+    residency->addTexture(texture);
+  for (VKbuffer *buffer : batchBuffers)
+    residency->addBuffer(buffer);
+  batchTextures.clear();
+  batchBuffers.clear();
+  return id;
+}
+
+VKStreamedTexture *
+MAIRenderer::createStreamedTexture(StreamedTextureInfo info) {
+  VKStreamedTexture *texture = textureStreamer->createTexture(info);
+  const uint32_t index = nextTextureIndex(texture->getTextureFormat());
+  textureStreamer->setTextureIndex(texture, index);
+  globalDescriptor->updateDescriptorImageWrite(
+      texture->getTexture()->getTextureImageView(), index,
+      texture->getTextureFormat());
+  trackResidency(texture->getTexture());
 
   return texture;
 }
 
+VKAsyncTexture *MAIRenderer::loadTexture(AsyncTextureInfo info) {
+  VKAsyncTexture *texture = textureLoader->load(info);
+  const uint32_t index = nextTextureIndex(info.format);
+  textureLoader->setTextureIndex(texture, index);
+  globalDescriptor->updateDescriptorImageWrite(
+      textureLoader->getPlaceholder(info.format)->getTextureImageView(), index,
+      info.format);
+
+  return texture;
+}
+
+void MAIRenderer::trackResidency(VKTexture *texture) {
+  if (vkCmd->isUploadBatchOpen())
+    batchTextures.push_back(texture);
+  else
+    residency->addTexture(texture);
+}
+
+void MAIRenderer::trackResidency(VKbuffer *buffer) {
+  if (vkCmd->isUploadBatchOpen())
+    batchBuffers.push_back(buffer);
+  else
+    residency->addBuffer(buffer);
+}
+
 void MAIRenderer::bindRenderPipeline(VKPipeline *pipeline) {
   assert(pipeline->getPipeline());
   if (lastBindPipeline_ != pipeline) {
@@ -144,6 +313,7 @@ void MAIRenderer::bindVertexBuffer(uint32_t firstBinding, VKbuffer *buffer,
                                    uint32_t offset) {
   assert(lastBindPipeline_);
   assert(buffer->getBufferModule());
+  residency->touch(buffer);
   VkBuffer vertexBuffer[] = {buffer->getBufferModule()};
   VkDeviceSize offsets[] = {offset};
   vkRender->cmdBindVertexBuffers(firstBinding, 1, vertexBuffer, offsets);
@@ -154,9 +324,27 @@ void MAIRenderer::bindIndexBuffer(VKbuffer *buffer, VkDeviceSize offset,
   assert(lastBindPipeline_);
   assert(buffer);
   assert(buffer->getBufferUsage() & VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+  residency->touch(buffer);
   vkRender->cmdBindIndexBuffer(buffer->getBufferModule(), offset, indexType);
 }
 
+void MAIRenderer::bindVertexBuffer(uint32_t firstBinding,
+                                   const FrameAllocation &allocation) {
+  assert(lastBindPipeline_);
+  assert(allocation.buffer);
+  VkBuffer vertexBuffer[] = {allocation.buffer};
+  VkDeviceSize offsets[] = {allocation.offset};
+  vkRender->cmdBindVertexBuffers(firstBinding, 1, vertexBuffer, offsets);
+}
+
+void MAIRenderer::bindIndexBuffer(const FrameAllocation &allocation,
+                                  VkIndexType indexType) {
+  assert(lastBindPipeline_);
+  assert(allocation.buffer);
+  vkRender->cmdBindIndexBuffer(allocation.buffer, allocation.offset,
+                               indexType);
+}
+
 void MAIRenderer::bindDescriptorSet(VKPipeline *pipeline,
                                     const std::vector<VkDescriptorSet> &sets) {
   assert(lastBindPipeline_);
@@ -178,6 +366,47 @@ void MAIRenderer::cmdDrawIndex(uint32_t indexCount, uint32_t instanceCount,
                          firstInstance);
 }
 
+void MAIRenderer::cmdDrawRecords(const DrawRecord *records, uint32_t count) {
+  assert(lastBindPipeline_);
+  assert(lastBindPipeline_->isVertexPulling());
+  assert(lastBindPipeline_->getPushConstantSize() >= sizeof(VkDeviceAddress));
+  if (!count)
+    return;
+
+  const FrameAllocation recordData =
+      allocateFrameData(records, count * sizeof(DrawRecord));
+  vkRender->cmdPushConstants(lastBindPipeline_->getPipelineLayout(),
+                             lastBindPipeline_->getPushConstantShaderStages(),
+                             0, sizeof(VkDeviceAddress), &recordData.address);
+
+  const VkPhysicalDeviceFeatures &features = vkContext->getEnabledFeatures();
+  if (!features.multiDrawIndirect || !features.drawIndirectFirstInstance) {
+    for (uint32_t i = 0; i < count; i++)
+      vkRender->cmdDraw(records[i].count, 1, 0, i);
+    return;
+  }
+
+  const FrameAllocation commandData =
+      frameAllocator->allocate(count * sizeof(VkDrawIndirectCommand));
+  VkDrawIndirectCommand *commands =
+      static_cast<VkDrawIndirectCommand *>(commandData.data);
+  for (uint32_t i = 0; i < count; i++)
+    commands[i] = {
+        .vertexCount = records[i].count,
+        .instanceCount = 1,
+        .firstVertex = 0,
+        .firstInstance = i,
+    };
+
+  const uint32_t maxDraws =
+      vkContext->getCapabilities().limits().maxDrawIndirectCount;
+  for (uint32_t first = 0; first < count; first += maxDraws)
+    vkRender->cmdDrawIndirect(
+        commandData.buffer,
+        commandData.offset + first * sizeof(VkDrawIndirectCommand),
+        std::min(maxDraws, count - first), sizeof(VkDrawIndirectCommand));
+}
+
 void MAIRenderer::updatePushConstant(uint32_t size, const void *value) {
   assert(lastBindPipeline_);
   vkRender->cmdPushConstants(lastBindPipeline_->getPipelineLayout(),
@@ -191,6 +420,36 @@ void MAIRenderer::updateBuffer(VKbuffer *buffer, void *data, size_t size) {
   buffer->updateUniformBuffer(vkRender->getFrameIndex(), data, size);
 }
 
+void MAIRenderer::updateBufferRange(VKbuffer *buffer, VkDeviceSize offset,
+                                    VkDeviceSize size, const void *data) {
+  assert(buffer);
+  buffer->update(offset, size, data);
+}
+
+FrameAllocation MAIRenderer::allocateFrameData(VkDeviceSize size,
+                                               VkDeviceSize alignment) {
+  return frameAllocator->allocate(size, alignment);
+}
+
+FrameAllocation MAIRenderer::allocateFrameData(const void *data,
+                                               VkDeviceSize size,
+                                               VkDeviceSize alignment) {
+  FrameAllocation allocation = frameAllocator->allocate(size, alignment);
+  memcpy(allocation.data, data, (size_t)size);
+  return allocation;
+}
+
+void MAIRenderer::beginProfileScope(const char *name) {
+  vkRender->cmdBeginProfileScope(name);
+}
+
+void MAIRenderer::endProfileScope() { vkRender->cmdEndProfileScope(); }
+
+bool MAIRenderer::writeProfilerTrace(const char *filename) const {
+  assert(profiler);
+  return profiler->writeChromeTrace(filename);
+}
+
 void MAIRenderer::BindDepthState(DepthInfo info) {
   assert(lastBindPipeline_);
   vkRender->cmdBindDepthState(info);
@@ -204,20 +463,28 @@ void MAIRenderer::createGlobalDescriptor() {
               {
                   .binding = 0,
                   .descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
-                  .descriptorCount = MAX_TEXTURES * MAX_FRAMES_IN_FLIGHT,
+                  .descriptorCount = MAX_TEXTURES,
                   .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
               },
+              // sampler table, see VKSamplerCache
               {
                   .binding = 1,
                   .descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER,
-                  .descriptorCount = MAX_TEXTURES * MAX_FRAMES_IN_FLIGHT,
+                  .descriptorCount = MAX_SAMPLERS,
                   .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
               },
               // cubemap
               {
                   .binding = 2,
                   .descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
-                  .descriptorCount = MAX_TEXTURES * MAX_FRAMES_IN_FLIGHT,
+                  .descriptorCount = MAX_TEXTURES,
+                  .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+              },
+              // 2d texture arrays
+              {
+                  .binding = 3,
+                  .descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
+                  .descriptorCount = MAX_TEXTURES,
                   .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
               },
           },
@@ -227,14 +494,31 @@ void MAIRenderer::createGlobalDescriptor() {
 
 MAIRenderer::~MAIRenderer() {
   vkContext->waitForDevice();
+  vkContext->getSamplerCache()->setSamplerAddedCallback(nullptr);
   delete globalDescriptor;
   delete vkRender;
+  delete renderTargets;
+  delete textureStreamer;
+  delete textureLoader;
+  delete profiler;
+  delete frameAllocator;
+  vkContext->setDefragmenter(nullptr);
+  delete defragmenter;
+  vkContext->getAllocator()->setEvictCallback(nullptr);
+  vkContext->setResidency(nullptr);
+  delete residency;
+  // retires the last uploads, which still hold ring space
   delete vkCmd;
+  delete stagingRing;
   delete vkSyncObj;
   delete vkSwapchain;
+  if (info_.reportLeaks)
+    vkContext->getResourceTracker()->reportLeaks(std::cerr);
   delete vkContext;
-  glfwDestroyWindow(window);
-  glfwTerminate();
+  if (window) {
+    glfwDestroyWindow(window);
+    glfwTerminate();
+  }
 }
 
 }; // namespace MAI
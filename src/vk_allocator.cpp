@@ -0,0 +1,667 @@
+#include "vk_allocator.h"
+#include "vk_context.h"
+#include <algorithm>
+#include <bit>
+#include <iostream>
+#include <stdexcept>
+
+namespace MAI {
+
+// smallest buddy order that holds size bytes
+static uint8_t orderForSize(VkDeviceSize size) {
+  uint8_t order = 0;
+  while ((ALLOCATOR_MIN_ALLOCATION << order) < size)
+    order++;
+  return order;
+}
+
+static VkDeviceSize sizeForOrder(uint8_t order) {
+  return ALLOCATOR_MIN_ALLOCATION << order;
+}
+
+VKAllocator::VKAllocator(VKContext *vkContext)
+    : vkContext(vkContext), vkd(vkContext->getDispatch()) {
+  const VkPhysicalDeviceMemoryProperties &memProperties =
+      vkContext->getCapabilities().memoryProperties;
+
+  pools.resize(memProperties.memoryTypeCount * 2);
+  for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
+    const uint32_t heap = memProperties.memoryTypes[i].heapIndex;
+    const VkDeviceSize heapSize = memProperties.memoryHeaps[heap].size;
+
+    // small heaps (BAR windows, some integrated parts) get smaller blocks
+    VkDeviceSize blockSize = ALLOCATOR_BLOCK_SIZE;
+    while (blockSize > ALLOCATOR_MIN_ALLOCATION && blockSize * 8 > heapSize)
+      blockSize /= 2;
+
+    for (uint32_t kind = 0; kind < 2; kind++) {
+      pools[i * 2 + kind].blockSize = blockSize;
+      pools[i * 2 + kind].maxOrder = orderForSize(blockSize);
+    }
+  }
+
+  heapBudgets.resize(memProperties.memoryHeapCount);
+  stats.deviceMemoryTypes.resize(memProperties.memoryTypeCount);
+  stats.deviceMemoryHeaps.resize(memProperties.memoryHeapCount);
+  stats.allocationTypes.resize(memProperties.memoryTypeCount);
+  updateBudget();
+}
+
+uint32_t VKAllocator::findMemoryType(uint32_t typeFilter,
+                                     MemoryUsage usage) const {
+  constexpr VkMemoryPropertyFlags hostFlags =
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+      VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
+  VkMemoryPropertyFlags required = 0;
+  VkMemoryPropertyFlags preferred = 0;
+  // lazily allocated and protected memory is never picked implicitly
+  VkMemoryPropertyFlags avoided = VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT |
+                                  VK_MEMORY_PROPERTY_PROTECTED_BIT;
+  switch (usage) {
+  case MAI_MEMORY_GPU_ONLY:
+    preferred = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+    // leave the BAR window to resources the CPU writes
+    avoided |= VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+    break;
+  case MAI_MEMORY_UPLOAD:
+    required = hostFlags;
+    avoided |= VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+    break;
+  case MAI_MEMORY_READBACK:
+    required = hostFlags;
+    preferred = VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+    avoided |= VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+    break;
+  case MAI_MEMORY_DYNAMIC:
+    required = hostFlags;
+    preferred = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+    break;
+  case MAI_MEMORY_HOST_FALLBACK:
+    avoided |= VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+    break;
+  case MAI_MEMORY_TRANSIENT:
+    preferred = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT |
+                VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+    avoided = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+              VK_MEMORY_PROPERTY_PROTECTED_BIT;
+    break;
+  }
+
+  const VkPhysicalDeviceMemoryProperties &memProperties =
+      vkContext->getCapabilities().memoryProperties;
+
+  // a missing preferred flag costs more than an avoided one that is present
+  uint32_t best = UINT32_MAX;
+  uint32_t bestCost = UINT32_MAX;
+  for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
+    const VkMemoryPropertyFlags flags =
+        memProperties.memoryTypes[i].propertyFlags;
+    if (!(typeFilter & (1 << i)) || (flags & required) != required)
+      continue;
+    const uint32_t cost = std::popcount(preferred & ~flags) * 2 +
+                          std::popcount(avoided & flags);
+    if (cost < bestCost) {
+      best = i;
+      bestCost = cost;
+    }
+  }
+
+  if (best == UINT32_MAX)
+    throw std::runtime_error("failed to find suitable memory type!");
+  return best;
+}
+
+VkMemoryPropertyFlags
+VKAllocator::getMemoryFlags(const Allocation &allocation) const {
+  return vkContext->getCapabilities()
+      .memoryProperties.memoryTypes[allocation.memoryType]
+      .propertyFlags;
+}
+
+uint32_t VKAllocator::getHeapIndex(uint32_t memoryType) const {
+  return vkContext->getCapabilities()
+      .memoryProperties.memoryTypes[memoryType]
+      .heapIndex;
+}
+
+void VKAllocator::updateBudget() {
+  const VkPhysicalDeviceMemoryProperties &memProperties =
+      vkContext->getCapabilities().memoryProperties;
+  const bool hasBudget = vkContext->getCapabilities().memoryBudget;
+
+  VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProperties{
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT,
+  };
+  if (hasBudget) {
+    VkPhysicalDeviceMemoryProperties2 properties{
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2,
+        .pNext = &budgetProperties,
+    };
+    vkGetPhysicalDeviceMemoryProperties2(vkContext->getPhysicalDevice(),
+                                         &properties);
+  }
+
+  std::lock_guard<std::mutex> lock(budgetMutex);
+  for (uint32_t i = 0; i < memProperties.memoryHeapCount; i++)
+    heapBudgets[i].budget = hasBudget ? budgetProperties.heapBudget[i]
+                                      : memProperties.memoryHeaps[i].size /
+                                            100 * ALLOCATOR_FALLBACK_BUDGET;
+}
+
+HeapBudget VKAllocator::getHeapBudget(uint32_t heap) {
+  std::lock_guard<std::mutex> lock(budgetMutex);
+  return heapBudgets[heap];
+}
+
+Allocation VKAllocator::allocateBuffer(VkBuffer buffer, MemoryUsage usage) {
+  VkMemoryDedicatedRequirements dedicated{
+      .sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS,
+  };
+  VkMemoryRequirements2 requirements{
+      .sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2,
+      .pNext = &dedicated,
+  };
+  VkBufferMemoryRequirementsInfo2 requirementsInfo{
+      .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_REQUIREMENTS_INFO_2,
+      .buffer = buffer,
+  };
+  vkd.vkGetBufferMemoryRequirements2(vkContext->getDevice(), &requirementsInfo,
+                                     &requirements);
+
+  Allocation allocation =
+      allocate(requirements.memoryRequirements, usage, MAI_ALLOCATION_LINEAR,
+               dedicated.prefersDedicatedAllocation ||
+                   dedicated.requiresDedicatedAllocation,
+               buffer, VK_NULL_HANDLE);
+  allocation.usage = usage;
+  countAllocation(allocation, true);
+
+  if (vkd.vkBindBufferMemory(vkContext->getDevice(), buffer, allocation.memory,
+                             allocation.offset) != VK_SUCCESS) {
+    free(allocation);
+    throw std::runtime_error("failed to bind buffer memory");
+  }
+  return allocation;
+}
+
+Allocation VKAllocator::allocateImage(VkImage image, MemoryUsage usage,
+                                      VkImageTiling tiling) {
+  VkMemoryDedicatedRequirements dedicated{
+      .sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS,
+  };
+  VkMemoryRequirements2 requirements{
+      .sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2,
+      .pNext = &dedicated,
+  };
+  VkImageMemoryRequirementsInfo2 requirementsInfo{
+      .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_REQUIREMENTS_INFO_2,
+      .image = image,
+  };
+  vkd.vkGetImageMemoryRequirements2(vkContext->getDevice(), &requirementsInfo,
+                                    &requirements);
+
+  Allocation allocation =
+      allocate(requirements.memoryRequirements, usage,
+               tiling == VK_IMAGE_TILING_LINEAR ? MAI_ALLOCATION_LINEAR
+                                                : MAI_ALLOCATION_OPTIMAL,
+               dedicated.prefersDedicatedAllocation ||
+                   dedicated.requiresDedicatedAllocation,
+               VK_NULL_HANDLE, image);
+  allocation.usage = usage;
+  countAllocation(allocation, true);
+
+  if (vkd.vkBindImageMemory(vkContext->getDevice(), image, allocation.memory,
+                            allocation.offset) != VK_SUCCESS) {
+    free(allocation);
+    throw std::runtime_error("failed to bind image memory");
+  }
+  return allocation;
+}
+
+Allocation VKAllocator::allocate(const VkMemoryRequirements &requirements,
+                                 MemoryUsage usage, AllocationKind kind,
+                                 bool dedicated, VkBuffer buffer,
+                                 VkImage image) {
+  const uint32_t memoryType =
+      findMemoryType(requirements.memoryTypeBits, usage);
+  const uint32_t heap = getHeapIndex(memoryType);
+  const bool deviceLocal =
+      vkContext->getCapabilities().memoryProperties.memoryHeaps[heap].flags &
+      VK_MEMORY_HEAP_DEVICE_LOCAL_BIT;
+
+  Allocation allocation;
+  if (tryAllocate(requirements, memoryType, kind, dedicated, false, buffer,
+                  image, allocation))
+    return allocation;
+
+  // new device memory is needed: make room first rather than go over the
+  // budget, the driver would start paging or fail
+  if (deviceLocal && evictCallback) {
+    const HeapBudget budget = getHeapBudget(heap);
+    const VkDeviceSize needed = std::max(
+        requirements.size, pools[memoryType * 2 + kind].blockSize);
+    if (budget.usage + needed > budget.budget &&
+        evictCallback(heap, budget.usage + needed - budget.budget) &&
+        tryAllocate(requirements, memoryType, kind, dedicated, false, buffer,
+                    image, allocation))
+      return allocation;
+  }
+
+  if (tryAllocate(requirements, memoryType, kind, dedicated, true, buffer,
+                  image, allocation))
+    return allocation;
+
+  if (deviceLocal && evictCallback && evictCallback(heap, requirements.size) &&
+      tryAllocate(requirements, memoryType, kind, dedicated, true, buffer,
+                  image, allocation))
+    return allocation;
+
+  // out of device memory: slower system memory beats an exception
+  if (deviceLocal) {
+    const uint32_t fallbackType = findMemoryType(requirements.memoryTypeBits,
+                                                 MAI_MEMORY_HOST_FALLBACK);
+    if (fallbackType != memoryType &&
+        tryAllocate(requirements, fallbackType, kind, dedicated, true, buffer,
+                    image, allocation)) {
+      std::cerr << "device memory exhausted, " << requirements.size
+                << " bytes placed in system memory" << std::endl;
+      return allocation;
+    }
+  }
+
+  throw std::runtime_error("failed to allocate device memory");
+}
+
+bool VKAllocator::tryAllocate(const VkMemoryRequirements &requirements,
+                              uint32_t memoryType, AllocationKind kind,
+                              bool dedicated, bool grow, VkBuffer buffer,
+                              VkImage image, Allocation &allocation) {
+  // buddies are aligned to their own size, so rounding the size up to the
+  // alignment is enough to honour it
+  const VkDeviceSize size =
+      std::max(requirements.size, requirements.alignment);
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    Pool &pool = pools[memoryType * 2 + kind];
+    if (!dedicated && size <= pool.blockSize / 2 &&
+        allocateFromPool(pool, memoryType, kind, orderForSize(size), grow,
+                         allocation)) {
+      allocation.size = requirements.size;
+      return true;
+    }
+  }
+
+  // large resources, driver preference, or no room left for a new block
+  return grow && allocateDedicated(requirements.size, memoryType, kind,
+                                   buffer, image, allocation);
+}
+
+bool VKAllocator::allocateFromPool(Pool &pool, uint32_t memoryType,
+                                   AllocationKind kind, uint8_t order,
+                                   bool grow, Allocation &allocation,
+                                   bool moving) {
+  auto takeBuddy = [&](Block &block, VkDeviceSize &offset) {
+    if (block.memory == VK_NULL_HANDLE || block.draining ||
+        (moving && !block.used))
+      return false;
+
+    uint8_t k = order;
+    while (k <= pool.maxOrder && block.freeLists[k].empty())
+      k++;
+    if (k > pool.maxOrder)
+      return false;
+
+    offset = *block.freeLists[k].begin();
+    block.freeLists[k].erase(block.freeLists[k].begin());
+    // split down, the upper halves go back to the free lists
+    while (k > order) {
+      k--;
+      block.freeLists[k].insert(offset + sizeForOrder(k));
+    }
+    block.used += sizeForOrder(order);
+    return true;
+  };
+
+  VkDeviceSize offset = 0;
+  uint32_t blockIndex = UINT32_MAX;
+  for (uint32_t i = 0; i < pool.blocks.size(); i++)
+    if (takeBuddy(pool.blocks[i], offset)) {
+      blockIndex = i;
+      break;
+    }
+
+  if (blockIndex == UINT32_MAX) {
+    if (!grow)
+      return false;
+    blockIndex = createBlock(pool, memoryType, kind);
+    if (blockIndex == UINT32_MAX || !takeBuddy(pool.blocks[blockIndex], offset))
+      return false;
+  }
+
+  Block &block = pool.blocks[blockIndex];
+  allocation = {
+      .memory = block.memory,
+      .offset = offset,
+      .mapped =
+          block.mapped ? static_cast<char *>(block.mapped) + offset : nullptr,
+      .memoryType = memoryType,
+      .block = blockIndex,
+      .kind = kind,
+      .order = order,
+  };
+  return true;
+}
+
+bool VKAllocator::allocateDedicated(VkDeviceSize size, uint32_t memoryType,
+                                    AllocationKind kind, VkBuffer buffer,
+                                    VkImage image, Allocation &allocation) {
+  VkMemoryDedicatedAllocateInfo dedicatedInfo{
+      .sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO,
+      .image = image,
+      .buffer = buffer,
+  };
+
+  void *mapped = nullptr;
+  VkDeviceMemory memory =
+      allocateMemory(size, memoryType, kind, &dedicatedInfo, &mapped);
+  if (memory == VK_NULL_HANDLE)
+    return false;
+
+  allocation = {
+      .memory = memory,
+      .offset = 0,
+      .size = size,
+      .mapped = mapped,
+      .memoryType = memoryType,
+      .kind = kind,
+  };
+  return true;
+}
+
+uint32_t VKAllocator::createBlock(Pool &pool, uint32_t memoryType,
+                                  AllocationKind kind) {
+  void *mapped = nullptr;
+  VkDeviceMemory memory =
+      allocateMemory(pool.blockSize, memoryType, kind, nullptr, &mapped);
+  if (memory == VK_NULL_HANDLE)
+    return UINT32_MAX;
+
+  // reuse a released slot so block indices held by allocations stay valid
+  uint32_t index = 0;
+  while (index < pool.blocks.size() &&
+         pool.blocks[index].memory != VK_NULL_HANDLE)
+    index++;
+  if (index == pool.blocks.size())
+    pool.blocks.emplace_back();
+
+  Block &block = pool.blocks[index];
+  block.memory = memory;
+  block.mapped = mapped;
+  block.used = 0;
+  block.freeLists.assign(pool.maxOrder + 1, {});
+  block.freeLists[pool.maxOrder].insert(0);
+  return index;
+}
+
+void VKAllocator::destroyBlock(Pool &pool, uint32_t memoryType,
+                               Block &block) {
+  // freeing implicitly unmaps
+  freeMemory(block.memory, pool.blockSize, memoryType);
+  block = {};
+}
+
+VkDeviceMemory VKAllocator::allocateMemory(VkDeviceSize size,
+                                           uint32_t memoryType,
+                                           AllocationKind kind,
+                                           const void *pNext, void **mapped) {
+  // any buffer placed in a linear block may ask for its device address
+  VkMemoryAllocateFlagsInfo allocFlags{
+      .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO,
+      .pNext = pNext,
+      .flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT,
+  };
+  VkMemoryAllocateInfo allocInfo{
+      .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+      .pNext = kind == MAI_ALLOCATION_LINEAR ? &allocFlags : pNext,
+      .allocationSize = size,
+      .memoryTypeIndex = memoryType,
+  };
+
+  VkDeviceMemory memory;
+  if (vkd.vkAllocateMemory(vkContext->getDevice(), &allocInfo, nullptr,
+                           &memory) != VK_SUCCESS)
+    return VK_NULL_HANDLE;
+
+  const VkMemoryPropertyFlags flags = vkContext->getCapabilities()
+                                          .memoryProperties
+                                          .memoryTypes[memoryType]
+                                          .propertyFlags;
+  *mapped = nullptr;
+  if ((flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) &&
+      vkd.vkMapMemory(vkContext->getDevice(), memory, 0, VK_WHOLE_SIZE, 0,
+                      mapped) != VK_SUCCESS) {
+    vkd.vkFreeMemory(vkContext->getDevice(), memory, nullptr);
+    return VK_NULL_HANDLE;
+  }
+
+  std::lock_guard<std::mutex> lock(budgetMutex);
+  heapBudgets[getHeapIndex(memoryType)].usage += size;
+  stats.deviceMemoryTypes[memoryType].add(size);
+  stats.deviceMemoryHeaps[getHeapIndex(memoryType)].add(size);
+  return memory;
+}
+
+void VKAllocator::freeMemory(VkDeviceMemory memory, VkDeviceSize size,
+                             uint32_t memoryType) {
+  vkd.vkFreeMemory(vkContext->getDevice(), memory, nullptr);
+
+  std::lock_guard<std::mutex> lock(budgetMutex);
+  heapBudgets[getHeapIndex(memoryType)].usage -= size;
+  stats.deviceMemoryTypes[memoryType].remove(size);
+  stats.deviceMemoryHeaps[getHeapIndex(memoryType)].remove(size);
+}
+
+void VKAllocator::free(Allocation &allocation) {
+  if (allocation.memory == VK_NULL_HANDLE)
+    return;
+  countAllocation(allocation, false);
+
+  if (allocation.isDedicated()) {
+    freeMemory(allocation.memory, allocation.size, allocation.memoryType);
+    allocation = {};
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex);
+  Pool &pool = pools[allocation.memoryType * 2 + allocation.kind];
+  Block &block = pool.blocks[allocation.block];
+
+  VkDeviceSize offset = allocation.offset;
+  uint8_t order = allocation.order;
+  block.used -= sizeForOrder(order);
+
+  // merge with the buddy for as long as it is free too
+  while (order < pool.maxOrder) {
+    const VkDeviceSize buddy = offset ^ sizeForOrder(order);
+    auto it = block.freeLists[order].find(buddy);
+    if (it == block.freeLists[order].end())
+      break;
+    block.freeLists[order].erase(it);
+    offset = std::min(offset, buddy);
+    order++;
+  }
+  block.freeLists[order].insert(offset);
+
+  // keep a single empty block per pool so churn does not keep hitting
+  // vkAllocateMemory. a drained block goes right away, that is its point
+  if (block.used == 0 && block.draining)
+    destroyBlock(pool, allocation.memoryType, block);
+  else if (block.used == 0)
+    for (Block &other : pool.blocks)
+      if (&other != &block && other.memory != VK_NULL_HANDLE &&
+          other.used == 0) {
+        destroyBlock(pool, allocation.memoryType, block);
+        break;
+      }
+
+  allocation = {};
+}
+
+bool VKAllocator::isDeviceLocalType(uint32_t memoryType) const {
+  return vkContext->getCapabilities()
+             .memoryProperties.memoryTypes[memoryType]
+             .propertyFlags &
+         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+}
+
+void VKAllocator::countAllocation(const Allocation &allocation, bool added) {
+  std::lock_guard<std::mutex> lock(budgetMutex);
+  for (MemoryCounter *counter :
+       {&stats.allocationTypes[allocation.memoryType],
+        &stats.allocationUsages[allocation.usage]})
+    if (added)
+      counter->add(allocation.size);
+    else
+      counter->remove(allocation.size);
+}
+
+MemoryStats VKAllocator::getStats() {
+  std::lock_guard<std::mutex> lock(budgetMutex);
+  return stats;
+}
+
+FragmentationStats VKAllocator::getFragmentation() {
+  FragmentationStats stats;
+
+  std::lock_guard<std::mutex> lock(mutex);
+  for (uint32_t i = 0; i < pools.size(); i++) {
+    if (!isDeviceLocalType(i / 2))
+      continue;
+    for (const Block &block : pools[i].blocks)
+      if (block.memory != VK_NULL_HANDLE && block.used) {
+        stats.used += block.used;
+        stats.stranded += pools[i].blockSize - block.used;
+      }
+  }
+
+  if (stats.used)
+    stats.ratio = static_cast<float>(stats.stranded) /
+                  static_cast<float>(stats.used + stats.stranded);
+  return stats;
+}
+
+VkDeviceSize VKAllocator::getBlockUsage(const Allocation &allocation) {
+  if (allocation.isDedicated())
+    return allocation.size;
+
+  std::lock_guard<std::mutex> lock(mutex);
+  return pools[allocation.memoryType * 2 + allocation.kind]
+      .blocks[allocation.block]
+      .used;
+}
+
+VkDeviceSize VKAllocator::getPoolSpareSpace(const Allocation &allocation) {
+  if (allocation.isDedicated())
+    return 0;
+
+  std::lock_guard<std::mutex> lock(mutex);
+  const Pool &pool = pools[allocation.memoryType * 2 + allocation.kind];
+  VkDeviceSize spare = 0;
+  for (uint32_t i = 0; i < pool.blocks.size(); i++) {
+    const Block &block = pool.blocks[i];
+    if (i != allocation.block && block.memory != VK_NULL_HANDLE &&
+        block.used && !block.draining)
+      spare += pool.blockSize - block.used;
+  }
+  return spare;
+}
+
+void VKAllocator::setDraining(const Allocation &allocation, bool draining) {
+  if (allocation.isDedicated())
+    return;
+
+  std::lock_guard<std::mutex> lock(mutex);
+  Pool &pool = pools[allocation.memoryType * 2 + allocation.kind];
+  Block &block = pool.blocks[allocation.block];
+  if (block.memory == allocation.memory)
+    block.draining = draining;
+}
+
+bool VKAllocator::moveBuffer(VkBuffer buffer, const Allocation &from,
+                             Allocation &allocation) {
+  VkMemoryRequirements2 requirements{
+      .sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2,
+  };
+  VkBufferMemoryRequirementsInfo2 requirementsInfo{
+      .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_REQUIREMENTS_INFO_2,
+      .buffer = buffer,
+  };
+  vkd.vkGetBufferMemoryRequirements2(vkContext->getDevice(), &requirementsInfo,
+                                    &requirements);
+  if (!allocateMove(requirements.memoryRequirements, from, allocation))
+    return false;
+  allocation.usage = from.usage;
+  countAllocation(allocation, true);
+
+  if (vkd.vkBindBufferMemory(vkContext->getDevice(), buffer, allocation.memory,
+                             allocation.offset) != VK_SUCCESS) {
+    free(allocation);
+    throw std::runtime_error("failed to bind buffer memory");
+  }
+  return true;
+}
+
+bool VKAllocator::moveImage(VkImage image, const Allocation &from,
+                            Allocation &allocation) {
+  VkMemoryRequirements2 requirements{
+      .sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2,
+  };
+  VkImageMemoryRequirementsInfo2 requirementsInfo{
+      .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_REQUIREMENTS_INFO_2,
+      .image = image,
+  };
+  vkd.vkGetImageMemoryRequirements2(vkContext->getDevice(), &requirementsInfo,
+                                   &requirements);
+  if (!allocateMove(requirements.memoryRequirements, from, allocation))
+    return false;
+  allocation.usage = from.usage;
+  countAllocation(allocation, true);
+
+  if (vkd.vkBindImageMemory(vkContext->getDevice(), image, allocation.memory,
+                            allocation.offset) != VK_SUCCESS) {
+    free(allocation);
+    throw std::runtime_error("failed to bind image memory");
+  }
+  return true;
+}
+
+bool VKAllocator::allocateMove(const VkMemoryRequirements &requirements,
+                               const Allocation &from,
+                               Allocation &allocation) {
+  if (from.isDedicated() ||
+      !(requirements.memoryTypeBits & (1u << from.memoryType)))
+    return false;
+
+  const VkDeviceSize size =
+      std::max(requirements.size, requirements.alignment);
+
+  std::lock_guard<std::mutex> lock(mutex);
+  Pool &pool = pools[from.memoryType * 2 + from.kind];
+  if (size > pool.blockSize / 2 ||
+      !allocateFromPool(pool, from.memoryType, from.kind, orderForSize(size),
+                        false, allocation, true))
+    return false;
+  allocation.size = requirements.size;
+  return true;
+}
+
+VKAllocator::~VKAllocator() {
+  for (uint32_t i = 0; i < pools.size(); i++)
+    for (Block &block : pools[i].blocks)
+      if (block.memory != VK_NULL_HANDLE)
+        destroyBlock(pools[i], i / 2, block);
+}
+
+}; // namespace MAI
@@ -1,63 +1,103 @@
 #include "vk_buffer.h"
+#include "vk_defragmenter.h"
+#include "vk_residency.h"
+#include "vk_resource_tracker.h"
+#include <algorithm>
+#include <cassert>
 
 namespace MAI {
 
 VKbuffer::VKbuffer(VKContext *vkContext, VKCmd *vkCmd, BufferInfo info)
-    : vkContext(vkContext), vkCmd(vkCmd), info_(info) {
-  if (info_.usage & VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT)
+    : vkContext(vkContext), vkd(vkContext->getDispatch()), vkCmd(vkCmd),
+      info_(info) {
+  VkDeviceSize bytes = 0;
+  if (info_.usage & VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT) {
     createUniformBuffer();
-  else
+    for (const Allocation &uniformAllocation : uniformAllocations)
+      bytes += uniformAllocation.size;
+  } else {
     initBuffer();
+    bytes = allocation.size;
+  }
+  vkContext->getResourceTracker()->add(this, MAI_RESOURCE_BUFFER,
+                                       info_.debugName, bytes);
 }
 
 void VKbuffer::initBuffer() {
-  VkBuffer stagingBuffer;
-  VkDeviceMemory stagingBufferMemory;
-
   if (info_.size <= 0)
     throw std::runtime_error("buffer size must be greater than 0");
 
-  createBuffer(vkContext, info_.size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-               VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                   VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-               stagingBuffer, stagingBufferMemory);
+  // host visible buffers are written in place
+  if (info_.memoryUsage != MAI_MEMORY_GPU_ONLY) {
+    createBuffer(vkContext, info_.size, info_.usage, info_.memoryUsage, buffer,
+                 allocation);
+    if (info_.data)
+      memcpy(allocation.mapped, info_.data, (size_t)info_.size);
+    return;
+  }
 
-  void *data;
-  vkMapMemory(vkContext->getDevice(), stagingBufferMemory, 0, info_.size, 0,
-              &data);
+  // with resizable BAR or unified memory the CPU writes VRAM directly: no
+  // staging buffer, no copy and no wait. coherent writes are visible to any
+  // later submit
+  if (vkContext->getCapabilities().hostVisibleVram) {
+    createBuffer(vkContext, info_.size,
+                 VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+                     VK_BUFFER_USAGE_TRANSFER_SRC_BIT | info_.usage,
+                 MAI_MEMORY_DYNAMIC, buffer, allocation);
+    if (vkContext->getAllocator()->getMemoryFlags(allocation) &
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) {
+      hostVisibleVram = true;
+      if (info_.data)
+        memcpy(allocation.mapped, info_.data, (size_t)info_.size);
+      return;
+    }
+    // the buffer's memoryTypeBits ruled out host visible VRAM
+    destroyBuffer(vkContext, buffer, allocation);
+  }
 
-  memcpy(data, info_.data, (size_t)info_.size);
-  vkUnmapMemory(vkContext->getDevice(), stagingBufferMemory);
+  // transfer source too, so the buffer can be demoted later
+  createBuffer(vkContext, info_.size,
+               VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+                   VK_BUFFER_USAGE_TRANSFER_SRC_BIT | info_.usage,
+               MAI_MEMORY_GPU_ONLY, buffer, allocation);
+  if (!info_.data)
+    return;
 
-  createBuffer(
-      vkContext, info_.size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | info_.usage,
-      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, buffer, bufferMemory,
-      info_.usage & VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT ? true : false);
-  copyBuffer(stagingBuffer, buffer, info_.size);
+  // staged through the renderer's ring, chunk by chunk for buffers larger
+  // than a slice of it
+  UploadCmd cmd = vkCmd->beginUploadCommandBuffers();
+  const VkDeviceSize chunkSize = vkCmd->getStagingChunkSize();
+  for (VkDeviceSize offset = 0; offset < info_.size; offset += chunkSize) {
+    const VkDeviceSize size = std::min(chunkSize, info_.size - offset);
+    StagingRegion region = vkCmd->stage(cmd, size);
+    memcpy(region.data, static_cast<const char *>(info_.data) + offset,
+           (size_t)size);
+
+    VkBufferCopy copyRegion{
+        .srcOffset = region.offset,
+        .dstOffset = offset,
+        .size = size,
+    };
+    vkd.vkCmdCopyBuffer(cmd.transfer, region.buffer, buffer, 1, &copyRegion);
+  }
+  releaseToGraphics(cmd, buffer);
 
-  vkDestroyBuffer(vkContext->getDevice(), stagingBuffer, nullptr);
-  vkFreeMemory(vkContext->getDevice(), stagingBufferMemory, nullptr);
+  vkCmd->endUploadCommandBuffers(cmd);
 }
 
 void VKbuffer::createUniformBuffer() {
   uniformBuffers.resize(MAX_FRAMES_IN_FLIGHT);
-  uniformBufferMemory.resize(MAX_FRAMES_IN_FLIGHT);
-  uniformBufferMapped.resize(MAX_FRAMES_IN_FLIGHT);
-  for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+  uniformAllocations.resize(MAX_FRAMES_IN_FLIGHT);
+  for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
     createBuffer(vkContext, info_.size, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                     VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                 uniformBuffers[i], uniformBufferMemory[i]);
-    vkMapMemory(vkContext->getDevice(), uniformBufferMemory[i], 0, info_.size,
-                0, &uniformBufferMapped[i]);
-  }
+                 MAI_MEMORY_DYNAMIC, uniformBuffers[i], uniformAllocations[i]);
 }
 
 void VKbuffer::createBuffer(VKContext *vkContext, VkDeviceSize size,
                             VkBufferUsageFlags usage,
-                            VkMemoryPropertyFlags properties, VkBuffer &buffer,
-                            VkDeviceMemory &bufferMemory,
-                            bool isStorageBuffer) {
+                            MemoryUsage memoryUsage, VkBuffer &buffer,
+                            Allocation &allocation) {
+  const VKDispatch &vkd = vkContext->getDispatch();
 
   VkBufferCreateInfo bufferInfo{
       .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
@@ -66,66 +106,139 @@ void VKbuffer::createBuffer(VKContext *vkContext, VkDeviceSize size,
       .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
   };
 
-  if (vkCreateBuffer(vkContext->getDevice(), &bufferInfo, nullptr, &buffer) !=
-      VK_SUCCESS)
+  if (vkd.vkCreateBuffer(vkContext->getDevice(), &bufferInfo, nullptr,
+                         &buffer) != VK_SUCCESS)
     throw std::runtime_error("failed to create buffer module");
 
-  VkMemoryRequirements memRequirements;
-  vkGetBufferMemoryRequirements(vkContext->getDevice(), buffer,
-                                &memRequirements);
-
-  VkMemoryAllocateInfo allocInfo{
-      .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-      .allocationSize = memRequirements.size,
-      .memoryTypeIndex =
-          findMemoryType(vkContext, memRequirements.memoryTypeBits, properties),
-  };
-
-  if (isStorageBuffer) {
-    VkMemoryAllocateFlagsInfo allocFlags = {
-        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO,
-        .flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT,
-    };
-    allocInfo.pNext = &allocFlags;
-  } else
-    allocInfo.pNext = nullptr;
-
-  if (vkAllocateMemory(vkContext->getDevice(), &allocInfo, nullptr,
-                       &bufferMemory) != VK_SUCCESS)
-    throw std::runtime_error("failed to allocate buffer memory");
+  allocation = vkContext->getAllocator()->allocateBuffer(buffer, memoryUsage);
+}
 
-  vkBindBufferMemory(vkContext->getDevice(), buffer, bufferMemory, 0);
+void VKbuffer::destroyBuffer(VKContext *vkContext, VkBuffer buffer,
+                             Allocation &allocation) {
+  vkContext->getDispatch().vkDestroyBuffer(vkContext->getDevice(), buffer,
+                                           nullptr);
+  vkContext->getAllocator()->free(allocation);
 }
 
 void VKbuffer::copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer,
                           VkDeviceSize size) {
-  VkCommandBuffer commandBuffer = vkCmd->beginSingleCommandBuffer();
+  UploadCmd cmd = vkCmd->beginUploadCommandBuffers();
 
   VkBufferCopy copyRegion{
       .size = size,
   };
-  vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
+  vkd.vkCmdCopyBuffer(cmd.transfer, srcBuffer, dstBuffer, 1, &copyRegion);
 
-  vkCmd->endSingleCommandBuffer(commandBuffer);
+  releaseToGraphics(cmd, dstBuffer);
+
+  vkCmd->endUploadCommandBuffers(cmd);
 }
 
-uint32_t VKbuffer::findMemoryType(VKContext *vkContext, uint32_t typeFilter,
-                                  VkMemoryPropertyFlags properties) {
-  VkPhysicalDeviceMemoryProperties memProperties;
-  vkGetPhysicalDeviceMemoryProperties(vkContext->getPhysicalDevice(),
-                                      &memProperties);
+void VKbuffer::releaseToGraphics(UploadCmd &cmd, VkBuffer dstBuffer) {
+  const bool dedicated = vkContext->hasDedicatedTransferQueue();
+  const QueueFamilyIndices indices = vkContext->getFamilyIndices();
 
-  for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++)
-    if ((typeFilter & (1 << i)) &&
-        (memProperties.memoryTypes[i].propertyFlags & properties) == properties)
-      return i;
+  VkBufferMemoryBarrier barrier{
+      .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+      .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+      .dstAccessMask = VK_ACCESS_MEMORY_READ_BIT,
+      .srcQueueFamilyIndex =
+          dedicated ? indices.transferFamily.value() : VK_QUEUE_FAMILY_IGNORED,
+      .dstQueueFamilyIndex =
+          dedicated ? indices.graphcisFamily.value() : VK_QUEUE_FAMILY_IGNORED,
+      .buffer = dstBuffer,
+      .offset = 0,
+      .size = VK_WHOLE_SIZE,
+  };
 
-  throw std::runtime_error("failed to find suitable memory type!");
+  // release half, only needed when the buffer changes queue family
+  if (dedicated)
+    vkd.vkCmdPipelineBarrier(cmd.transfer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0,
+                             nullptr, 1, &barrier, 0, nullptr);
+
+  // acquire half on the graphics queue
+  VkBufferMemoryBarrier acquire = barrier;
+  acquire.srcAccessMask = dedicated ? 0 : VK_ACCESS_TRANSFER_WRITE_BIT;
+  vkd.vkCmdPipelineBarrier(cmd.acquire,
+                           dedicated ? VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT
+                                     : VK_PIPELINE_STAGE_TRANSFER_BIT,
+                           VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr,
+                           1, &acquire, 0, nullptr);
 }
 
 void VKbuffer::updateUniformBuffer(uint32_t curreImage, void *data,
                                    size_t size) {
-  memcpy(uniformBufferMapped[curreImage], data, size);
+  memcpy(uniformAllocations[curreImage].mapped, data, size);
+}
+
+void VKbuffer::update(VkDeviceSize offset, VkDeviceSize size,
+                      const void *data) {
+  assert(!(info_.usage & VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT));
+  assert(size > 0 && offset + size <= info_.size);
+
+  if (info_.memoryUsage != MAI_MEMORY_GPU_ONLY) {
+    memcpy(static_cast<char *>(allocation.mapped) + offset, data,
+           (size_t)size);
+    return;
+  }
+
+  if (pendingWrites.empty())
+    vkCmd->addDirtyBuffer(this);
+
+  // find every pending range touching [offset, offset + size)
+  VkDeviceSize begin = offset;
+  VkDeviceSize end = offset + size;
+  auto first = pendingWrites.upper_bound(begin);
+  if (first != pendingWrites.begin() &&
+      std::prev(first)->first + std::prev(first)->second.size() >= begin)
+    --first;
+  auto last = first;
+  for (; last != pendingWrites.end() && last->first <= end; ++last) {
+    begin = std::min(begin, last->first);
+    end = std::max(end, last->first + last->second.size());
+  }
+
+  std::vector<uint8_t> merged(end - begin);
+  for (auto it = first; it != last; ++it)
+    memcpy(merged.data() + (it->first - begin), it->second.data(),
+           it->second.size());
+  memcpy(merged.data() + (offset - begin), data, (size_t)size);
+
+  pendingWrites.erase(first, last);
+  pendingWrites.emplace(begin, std::move(merged));
+}
+
+void VKbuffer::recordUpdates(VkCommandBuffer commandBuffer,
+                             VKFrameAllocator *frameAllocator) {
+  // the frame's command buffer writes the buffer from now on, a demotion
+  // later in the frame would destroy it under the recorded writes
+  if (VKResidency *residency = vkContext->getResidency())
+    residency->touch(this);
+
+  std::vector<VkBufferCopy> copies;
+  for (const auto &[offset, bytes] : pendingWrites) {
+    const VkDeviceSize size = bytes.size();
+    if (size <= BUFFER_INLINE_UPDATE_SIZE && offset % 4 == 0 &&
+        size % 4 == 0) {
+      vkd.vkCmdUpdateBuffer(commandBuffer, buffer, offset, size,
+                            bytes.data());
+      continue;
+    }
+
+    FrameAllocation staging = frameAllocator->allocate(size, 16);
+    memcpy(staging.data, bytes.data(), (size_t)size);
+    copies.push_back({
+        .srcOffset = staging.offset,
+        .dstOffset = offset,
+        .size = size,
+    });
+  }
+
+  if (!copies.empty())
+    vkd.vkCmdCopyBuffer(commandBuffer, frameAllocator->getBuffer(), buffer,
+                        static_cast<uint32_t>(copies.size()), copies.data());
+  pendingWrites.clear();
 }
 
 uint64_t VKbuffer::gpuAddress() {
@@ -134,22 +247,124 @@ uint64_t VKbuffer::gpuAddress() {
       .buffer = buffer,
   };
   VkDeviceAddress address =
-      vkGetBufferDeviceAddress(vkContext->getDevice(), &addrInfo);
+      vkd.vkGetBufferDeviceAddress(vkContext->getDevice(), &addrInfo);
+  addressTaken = true;
   return address;
 }
 
+bool VKbuffer::isDeviceLocal() const {
+  return vkContext->getAllocator()->getMemoryFlags(allocation) &
+         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+}
+
+uint32_t VKbuffer::getMemoryHeap() const {
+  return vkContext->getAllocator()->getHeapIndex(allocation.memoryType);
+}
+
+bool VKbuffer::isMovable() const {
+  return !addressTaken && !hostVisibleVram &&
+         info_.memoryUsage == MAI_MEMORY_GPU_ONLY &&
+         !(info_.usage & VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
+}
+
+void VKbuffer::recordCopy(VkCommandBuffer commandBuffer, VkBuffer dstBuffer) {
+  // earlier frames may have written the buffer, later ones read the copy
+  VkMemoryBarrier barrier{
+      .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+      .srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT,
+      .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+  };
+  VkBufferCopy region{
+      .size = info_.size,
+  };
+
+  vkd.vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                           VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0,
+                           nullptr, 0, nullptr);
+  vkd.vkCmdCopyBuffer(commandBuffer, buffer, dstBuffer, 1, &region);
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+  vkd.vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                           VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &barrier,
+                           0, nullptr, 0, nullptr);
+}
+
+bool VKbuffer::demote() {
+  if (!isMovable())
+    return false;
+
+  VkBuffer newBuffer;
+  Allocation newAllocation;
+  createBuffer(vkContext, info_.size,
+               VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+                   VK_BUFFER_USAGE_TRANSFER_SRC_BIT | info_.usage,
+               MAI_MEMORY_HOST_FALLBACK, newBuffer, newAllocation);
+  if (vkContext->getAllocator()->getMemoryFlags(newAllocation) &
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) {
+    destroyBuffer(vkContext, newBuffer, newAllocation);
+    return false;
+  }
+
+  // waits for the graphics queue to go idle, no frame still uses the old
+  // buffer once this returns
+  VkCommandBuffer commandBuffer = vkCmd->beginSingleCommandBuffer();
+  recordCopy(commandBuffer, newBuffer);
+  vkCmd->endSingleCommandBuffer(commandBuffer);
+
+  destroyBuffer(vkContext, buffer, allocation);
+  buffer = newBuffer;
+  allocation = newAllocation;
+  return true;
+}
+
+bool VKbuffer::relocate(VkCommandBuffer commandBuffer, VkBuffer &oldBuffer,
+                        Allocation &oldAllocation) {
+  if (!isMovable() || allocation.isDedicated())
+    return false;
+
+  VkBufferCreateInfo bufferInfo{
+      .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+      .size = info_.size,
+      .usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+               VK_BUFFER_USAGE_TRANSFER_SRC_BIT | info_.usage,
+      .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+  };
+  VkBuffer newBuffer;
+  if (vkd.vkCreateBuffer(vkContext->getDevice(), &bufferInfo, nullptr,
+                         &newBuffer) != VK_SUCCESS)
+    throw std::runtime_error("failed to create buffer module");
+
+  Allocation newAllocation;
+  if (!vkContext->getAllocator()->moveBuffer(newBuffer, allocation,
+                                             newAllocation)) {
+    vkd.vkDestroyBuffer(vkContext->getDevice(), newBuffer, nullptr);
+    return false;
+  }
+
+  recordCopy(commandBuffer, newBuffer);
+
+  oldBuffer = buffer;
+  oldAllocation = allocation;
+  buffer = newBuffer;
+  allocation = newAllocation;
+  return true;
+}
+
 VKbuffer::~VKbuffer() {
+  vkContext->getResourceTracker()->remove(this);
+  if (VKResidency *residency = vkContext->getResidency())
+    residency->removeBuffer(this);
+  if (VKDefragmenter *defragmenter = vkContext->getDefragmenter())
+    defragmenter->removeBuffer(this);
+  if (!pendingWrites.empty())
+    vkCmd->removeDirtyBuffer(this);
 
   if (info_.usage & VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT)
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-      vkDestroyBuffer(vkContext->getDevice(), uniformBuffers[i], nullptr);
-      vkFreeMemory(vkContext->getDevice(), uniformBufferMemory[i], nullptr);
-    }
+    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+      destroyBuffer(vkContext, uniformBuffers[i], uniformAllocations[i]);
 
-  else {
-    vkDestroyBuffer(vkContext->getDevice(), buffer, nullptr);
-    vkFreeMemory(vkContext->getDevice(), bufferMemory, nullptr);
-  }
+  else
+    destroyBuffer(vkContext, buffer, allocation);
 }
 
 }; // namespace MAI
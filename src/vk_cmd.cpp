@@ -1,8 +1,12 @@
 #include "vk_cmd.h"
+#include "vk_buffer.h"
+#include <algorithm>
+#include <cassert>
 #include <iostream>
 
 namespace MAI {
-VKCmd::VKCmd(VKContext *vkContext) : vkContext(vkContext) {
+VKCmd::VKCmd(VKContext *vkContext)
+    : vkContext(vkContext), vkd(vkContext->getDispatch()) {
   createCommandPool();
   createCommandBuffers();
 }
@@ -15,9 +19,19 @@ void VKCmd::createCommandPool() {
       .queueFamilyIndex = indices.graphcisFamily.value(),
   };
 
-  if (vkCreateCommandPool(vkContext->getDevice(), &poolInfo, nullptr,
-                          &commandPool) != VK_SUCCESS)
+  if (vkd.vkCreateCommandPool(vkContext->getDevice(), &poolInfo, nullptr,
+                              &commandPool) != VK_SUCCESS)
     throw std::runtime_error("failed to create command pool!");
+
+  VkCommandPoolCreateInfo transferPoolInfo = {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+      .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+      .queueFamilyIndex = indices.transferFamily.value(),
+  };
+
+  if (vkd.vkCreateCommandPool(vkContext->getDevice(), &transferPoolInfo,
+                              nullptr, &transferCommandPool) != VK_SUCCESS)
+    throw std::runtime_error("failed to create transfer command pool!");
 }
 
 void VKCmd::createCommandBuffers() {
@@ -28,8 +42,8 @@ void VKCmd::createCommandBuffers() {
       .commandPool = commandPool,
       .commandBufferCount = MAX_FRAMES_IN_FLIGHT,
   };
-  if (vkAllocateCommandBuffers(vkContext->getDevice(), &allocInfo,
-                               commandBuffers.data()) != VK_SUCCESS)
+  if (vkd.vkAllocateCommandBuffers(vkContext->getDevice(), &allocInfo,
+                                   commandBuffers.data()) != VK_SUCCESS)
     throw std::runtime_error("failed to allocate command buffer!");
 }
 
@@ -41,20 +55,21 @@ VkCommandBuffer VKCmd::beginSingleCommandBuffer() {
       .commandBufferCount = 1,
   };
   VkCommandBuffer commandBuffer;
-  vkAllocateCommandBuffers(vkContext->getDevice(), &allocInfo, &commandBuffer);
+  vkd.vkAllocateCommandBuffers(vkContext->getDevice(), &allocInfo,
+                               &commandBuffer);
 
   VkCommandBufferBeginInfo beginInfo{
       .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
       .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
   };
 
-  vkBeginCommandBuffer(commandBuffer, &beginInfo);
+  vkd.vkBeginCommandBuffer(commandBuffer, &beginInfo);
 
   return commandBuffer;
 }
 
 void VKCmd::endSingleCommandBuffer(VkCommandBuffer commandBuffer) {
-  vkEndCommandBuffer(commandBuffer);
+  vkd.vkEndCommandBuffer(commandBuffer);
 
   VkSubmitInfo submitInfo{
       .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
@@ -62,12 +77,269 @@ void VKCmd::endSingleCommandBuffer(VkCommandBuffer commandBuffer) {
       .pCommandBuffers = &commandBuffer,
   };
 
-  vkQueueSubmit(vkContext->getGraphicsQueue(), 1, &submitInfo, VK_NULL_HANDLE);
-  vkQueueWaitIdle(vkContext->getGraphicsQueue());
-  vkFreeCommandBuffers(vkContext->getDevice(), commandPool, 1, &commandBuffer);
+  vkd.vkQueueSubmit(vkContext->getGraphicsQueue(), 1, &submitInfo,
+                    VK_NULL_HANDLE);
+  vkd.vkQueueWaitIdle(vkContext->getGraphicsQueue());
+  vkd.vkFreeCommandBuffers(vkContext->getDevice(), commandPool, 1,
+                           &commandBuffer);
+}
+
+VKCmd::UploadSync VKCmd::acquireUploadSync() {
+  if (!freeUploadSyncs.empty()) {
+    UploadSync sync = freeUploadSyncs.back();
+    freeUploadSyncs.pop_back();
+    return sync;
+  }
+
+  VkSemaphoreCreateInfo semaphoreInfo = {
+      .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+  };
+  VkFenceCreateInfo fenceInfo = {
+      .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+  };
+  UploadSync sync;
+  if (vkd.vkCreateSemaphore(vkContext->getDevice(), &semaphoreInfo, nullptr,
+                            &sync.semaphore) != VK_SUCCESS ||
+      vkd.vkCreateFence(vkContext->getDevice(), &fenceInfo, nullptr,
+                        &sync.fence) != VK_SUCCESS)
+    throw std::runtime_error("failed to create upload sync objects");
+  return sync;
+}
+
+UploadCmd VKCmd::beginUploadCommandBuffers() {
+  return batchOpen ? batchCmd : allocateUploadCmd();
+}
+
+UploadCmd VKCmd::allocateUploadCmd() {
+  UploadCmd cmd;
+
+  VkCommandBufferAllocateInfo allocInfo{
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+      .commandPool = transferCommandPool,
+      .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+      .commandBufferCount = 1,
+  };
+  if (vkd.vkAllocateCommandBuffers(vkContext->getDevice(), &allocInfo,
+                                   &cmd.transfer) != VK_SUCCESS)
+    throw std::runtime_error("failed to allocate transfer command buffer!");
+
+  allocInfo.commandPool = commandPool;
+  if (vkd.vkAllocateCommandBuffers(vkContext->getDevice(), &allocInfo,
+                                   &cmd.acquire) != VK_SUCCESS)
+    throw std::runtime_error("failed to allocate acquire command buffer!");
+
+  VkCommandBufferBeginInfo beginInfo{
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+      .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+  };
+  vkd.vkBeginCommandBuffer(cmd.transfer, &beginInfo);
+  vkd.vkBeginCommandBuffer(cmd.acquire, &beginInfo);
+
+  cmd.id = nextUploadId++;
+  return cmd;
+}
+
+void VKCmd::endUploadCommandBuffers(UploadCmd &cmd) {
+  if (batchOpen) {
+    // stage() may have flushed the batch into fresh command buffers
+    batchCmd = cmd;
+    cmd = {};
+    return;
+  }
+  waitForUpload(submitUpload(cmd));
+}
+
+void VKCmd::beginUploadBatch() {
+  assert(!batchOpen);
+  batchCmd = allocateUploadCmd();
+  batchOpen = true;
+}
+
+uint64_t VKCmd::endUploadBatch() {
+  assert(batchOpen);
+  batchOpen = false;
+  return submitUpload(batchCmd);
+}
+
+bool VKCmd::isUploadComplete(uint64_t id) {
+  if (batchOpen && id == batchCmd.id)
+    return false;
+  pollUploads();
+  for (const PendingUpload &upload : pendingUploads)
+    if (upload.id == id)
+      return false;
+  return true;
+}
+
+uint64_t VKCmd::submitUpload(UploadCmd &cmd) {
+  vkd.vkEndCommandBuffer(cmd.transfer);
+  vkd.vkEndCommandBuffer(cmd.acquire);
+
+  UploadSync sync = acquireUploadSync();
+
+  if (vkContext->hasDedicatedTransferQueue()) {
+    VkSubmitInfo transferSubmit{
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &cmd.transfer,
+        .signalSemaphoreCount = 1,
+        .pSignalSemaphores = &sync.semaphore,
+    };
+    if (vkd.vkQueueSubmit(vkContext->getTransferQueue(), 1, &transferSubmit,
+                          VK_NULL_HANDLE) != VK_SUCCESS)
+      throw std::runtime_error("failed to submit to the transfer queue");
+
+    VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+    VkSubmitInfo acquireSubmit{
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .waitSemaphoreCount = 1,
+        .pWaitSemaphores = &sync.semaphore,
+        .pWaitDstStageMask = &waitStage,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &cmd.acquire,
+    };
+    if (vkd.vkQueueSubmit(vkContext->getGraphicsQueue(), 1, &acquireSubmit,
+                          sync.fence) != VK_SUCCESS)
+      throw std::runtime_error("failed to submit to the queue");
+  } else {
+    // same family: submission order is enough, the acquire buffer only
+    // carries the visibility barrier
+    VkCommandBuffer commandBuffers[] = {cmd.transfer, cmd.acquire};
+    VkSubmitInfo submitInfo{
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .commandBufferCount = 2,
+        .pCommandBuffers = commandBuffers,
+    };
+    if (vkd.vkQueueSubmit(vkContext->getGraphicsQueue(), 1, &submitInfo,
+                          sync.fence) != VK_SUCCESS)
+      throw std::runtime_error("failed to submit to the queue");
+  }
+
+  const uint64_t id = cmd.id;
+  pendingUploads.push_back({.id = id, .sync = sync, .cmd = cmd});
+  cmd = {};
+  return id;
+}
+
+void VKCmd::waitForUpload(uint64_t id) {
+  // an open batch would never signal
+  assert(!batchOpen || id != batchCmd.id);
+  for (auto it = pendingUploads.begin(); it != pendingUploads.end(); ++it) {
+    if (it->id != id)
+      continue;
+    // wait for this upload only, frames in flight keep running
+    vkd.vkWaitForFences(vkContext->getDevice(), 1, &it->sync.fence, VK_TRUE,
+                        UINT64_MAX);
+    retireUpload(*it);
+    pendingUploads.erase(it);
+    break;
+  }
+  pollUploads();
+}
+
+void VKCmd::pollUploads() {
+  for (auto it = pendingUploads.begin(); it != pendingUploads.end();) {
+    if (vkd.vkGetFenceStatus(vkContext->getDevice(), it->sync.fence) ==
+        VK_SUCCESS) {
+      retireUpload(*it);
+      it = pendingUploads.erase(it);
+    } else
+      ++it;
+  }
+}
+
+void VKCmd::retireUpload(PendingUpload &upload) {
+  vkd.vkResetFences(vkContext->getDevice(), 1, &upload.sync.fence);
+  freeUploadSyncs.push_back(upload.sync);
+
+  vkd.vkFreeCommandBuffers(vkContext->getDevice(), transferCommandPool, 1,
+                           &upload.cmd.transfer);
+  vkd.vkFreeCommandBuffers(vkContext->getDevice(), commandPool, 1,
+                           &upload.cmd.acquire);
+  if (stagingRing)
+    stagingRing->retire(upload.id);
+}
+
+StagingRegion VKCmd::stage(UploadCmd &cmd, VkDeviceSize size,
+                           VkDeviceSize alignment) {
+  assert(stagingRing && size <= stagingRing->getCapacity());
+
+  StagingRegion region;
+  while (!stagingRing->allocate(size, alignment, cmd.id, region)) {
+    const uint64_t oldest = stagingRing->getOldestUpload();
+    if (oldest == cmd.id) {
+      // cmd alone fills the ring: flush the copies recorded so far and go
+      // on in a fresh pair of command buffers. later barriers on the same
+      // queue still cover these writes
+      waitForUpload(submitUpload(cmd));
+      cmd = allocateUploadCmd();
+      if (batchOpen)
+        batchCmd = cmd;
+      continue;
+    }
+    waitForUpload(oldest);
+    if (stagingRing->getOldestUpload() == oldest)
+      throw std::runtime_error("staging ring held by an unsubmitted upload");
+  }
+  return region;
+}
+
+void VKCmd::removeDirtyBuffer(VKbuffer *buffer) {
+  dirtyBuffers.erase(
+      std::remove(dirtyBuffers.begin(), dirtyBuffers.end(), buffer),
+      dirtyBuffers.end());
+}
+
+void VKCmd::recordBufferUpdates(VkCommandBuffer commandBuffer,
+                                VKFrameAllocator *frameAllocator) {
+  if (dirtyBuffers.empty())
+    return;
+
+  // earlier frames on this queue may still read or write the buffers
+  VkMemoryBarrier2 barrier{
+      .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+      .srcStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+      .srcAccessMask = VK_ACCESS_2_MEMORY_WRITE_BIT,
+      .dstStageMask = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT,
+      .dstAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+  };
+  VkDependencyInfo dependencyInfo{
+      .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+      .memoryBarrierCount = 1,
+      .pMemoryBarriers = &barrier,
+  };
+  vkd.vkCmdPipelineBarrier2(commandBuffer, &dependencyInfo);
+
+  for (VKbuffer *buffer : dirtyBuffers)
+    buffer->recordUpdates(commandBuffer, frameAllocator);
+  dirtyBuffers.clear();
+
+  // and this frame reads them after the copies
+  barrier = {
+      .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+      .srcStageMask = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT,
+      .srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+      .dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+      .dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT,
+  };
+  vkd.vkCmdPipelineBarrier2(commandBuffer, &dependencyInfo);
 }
 
 VKCmd::~VKCmd() {
-  vkDestroyCommandPool(vkContext->getDevice(), commandPool, nullptr);
+  if (batchOpen)
+    endUploadBatch();
+  for (PendingUpload &upload : pendingUploads) {
+    vkd.vkWaitForFences(vkContext->getDevice(), 1, &upload.sync.fence,
+                        VK_TRUE, UINT64_MAX);
+    retireUpload(upload);
+  }
+  pendingUploads.clear();
+  for (UploadSync &sync : freeUploadSyncs) {
+    vkd.vkDestroyFence(vkContext->getDevice(), sync.fence, nullptr);
+    vkd.vkDestroySemaphore(vkContext->getDevice(), sync.semaphore, nullptr);
+  }
+  vkd.vkDestroyCommandPool(vkContext->getDevice(), transferCommandPool,
+                           nullptr);
+  vkd.vkDestroyCommandPool(vkContext->getDevice(), commandPool, nullptr);
 }
 }; // namespace MAI
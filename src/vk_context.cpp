@@ -1,7 +1,14 @@
 #include "vk_context.h"
+#include "vk_allocator.h"
+#include "vk_resource_tracker.h"
+#include "vk_sampler.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <set>
 #include <stdexcept>
+#include <string>
 
 static void framebufferResizeCallback(GLFWwindow *window, int width,
                                       int height) {
@@ -12,36 +19,53 @@ static void framebufferResizeCallback(GLFWwindow *window, int width,
 
 namespace MAI {
 
-VKContext::VKContext(const char *appName, GLFWwindow *window) : window(window) {
+VKContext::VKContext(ContextInfo info) : window(info.window), info_(info) {
+  enableValidationLayers = info_.validation != MAI_VALIDATION_OFF;
 
-  windowCallbacks();
-  createInstance(appName);
+  if (!isHeadless())
+    windowCallbacks();
+  createInstance(info_.appName);
   setupDebugMessenger();
-  createSurfaceKHR();
+  if (!isHeadless())
+    createSurfaceKHR();
   pickPhysicalDevice();
+  probeCapabilities();
   createLogicalDevice();
+  allocator = new VKAllocator(this);
+  resourceTracker = new VKResourceTracker();
+  samplerCache = new VKSamplerCache(this);
 }
 
+// runs on driver threads: only queue the message, printing happens in
+// VKContext::drainDebugMessages
 static VKAPI_ATTR VkBool32 VKAPI_CALL
 debugCallback(VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
               VkDebugUtilsMessageTypeFlagsEXT type,
-              const VkDebugUtilsMessengerCallbackDataEXT *pCallback, void *) {
-  std::cerr << "validation layer: " << pCallback->pMessage << std::endl;
+              const VkDebugUtilsMessengerCallbackDataEXT *pCallback,
+              void *pUserData) {
+  static_cast<VKDebugLog *>(pUserData)->push(
+      messageSeverity, pCallback->messageIdNumber, pCallback->pMessage);
   return VK_FALSE;
 }
 
-void populateDebugMessenger(VkDebugUtilsMessengerCreateInfoEXT &createInfo) {
+void populateDebugMessenger(VkDebugUtilsMessengerCreateInfoEXT &createInfo,
+                            ValidationMode mode, VKDebugLog *log) {
   createInfo = {};
   createInfo = {
       .sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT,
-      .messageSeverity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT |
-                         VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT |
+      .messageSeverity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT |
                          VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT,
       .messageType = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT |
                      VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT |
                      VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT,
       .pfnUserCallback = debugCallback,
+      .pUserData = log,
   };
+
+  if (mode == MAI_VALIDATION_ERRORS) {
+    createInfo.messageSeverity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
+    createInfo.messageType = VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT;
+  }
 }
 
 bool checkValiadationLayers() {
@@ -65,17 +89,21 @@ bool checkValiadationLayers() {
 }
 
 std::vector<const char *>
-getRequriedExtensiosn(bool enableValidationLayers = false) {
-
-  uint32_t glfwExtensionsCount = 0;
-  const char **glfwExtensions =
-      glfwGetRequiredInstanceExtensions(&glfwExtensionsCount);
-
-  std::vector<const char *> extensions(glfwExtensions,
-                                       glfwExtensions + glfwExtensionsCount);
-  if (enableValidationLayers) {
+getRequriedExtensiosn(ValidationMode validation = MAI_VALIDATION_OFF,
+                      bool headless = false) {
+
+  std::vector<const char *> extensions;
+  if (!headless) {
+    uint32_t glfwExtensionsCount = 0;
+    const char **glfwExtensions =
+        glfwGetRequiredInstanceExtensions(&glfwExtensionsCount);
+    extensions.assign(glfwExtensions, glfwExtensions + glfwExtensionsCount);
+  }
+  if (validation != MAI_VALIDATION_OFF) {
     extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
   }
+  if (validation == MAI_VALIDATION_GPU_ASSISTED)
+    extensions.push_back(VK_EXT_VALIDATION_FEATURES_EXTENSION_NAME);
 
   return extensions;
 }
@@ -94,6 +122,15 @@ QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device,
     if (queueFamilyProperties[i].queueFlags & VK_QUEUE_GRAPHICS_BIT)
       indices.graphcisFamily = i;
 
+    // headless: nothing is presented, the graphics queue stands in
+    if (surface == VK_NULL_HANDLE) {
+      if (indices.graphcisFamily.has_value())
+        indices.presentFamily = indices.graphcisFamily;
+      if (indices.isComplete())
+        break;
+      continue;
+    }
+
     VkBool32 supported = false;
     vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &supported);
 
@@ -104,9 +141,47 @@ QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device,
       break;
   }
 
+  // a family without graphics (and ideally without compute) maps to the
+  // copy engine, uploads there do not compete with rendering
+  std::optional<uint32_t> transferOnly;
+  for (uint32_t i = 0; i < queueFamiliesCount; i++) {
+    const VkQueueFlags flags = queueFamilyProperties[i].queueFlags;
+    if (!(flags & VK_QUEUE_TRANSFER_BIT) || (flags & VK_QUEUE_GRAPHICS_BIT))
+      continue;
+    if (!(flags & VK_QUEUE_COMPUTE_BIT)) {
+      transferOnly = i;
+      break;
+    }
+    if (!transferOnly.has_value())
+      transferOnly = i;
+  }
+  indices.transferFamily =
+      transferOnly.has_value() ? transferOnly : indices.graphcisFamily;
+
   return indices;
 }
 
+std::vector<const char *> getDeviceExtensions(bool headless) {
+  std::vector<const char *> extensions;
+  for (const char *extension : deviceExtensions)
+    if (!headless || strcmp(extension, VK_KHR_SWAPCHAIN_EXTENSION_NAME) != 0)
+      extensions.push_back(extension);
+  return extensions;
+}
+
+bool hasDeviceExtension(VkPhysicalDevice device, const char *name) {
+  uint32_t extensionCount;
+  vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount,
+                                       nullptr);
+  std::vector<VkExtensionProperties> extensions(extensionCount);
+  vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount,
+                                       extensions.data());
+  for (const VkExtensionProperties &extension : extensions)
+    if (strcmp(extension.extensionName, name) == 0)
+      return true;
+  return false;
+}
+
 void VKContext::windowCallbacks() {
   glfwSetWindowUserPointer(window, this);
   glfwSetFramebufferSizeCallback(window, framebufferResizeCallback);
@@ -129,7 +204,7 @@ void VKContext::createInstance(const char *appName) {
   if (enableValidationLayers && !checkValiadationLayers())
     throw std::runtime_error("validation layer requestion but not available!");
 
-  auto extensions = getRequriedExtensiosn(enableValidationLayers);
+  auto extensions = getRequriedExtensiosn(info_.validation, isHeadless());
   VkInstanceCreateInfo createInfo{
       .sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
       .pApplicationInfo = &appInfo,
@@ -143,13 +218,26 @@ void VKContext::createInstance(const char *appName) {
         static_cast<uint32_t>(validationLayers.size());
     createInfo.ppEnabledLayerNames = validationLayers.data();
 
-    populateDebugMessenger(debugInfo);
+    populateDebugMessenger(debugInfo, info_.validation, &debugLog);
     createInfo.pNext = (VkDebugUtilsMessengerCreateInfoEXT *)&debugInfo;
   } else {
     createInfo.enabledLayerCount = 0;
     createInfo.pNext = nullptr;
   }
 
+  VkValidationFeatureEnableEXT gpuAssisted[] = {
+      VK_VALIDATION_FEATURE_ENABLE_GPU_ASSISTED_EXT,
+      VK_VALIDATION_FEATURE_ENABLE_GPU_ASSISTED_RESERVE_BINDING_SLOT_EXT,
+  };
+  VkValidationFeaturesEXT validationFeatures{
+      .sType = VK_STRUCTURE_TYPE_VALIDATION_FEATURES_EXT,
+      .pNext = &debugInfo,
+      .enabledValidationFeatureCount = 2,
+      .pEnabledValidationFeatures = gpuAssisted,
+  };
+  if (info_.validation == MAI_VALIDATION_GPU_ASSISTED)
+    createInfo.pNext = &validationFeatures;
+
   if (vkCreateInstance(&createInfo, nullptr, &instance) != VK_SUCCESS)
     throw std::runtime_error("failed to create instance");
 }
@@ -181,7 +269,7 @@ void VKContext::setupDebugMessenger() {
     return;
 
   VkDebugUtilsMessengerCreateInfoEXT createInfo{};
-  populateDebugMessenger(createInfo);
+  populateDebugMessenger(createInfo, info_.validation, &debugLog);
   if (CreateDebugUtilsMessengerEXT(instance, &createInfo, nullptr,
                                    &debugMessenger) != VK_SUCCESS)
     throw std::runtime_error("failed to debug Utils Messenger");
@@ -193,7 +281,8 @@ void VKContext::createSurfaceKHR() {
     throw std::runtime_error("failed to create window surface");
 }
 
-bool isDeviceSuitable(VkPhysicalDevice device) {
+bool isDeviceSuitable(VkPhysicalDevice device, VkSurfaceKHR surface,
+                      bool headless) {
   uint32_t extensionCount;
   vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount,
                                        nullptr);
@@ -207,19 +296,85 @@ bool isDeviceSuitable(VkPhysicalDevice device) {
 
   bool isSuitable = properties.apiVersion >= VK_API_VERSION_1_3;
 
-  std::set<const char *> requiredExtensions(deviceExtensions.begin(),
-                                            deviceExtensions.end());
+  const std::vector<const char *> wanted = getDeviceExtensions(headless);
+  std::set<const char *> requiredExtensions(wanted.begin(), wanted.end());
 
   for (uint32_t i = 0; i < extensionCount; i++)
-    for (const char *extension : deviceExtensions)
+    for (const char *extension : wanted)
       if (strcmp(extension, extensions[i].extensionName) == 0)
         requiredExtensions.erase(extension);
 
-  isSuitable = requiredExtensions.empty();
+  isSuitable = isSuitable && requiredExtensions.empty();
+  isSuitable = isSuitable && findQueueFamilies(device, surface).isComplete();
 
   return isSuitable;
 }
 
+// higher is better: device type dominates, then the amount of device-local
+// memory, then queue layout and optional features as tie breakers
+uint64_t scorePhysicalDevice(VkPhysicalDevice device, VkSurfaceKHR surface) {
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(device, &properties);
+  VkPhysicalDeviceMemoryProperties memProperties;
+  vkGetPhysicalDeviceMemoryProperties(device, &memProperties);
+  VkPhysicalDeviceFeatures features;
+  vkGetPhysicalDeviceFeatures(device, &features);
+
+  // tiers 10000 apart, above what memory, queues and features add up to
+  uint64_t score = 0;
+  switch (properties.deviceType) {
+  case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:
+    score += 40000;
+    break;
+  case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU:
+    score += 30000;
+    break;
+  case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:
+    score += 20000;
+    break;
+  case VK_PHYSICAL_DEVICE_TYPE_CPU:
+    score += 10000;
+    break;
+  default:
+    break;
+  }
+
+  VkDeviceSize deviceLocal = 0;
+  for (uint32_t i = 0; i < memProperties.memoryHeapCount; i++)
+    if (memProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+      deviceLocal = std::max(deviceLocal, memProperties.memoryHeaps[i].size);
+  // 100 points per GiB up to 8000, so memory never outranks the device
+  // type. CPU devices report system RAM here
+  score += std::min<uint64_t>(deviceLocal >> 30, 80) * 100;
+
+  QueueFamilyIndices indices = findQueueFamilies(device, surface);
+  if (indices.transferFamily != indices.graphcisFamily)
+    score += 50;
+  if (indices.presentFamily == indices.graphcisFamily)
+    score += 10;
+
+  const VkBool32 optional[] = {
+      features.pipelineStatisticsQuery, features.multiDrawIndirect,
+      features.drawIndirectFirstInstance, features.textureCompressionBC,
+      features.textureCompressionASTC_LDR, features.textureCompressionETC2,
+  };
+  for (VkBool32 supported : optional)
+    if (supported)
+      score += 5;
+
+  return score;
+}
+
+// MAI_DEVICE is either an enumeration index or a substring of the name
+static bool matchesOverride(const char *selector, uint32_t index,
+                            const VkPhysicalDeviceProperties &properties) {
+  char *end = nullptr;
+  const long value = strtol(selector, &end, 10);
+  if (end != selector && *end == '\0')
+    return value == static_cast<long>(index);
+  return strstr(properties.deviceName, selector) != nullptr;
+}
+
 void VKContext::pickPhysicalDevice() {
 
   uint32_t deviceCount;
@@ -231,14 +386,92 @@ void VKContext::pickPhysicalDevice() {
   devices.resize(deviceCount);
   vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
 
-  for (uint32_t i = 0; i < deviceCount; i++)
-    if (isDeviceSuitable(devices[i])) {
+  std::string selector;
+  if (const char *env = getenv("MAI_DEVICE"))
+    selector = env;
+  else if (info_.deviceName)
+    selector = info_.deviceName;
+  else if (info_.deviceIndex >= 0)
+    selector = std::to_string(info_.deviceIndex);
+
+  uint64_t bestScore = 0;
+  for (uint32_t i = 0; i < deviceCount; i++) {
+    if (!isDeviceSuitable(devices[i], surface, isHeadless()))
+      continue;
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(devices[i], &properties);
+    if (!selector.empty() &&
+        matchesOverride(selector.c_str(), i, properties)) {
       physicalDevice = devices[i];
-      break;
+      return;
     }
 
+    const uint64_t score = scorePhysicalDevice(devices[i], surface);
+    if (physicalDevice == VK_NULL_HANDLE || score > bestScore) {
+      physicalDevice = devices[i];
+      bestScore = score;
+    }
+  }
+
   if (physicalDevice == VK_NULL_HANDLE)
     throw std::runtime_error("failed to find suitable GPU!");
+  if (!selector.empty())
+    std::cerr << "no suitable GPU matches \"" << selector
+              << "\", using the highest scoring one" << std::endl;
+}
+
+void VKContext::probeCapabilities() {
+  vkGetPhysicalDeviceProperties(physicalDevice, &capabilities.properties);
+  vkGetPhysicalDeviceFeatures(physicalDevice, &capabilities.features);
+  vkGetPhysicalDeviceMemoryProperties(physicalDevice,
+                                      &capabilities.memoryProperties);
+
+  uint32_t familyCount;
+  vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount,
+                                           nullptr);
+  capabilities.queueFamilies.resize(familyCount);
+  vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount,
+                                           capabilities.queueFamilies.data());
+
+  const VkPhysicalDeviceMemoryProperties &memory =
+      capabilities.memoryProperties;
+  for (uint32_t i = 0; i < memory.memoryHeapCount; i++)
+    if (memory.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+      capabilities.deviceLocalBytes += memory.memoryHeaps[i].size;
+
+  constexpr VkMemoryPropertyFlags directFlags =
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT |
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+      VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+  for (uint32_t i = 0; i < memory.memoryTypeCount; i++)
+    if ((memory.memoryTypes[i].propertyFlags & directFlags) == directFlags &&
+        memory.memoryHeaps[memory.memoryTypes[i].heapIndex].size >
+            (256ull << 20))
+      capabilities.hostVisibleVram = true;
+
+  capabilities.memoryBudget =
+      hasDeviceExtension(physicalDevice, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+
+  for (VkFormat format : {VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT,
+                          VK_FORMAT_D24_UNORM_S8_UINT})
+    if (getFormatProperties(format).optimalTilingFeatures &
+        VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT) {
+      capabilities.depthFormat = format;
+      break;
+    }
+  if (capabilities.depthFormat == VK_FORMAT_UNDEFINED)
+    throw std::runtime_error("failed to find a supported depth format");
+}
+
+const VkFormatProperties &VKContext::getFormatProperties(VkFormat format) {
+  auto it = capabilities.formats.find(format);
+  if (it != capabilities.formats.end())
+    return it->second;
+
+  VkFormatProperties props;
+  vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &props);
+  return capabilities.formats.emplace(format, props).first->second;
 }
 
 void VKContext::createLogicalDevice() {
@@ -246,7 +479,8 @@ void VKContext::createLogicalDevice() {
   indices = findQueueFamilies(physicalDevice, surface);
 
   std::set<uint32_t> uniqueQueueFamilies = {indices.graphcisFamily.value(),
-                                            indices.presentFamily.value()};
+                                            indices.presentFamily.value(),
+                                            indices.transferFamily.value()};
 
   std::vector<VkDeviceQueueCreateInfo> deviceQueueInfos;
   float queuePriority = 0.5f;
@@ -274,10 +508,23 @@ void VKContext::createLogicalDevice() {
       .runtimeDescriptorArray = VK_TRUE,
   };
 
+  const VkPhysicalDeviceFeatures &supportedFeatures = capabilities.features;
+
+  // members in declaration order, as designated initializers require
   VkPhysicalDeviceFeatures deviceFeatures{
       .geometryShader = VK_TRUE,
+      // optional, let vertex pulled draws go out in one indirect call
+      .multiDrawIndirect = supportedFeatures.multiDrawIndirect,
+      .drawIndirectFirstInstance = supportedFeatures.drawIndirectFirstInstance,
       .fillModeNonSolid = VK_TRUE,
       .samplerAnisotropy = VK_TRUE,
+      // optional, block compressed KTX2 textures of each family
+      .textureCompressionETC2 = supportedFeatures.textureCompressionETC2,
+      .textureCompressionASTC_LDR =
+          supportedFeatures.textureCompressionASTC_LDR,
+      .textureCompressionBC = supportedFeatures.textureCompressionBC,
+      // optional, used by the profiler
+      .pipelineStatisticsQuery = supportedFeatures.pipelineStatisticsQuery,
   };
 
   VkPhysicalDeviceExtendedDynamicStateFeaturesEXT dynamicStateFeatues = {
@@ -300,29 +547,47 @@ void VKContext::createLogicalDevice() {
       .features = deviceFeatures,
   };
 
+  std::vector<const char *> extensions = getDeviceExtensions(isHeadless());
+  // optional
+  if (capabilities.memoryBudget)
+    extensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+
   VkDeviceCreateInfo createInfo{
       .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
       .pNext = &deviceFeatures2,
       .queueCreateInfoCount = static_cast<uint32_t>(deviceQueueInfos.size()),
       .pQueueCreateInfos = deviceQueueInfos.data(),
-      .enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size()),
-      .ppEnabledExtensionNames = deviceExtensions.data(),
+      .enabledExtensionCount = static_cast<uint32_t>(extensions.size()),
+      .ppEnabledExtensionNames = extensions.data(),
   };
 
   if (vkCreateDevice(physicalDevice, &createInfo, nullptr, &device) !=
       VK_SUCCESS)
     throw std::runtime_error("failed to create logical device");
-
-  vkGetDeviceQueue(device, indices.graphcisFamily.value(), 0, &graphicsQueue);
-  vkGetDeviceQueue(device, indices.presentFamily.value(), 0, &presentQueue);
+  enabledFeatures = deviceFeatures;
+  dispatch.load(device, !isHeadless());
+
+  dispatch.vkGetDeviceQueue(device, indices.graphcisFamily.value(), 0,
+                            &graphicsQueue);
+  dispatch.vkGetDeviceQueue(device, indices.presentFamily.value(), 0,
+                            &presentQueue);
+  dispatch.vkGetDeviceQueue(device, indices.transferFamily.value(), 0,
+                            &transferQueue);
 }
 
 VKContext::~VKContext() {
 
-  vkDestroyDevice(device, nullptr);
+  delete samplerCache;
+  delete resourceTracker;
+  delete allocator;
+  dispatch.vkDestroyDevice(device, nullptr);
 
-  vkDestroySurfaceKHR(instance, surface, nullptr);
-  DestroyDebugUtilsMessengerEXT(instance, debugMessenger, nullptr);
+  if (!isHeadless())
+    vkDestroySurfaceKHR(instance, surface, nullptr);
+  if (debugMessenger != VK_NULL_HANDLE) {
+    debugLog.drain();
+    DestroyDebugUtilsMessengerEXT(instance, debugMessenger, nullptr);
+  }
   vkDestroyInstance(instance, nullptr);
 }
 
@@ -0,0 +1,154 @@
+#include "vk_debug.h"
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+namespace MAI {
+
+static uint64_t hashMessage(int32_t messageId, const char *text) {
+  // FNV-1a over the id and the text
+  uint64_t hash = 1469598103934665603ull ^ static_cast<uint32_t>(messageId);
+  for (const char *c = text; *c; c++) {
+    hash ^= static_cast<unsigned char>(*c);
+    hash *= 1099511628211ull;
+  }
+  // 0 marks an empty bucket
+  return hash ? hash : 1;
+}
+
+VKDebugLog::VKDebugLog() {
+  for (uint32_t i = 0; i < DEBUG_LOG_CAPACITY; i++)
+    slots[i].sequence.store(i, std::memory_order_relaxed);
+  for (uint32_t i = 0; i < DEBUG_LOG_SEEN_CAPACITY; i++) {
+    seenHashes[i].store(0, std::memory_order_relaxed);
+    seenRepeats[i].store(0, std::memory_order_relaxed);
+    seenIds[i].store(0, std::memory_order_relaxed);
+  }
+}
+
+bool VKDebugLog::isRepeat(uint64_t hash, int32_t messageId,
+                          uint32_t &bucket) {
+  constexpr uint32_t maxProbes = 16;
+  bucket = DEBUG_LOG_SEEN_CAPACITY;
+  for (uint32_t probe = 0; probe < maxProbes; probe++) {
+    const uint32_t index =
+        static_cast<uint32_t>(hash + probe) & (DEBUG_LOG_SEEN_CAPACITY - 1);
+    uint64_t current = seenHashes[index].load(std::memory_order_acquire);
+    if (current == hash) {
+      seenRepeats[index].fetch_add(1, std::memory_order_relaxed);
+      return true;
+    }
+    if (current == 0) {
+      if (seenHashes[index].compare_exchange_strong(
+              current, hash, std::memory_order_acq_rel)) {
+        seenIds[index].store(messageId, std::memory_order_relaxed);
+        bucket = index;
+        return false;
+      }
+      // another thread claimed the bucket first, it may be our message
+      if (current == hash) {
+        seenRepeats[index].fetch_add(1, std::memory_order_relaxed);
+        return true;
+      }
+    }
+  }
+  // table is full around this hash, let the message through
+  return false;
+}
+
+void VKDebugLog::forget(uint32_t bucket) {
+  if (bucket == DEBUG_LOG_SEEN_CAPACITY)
+    return;
+  // copies that arrived meanwhile were dropped along with it
+  seenRepeats[bucket].store(0, std::memory_order_relaxed);
+  seenHashes[bucket].store(0, std::memory_order_release);
+}
+
+bool VKDebugLog::isRateLimited() {
+  const int64_t now =
+      std::chrono::duration_cast<std::chrono::milliseconds>(
+          std::chrono::steady_clock::now().time_since_epoch())
+          .count();
+  int64_t start = windowStart.load(std::memory_order_relaxed);
+  if (now - start >= 1000 &&
+      windowStart.compare_exchange_strong(start, now,
+                                          std::memory_order_relaxed))
+    windowCount.store(0, std::memory_order_relaxed);
+
+  return windowCount.fetch_add(1, std::memory_order_relaxed) >=
+         DEBUG_LOG_RATE_LIMIT;
+}
+
+void VKDebugLog::push(VkDebugUtilsMessageSeverityFlagBitsEXT severity,
+                      int32_t messageId, const char *text) {
+  uint32_t bucket;
+  if (isRepeat(hashMessage(messageId, text), messageId, bucket))
+    return;
+  if (isRateLimited()) {
+    dropped.fetch_add(1, std::memory_order_relaxed);
+    forget(bucket);
+    return;
+  }
+
+  uint64_t pos = head.load(std::memory_order_relaxed);
+  for (;;) {
+    Slot &slot = slots[pos & (DEBUG_LOG_CAPACITY - 1)];
+    const uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+    const int64_t diff =
+        static_cast<int64_t>(sequence) - static_cast<int64_t>(pos);
+    if (diff == 0) {
+      if (head.compare_exchange_weak(pos, pos + 1,
+                                     std::memory_order_relaxed)) {
+        slot.message.severity = severity;
+        slot.message.messageId = messageId;
+        strncpy(slot.message.text, text, DEBUG_MESSAGE_LENGTH - 1);
+        slot.message.text[DEBUG_MESSAGE_LENGTH - 1] = '\0';
+        slot.sequence.store(pos + 1, std::memory_order_release);
+        return;
+      }
+    } else if (diff < 0) {
+      // ring is full until the next drain
+      dropped.fetch_add(1, std::memory_order_relaxed);
+      forget(bucket);
+      return;
+    } else
+      pos = head.load(std::memory_order_relaxed);
+  }
+}
+
+void VKDebugLog::drain() {
+  for (;;) {
+    Slot &slot = slots[tail & (DEBUG_LOG_CAPACITY - 1)];
+    if (slot.sequence.load(std::memory_order_acquire) != tail + 1)
+      break;
+
+    const char *prefix =
+        slot.message.severity >= VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT
+            ? "validation error: "
+            : "validation layer: ";
+    std::cerr << prefix << slot.message.text << std::endl;
+
+    slot.sequence.store(tail + DEBUG_LOG_CAPACITY, std::memory_order_release);
+    tail++;
+  }
+
+  for (uint32_t i = 0; i < DEBUG_LOG_SEEN_CAPACITY; i++) {
+    if (seenRepeats[i].load(std::memory_order_relaxed) == 0)
+      continue;
+    const uint32_t repeats =
+        seenRepeats[i].exchange(0, std::memory_order_relaxed);
+    if (repeats > 0)
+      std::cerr << "validation layer: message 0x" << std::hex
+                << static_cast<uint32_t>(seenIds[i].load()) << std::dec
+                << " repeated " << repeats << " more times" << std::endl;
+  }
+
+  const uint64_t droppedNow = dropped.load(std::memory_order_relaxed);
+  if (droppedNow != reportedDropped) {
+    std::cerr << "validation layer: " << droppedNow - reportedDropped
+              << " messages dropped by the rate limit" << std::endl;
+    reportedDropped = droppedNow;
+  }
+}
+
+}; // namespace MAI
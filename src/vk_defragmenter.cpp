@@ -0,0 +1,247 @@
+#include "vk_defragmenter.h"
+#include "vk_buffer.h"
+#include "vk_image.h"
+#include "vk_residency.h"
+#include <algorithm>
+#include <chrono>
+#include <unordered_map>
+
+namespace MAI {
+
+VKDefragmenter::VKDefragmenter(VKContext *vkContext, VKResidency *residency,
+                               DefragInfo info)
+    : vkContext(vkContext), residency(residency), info_(info) {
+  assert(info_.maxMovesPerFrame > 0);
+}
+
+void VKDefragmenter::step(VkCommandBuffer commandBuffer,
+                          uint32_t frameIndex) {
+  using clock = std::chrono::steady_clock;
+  const clock::time_point start = clock::now();
+
+  frame++;
+  release(false);
+  fixDescriptors(frameIndex);
+  if (!info_.enabled)
+    return;
+
+  VKAllocator *allocator = vkContext->getAllocator();
+  if (!passRunning) {
+    // only when fragmentation grew since the last pass left off, what that
+    // pass could not move would start every frame otherwise
+    const FragmentationStats stats = allocator->getFragmentation();
+    if (stats.ratio <= info_.minRatio || stats.ratio <= lastPass.ratioAfter)
+      return;
+    passRunning = true;
+    pass = {.ratioBefore = stats.ratio};
+    skipped.clear();
+  }
+
+  const std::chrono::duration<float, std::milli> budget(info_.budgetMs);
+  clock::duration slowest{};
+  VkDeviceSize bytes = 0;
+  for (uint32_t moves = 0; moves < info_.maxMovesPerFrame; moves++) {
+    if (moves && clock::now() - start + slowest > budget)
+      return;
+    if (bytes >= info_.maxBytesPerFrame)
+      return;
+
+    if (source.memory == VK_NULL_HANDLE && !pickSource()) {
+      // the ratio is only final once the moved out copies are freed
+      if (retired.empty()) {
+        pass.ratioAfter = allocator->getFragmentation().ratio;
+        lastPass = pass;
+        passRunning = false;
+        if (pass.moves)
+          std::cerr << "defragmented device memory, fragmentation "
+                    << pass.ratioBefore << " -> " << pass.ratioAfter << " in "
+                    << pass.moves << " moves of " << pass.bytesMoved
+                    << " bytes" << std::endl;
+      }
+      return;
+    }
+
+    const clock::time_point moveStart = clock::now();
+    if (!moveNext(commandBuffer, frameIndex, bytes))
+      continue;
+    slowest = std::max(slowest, clock::now() - moveStart);
+  }
+}
+
+bool VKDefragmenter::moveNext(VkCommandBuffer commandBuffer,
+                              uint32_t frameIndex, VkDeviceSize &bytes) {
+  // resources demoted since the block was picked are gone from it already
+  auto inSource = [&](const Allocation &allocation) {
+    return allocation.memory == source.memory;
+  };
+
+  if (!sourceTextures.empty()) {
+    VKTexture *texture = sourceTextures.back();
+    sourceTextures.pop_back();
+    if (!inSource(texture->getAllocation()))
+      return false;
+
+    const VkDeviceSize size = texture->getAllocation().footprint();
+    Retired old{.frame = frame};
+    if (!texture->relocate(commandBuffer, old.image, old.view,
+                           old.allocation)) {
+      endSource(false);
+      return false;
+    }
+    retired.push_back(old);
+    // only this frame's commands fill the new image, an eviction before
+    // they are submitted would copy it empty and destroy it under them
+    residency->touch(texture);
+
+    // this frame's set can change now, the others once their frame begins
+    const uint32_t others =
+        ((1u << MAX_FRAMES_IN_FLIGHT) - 1) & ~(1u << frameIndex);
+    auto it =
+        std::find_if(fixups.begin(), fixups.end(), [&](const Fixup &fixup) {
+          return fixup.texture == texture;
+        });
+    if (it == fixups.end())
+      fixups.push_back({.texture = texture, .frames = others});
+    else
+      it->frames = others;
+    if (descriptorFixup)
+      descriptorFixup(texture, frameIndex);
+
+    bytes += size;
+    pass.bytesMoved += size;
+    pass.moves++;
+  } else if (!sourceBuffers.empty()) {
+    VKbuffer *buffer = sourceBuffers.back();
+    sourceBuffers.pop_back();
+    if (!inSource(buffer->getAllocation()))
+      return false;
+
+    const VkDeviceSize size = buffer->getAllocation().footprint();
+    Retired old{.frame = frame};
+    if (!buffer->relocate(commandBuffer, old.buffer, old.allocation)) {
+      endSource(false);
+      return false;
+    }
+    retired.push_back(old);
+    residency->touch(buffer);
+
+    bytes += size;
+    pass.bytesMoved += size;
+    pass.moves++;
+  }
+
+  if (sourceTextures.empty() && sourceBuffers.empty())
+    endSource(true);
+  return true;
+}
+
+bool VKDefragmenter::pickSource() {
+  VKAllocator *allocator = vkContext->getAllocator();
+
+  // bytes each block would lose if every tracked resource in it moved
+  struct Candidate {
+    Allocation allocation;
+    VkDeviceSize movable = 0;
+  };
+  std::unordered_map<VkDeviceMemory, Candidate> candidates;
+  auto add = [&](const Allocation &allocation) {
+    if (allocation.isDedicated() ||
+        std::find(skipped.begin(), skipped.end(), allocation.memory) !=
+            skipped.end())
+      return;
+    Candidate &candidate = candidates[allocation.memory];
+    candidate.allocation = allocation;
+    candidate.movable += allocation.footprint();
+  };
+  for (const auto &[texture, lastUsed] : residency->getTextures())
+    if (texture->isDeviceLocal())
+      add(texture->getAllocation());
+  for (const auto &[buffer, lastUsed] : residency->getBuffers())
+    if (buffer->isDeviceLocal() && buffer->isMovable())
+      add(buffer->getAllocation());
+
+  VkDeviceSize bestUsage = 0;
+  for (const auto &[memory, candidate] : candidates) {
+    const VkDeviceSize usage = allocator->getBlockUsage(candidate.allocation);
+    // a block that keeps anything pinned stays allocated anyway
+    if (candidate.movable < usage ||
+        allocator->getPoolSpareSpace(candidate.allocation) < usage)
+      continue;
+    if (source.memory == VK_NULL_HANDLE || usage < bestUsage) {
+      source = candidate.allocation;
+      bestUsage = usage;
+    }
+  }
+  if (source.memory == VK_NULL_HANDLE)
+    return false;
+
+  allocator->setDraining(source, true);
+  for (const auto &[texture, lastUsed] : residency->getTextures())
+    if (texture->getAllocation().memory == source.memory)
+      sourceTextures.push_back(texture);
+  for (const auto &[buffer, lastUsed] : residency->getBuffers())
+    if (buffer->getAllocation().memory == source.memory)
+      sourceBuffers.push_back(buffer);
+  return true;
+}
+
+void VKDefragmenter::endSource(bool drained) {
+  // a full pool or a buddy split the spare space cannot take: what moved
+  // stays moved, the block takes allocations again
+  if (!drained) {
+    vkContext->getAllocator()->setDraining(source, false);
+    skipped.push_back(source.memory);
+  }
+  source = {};
+  sourceTextures.clear();
+  sourceBuffers.clear();
+}
+
+void VKDefragmenter::fixDescriptors(uint32_t frameIndex) {
+  for (Fixup &fixup : fixups)
+    if (fixup.frames & (1u << frameIndex)) {
+      fixup.frames &= ~(1u << frameIndex);
+      if (descriptorFixup)
+        descriptorFixup(fixup.texture, frameIndex);
+    }
+  std::erase_if(fixups, [](const Fixup &fixup) { return !fixup.frames; });
+}
+
+void VKDefragmenter::release(bool all) {
+  const VKDispatch &vkd = vkContext->getDispatch();
+  const VkDevice device = vkContext->getDevice();
+
+  // the fence of the frame that recorded the copy has been waited on
+  auto done = [&](Retired &old) {
+    if (!all && old.frame + MAX_FRAMES_IN_FLIGHT > frame)
+      return false;
+    if (old.view != VK_NULL_HANDLE)
+      vkd.vkDestroyImageView(device, old.view, nullptr);
+    if (old.image != VK_NULL_HANDLE)
+      vkd.vkDestroyImage(device, old.image, nullptr);
+    if (old.buffer != VK_NULL_HANDLE)
+      vkd.vkDestroyBuffer(device, old.buffer, nullptr);
+    vkContext->getAllocator()->free(old.allocation);
+    return true;
+  };
+  std::erase_if(retired, done);
+}
+
+void VKDefragmenter::removeTexture(VKTexture *texture) {
+  std::erase(sourceTextures, texture);
+  std::erase_if(fixups,
+                [&](const Fixup &fixup) { return fixup.texture == texture; });
+}
+
+void VKDefragmenter::removeBuffer(VKbuffer *buffer) {
+  std::erase(sourceBuffers, buffer);
+}
+
+VKDefragmenter::~VKDefragmenter() {
+  // the caller has waited for the device
+  release(true);
+  if (source.memory != VK_NULL_HANDLE)
+    vkContext->getAllocator()->setDraining(source, false);
+}
+
+}; // namespace MAI
@@ -1,32 +1,22 @@
 #include "vk_descriptor.h"
 #include "vk_context.h"
+#include <algorithm>
 #include <array>
 namespace MAI {
 
 VKDescriptor::VKDescriptor(VKContext *vkContext, DescriptorSetInfo info)
-    : vkContext(vkContext), info_(info) {
+    : vkContext(vkContext), vkd(vkContext->getDispatch()), info_(info) {
   createDescriptorSetLayout();
   createDescriptorPool();
   createDescriptorSets();
 }
 
 void VKDescriptor::createDescriptorSetLayout() {
-
-  std::vector<VkDescriptorBindingFlags> bindingFlags = {
-      // binding 0
-      // (2D texture)
-      VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT |
-          VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT,
-      // binding 1
-      // (sampler)
-      VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT |
-          VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT |
-          // binding 2
-          // (cubemap)
-          VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT |
-          VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT,
-      VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT,
-  };
+  std::vector<VkDescriptorBindingFlags> bindingFlags(
+      info_.uboLayout.size(), VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT |
+                                  VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT);
+  if (!bindingFlags.empty())
+    bindingFlags.back() |= VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT;
 
   VkDescriptorSetLayoutBindingFlagsCreateInfo flagsCreateInfo = {
       .sType =
@@ -43,29 +33,37 @@ void VKDescriptor::createDescriptorSetLayout() {
       .pBindings = info_.uboLayout.data(),
   };
 
-  if (vkCreateDescriptorSetLayout(vkContext->getDevice(), &layoutInfo, nullptr,
-                                  &descriptorSetLayout) != VK_SUCCESS)
+  if (vkd.vkCreateDescriptorSetLayout(vkContext->getDevice(), &layoutInfo,
+                                      nullptr,
+                                      &descriptorSetLayout) != VK_SUCCESS)
     throw std::runtime_error("failed to create descriptor set layout");
 }
 
 void VKDescriptor::createDescriptorPool() {
-  // std::array<VkDescriptorPoolSize, 2> poolSizes{};
-  VkDescriptorPoolSize poolSizes[] = {
-      {VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, MAX_TEXTURES},
-      {VK_DESCRIPTOR_TYPE_SAMPLER, MAX_TEXTURES},
-      {VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, MAX_TEXTURES},
-  };
+  // room for every binding of the layout in each frame's set
+  std::vector<VkDescriptorPoolSize> poolSizes;
+  for (const VkDescriptorSetLayoutBinding &binding : info_.uboLayout) {
+    auto it = std::find_if(poolSizes.begin(), poolSizes.end(),
+                           [&](const VkDescriptorPoolSize &size) {
+                             return size.type == binding.descriptorType;
+                           });
+    const uint32_t count = binding.descriptorCount * MAX_FRAMES_IN_FLIGHT;
+    if (it != poolSizes.end())
+      it->descriptorCount += count;
+    else
+      poolSizes.push_back({binding.descriptorType, count});
+  }
 
   VkDescriptorPoolCreateInfo poolInfo{
       .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
       .flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT,
       .maxSets = MAX_FRAMES_IN_FLIGHT,
-      .poolSizeCount = 3,
-      .pPoolSizes = poolSizes,
+      .poolSizeCount = static_cast<uint32_t>(poolSizes.size()),
+      .pPoolSizes = poolSizes.data(),
   };
 
-  if (vkCreateDescriptorPool(vkContext->getDevice(), &poolInfo, nullptr,
-                             &descriptorPool) != VK_SUCCESS)
+  if (vkd.vkCreateDescriptorPool(vkContext->getDevice(), &poolInfo, nullptr,
+                                 &descriptorPool) != VK_SUCCESS)
     throw std::runtime_error("failed to create pool descirptor");
 }
 
@@ -75,12 +73,15 @@ void VKDescriptor::createDescriptorSets() {
 
   std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT,
                                              descriptorSetLayout);
-  uint32_t counts[] = {MAX_TEXTURES, MAX_TEXTURES};
+  // the variable count binding is allocated at its full size
+  std::vector<uint32_t> counts(
+      MAX_FRAMES_IN_FLIGHT,
+      info_.uboLayout.empty() ? 0 : info_.uboLayout.back().descriptorCount);
   VkDescriptorSetVariableDescriptorCountAllocateInfo countInfo{
       .sType =
           VK_STRUCTURE_TYPE_DESCRIPTOR_SET_VARIABLE_DESCRIPTOR_COUNT_ALLOCATE_INFO,
       .descriptorSetCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT),
-      .pDescriptorCounts = counts,
+      .pDescriptorCounts = counts.data(),
   };
 
   VkDescriptorSetAllocateInfo allocInfo{
@@ -91,56 +92,71 @@ void VKDescriptor::createDescriptorSets() {
       .pSetLayouts = layouts.data(),
   };
 
-  if (vkAllocateDescriptorSets(vkContext->getDevice(), &allocInfo,
-                               descriptorSets.data()) != VK_SUCCESS)
+  if (vkd.vkAllocateDescriptorSets(vkContext->getDevice(), &allocInfo,
+                                   descriptorSets.data()) != VK_SUCCESS)
     throw std::runtime_error("failed to allocate descriptor set");
 }
 
 void VKDescriptor::updateDescriptorImageWrite(VkImageView imageView,
-                                              VkSampler sampler,
                                               uint32_t imageIndex,
-                                              bool isCubemap) {
+                                              TextureFormat format) {
+  for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+    updateFrameDescriptorImageWrite(i, imageView, imageIndex, format);
+}
+
+void VKDescriptor::updateFrameDescriptorImageWrite(uint32_t frameIndex,
+                                                   VkImageView imageView,
+                                                   uint32_t imageIndex,
+                                                   TextureFormat format) {
+  assert(frameIndex < MAX_FRAMES_IN_FLIGHT);
+  assert(format != MAI_DEPTH_TEXTURE);
   VkDescriptorImageInfo imageInfo{
       .imageView = imageView,
       .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
   };
+
+  VkWriteDescriptorSet descriptorWrite{
+      .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+      .dstSet = descriptorSets[frameIndex],
+      .dstBinding = format == MAI_TEXTURE_CUBE       ? 2u
+                    : format == MAI_TEXTURE_2D_ARRAY ? 3u
+                                                     : 0u,
+      .dstArrayElement = imageIndex,
+      .descriptorCount = 1,
+      .descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
+      .pImageInfo = &imageInfo,
+  };
+
+  vkd.vkUpdateDescriptorSets(vkContext->getDevice(), 1, &descriptorWrite, 0,
+                             nullptr);
+}
+
+void VKDescriptor::updateDescriptorSamplerWrite(VkSampler sampler,
+                                                uint32_t index) {
   VkDescriptorImageInfo samplerInfo{
       .sampler = sampler,
   };
 
-  for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-    std::array<VkWriteDescriptorSet, 2> descriptorWrites{};
-    descriptorWrites[0] = {
-        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-        .dstSet = descriptorSets[i],
-        .dstBinding = 0,
-        .dstArrayElement = imageIndex,
-        .descriptorCount = 1,
-        .descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
-        .pImageInfo = &imageInfo,
-    };
-    if (isCubemap)
-      descriptorWrites[0].dstBinding = 2;
-
-    descriptorWrites[1] = {
+  std::array<VkWriteDescriptorSet, MAX_FRAMES_IN_FLIGHT> descriptorWrites{};
+  for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+    descriptorWrites[i] = {
         .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
         .dstSet = descriptorSets[i],
         .dstBinding = 1,
-        .dstArrayElement = imageIndex,
+        .dstArrayElement = index,
         .descriptorCount = 1,
         .descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER,
         .pImageInfo = &samplerInfo,
     };
 
-    vkUpdateDescriptorSets(vkContext->getDevice(), descriptorWrites.size(),
-                           descriptorWrites.data(), 0, nullptr);
-  }
+  vkd.vkUpdateDescriptorSets(vkContext->getDevice(), descriptorWrites.size(),
+                             descriptorWrites.data(), 0, nullptr);
 }
 
 VKDescriptor::~VKDescriptor() {
-  vkDestroyDescriptorSetLayout(vkContext->getDevice(), descriptorSetLayout,
-                               nullptr);
-  vkDestroyDescriptorPool(vkContext->getDevice(), descriptorPool, nullptr);
+  vkd.vkDestroyDescriptorSetLayout(vkContext->getDevice(), descriptorSetLayout,
+                                   nullptr);
+  vkd.vkDestroyDescriptorPool(vkContext->getDevice(), descriptorPool, nullptr);
 }
 
 }; // namespace MAI
@@ -0,0 +1,20 @@
+#include "vk_dispatch.h"
+#include <stdexcept>
+#include <string>
+
+namespace MAI {
+
+void VKDispatch::load(VkDevice device, bool swapchain) {
+#define MAI_LOAD_FUNCTION(name)                                                \
+  name = reinterpret_cast<PFN_##name>(vkGetDeviceProcAddr(device, #name));     \
+  if (!name)                                                                   \
+    throw std::runtime_error("failed to load " + std::string(#name));
+
+  MAI_DEVICE_FUNCTIONS(MAI_LOAD_FUNCTION)
+  if (swapchain) {
+    MAI_SWAPCHAIN_FUNCTIONS(MAI_LOAD_FUNCTION)
+  }
+#undef MAI_LOAD_FUNCTION
+}
+
+}; // namespace MAI
@@ -0,0 +1,67 @@
+#include "vk_frame_allocator.h"
+#include "vk_buffer.h"
+#include <algorithm>
+#include <cassert>
+
+namespace MAI {
+
+VKFrameAllocator::VKFrameAllocator(VKContext *vkContext,
+                                   VkDeviceSize frameSize)
+    : vkContext(vkContext) {
+  const VkPhysicalDeviceLimits &limits = vkContext->getCapabilities().limits();
+  defaultAlignment = std::max({limits.minUniformBufferOffsetAlignment,
+                               limits.minStorageBufferOffsetAlignment,
+                               VkDeviceSize(16)});
+  // every slice starts aligned
+  this->frameSize =
+      (frameSize + defaultAlignment - 1) / defaultAlignment * defaultAlignment;
+
+  VKbuffer::createBuffer(vkContext, this->frameSize * MAX_FRAMES_IN_FLIGHT,
+                         VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT |
+                             VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                             VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
+                             VK_BUFFER_USAGE_INDEX_BUFFER_BIT |
+                             VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                             VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+                             VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                         MAI_MEMORY_DYNAMIC, buffer, allocation);
+
+  VkBufferDeviceAddressInfo addrInfo{
+      .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
+      .buffer = buffer,
+  };
+  baseAddress = vkContext->getDispatch().vkGetBufferDeviceAddress(
+      vkContext->getDevice(), &addrInfo);
+}
+
+void VKFrameAllocator::beginFrame(uint32_t frameIndex) {
+  assert(frameIndex < MAX_FRAMES_IN_FLIGHT);
+  frameBegin = frameIndex * frameSize;
+  head = frameBegin;
+}
+
+FrameAllocation VKFrameAllocator::allocate(VkDeviceSize size,
+                                           VkDeviceSize alignment) {
+  assert(size > 0);
+  if (!alignment)
+    alignment = defaultAlignment;
+
+  const VkDeviceSize offset = (head + alignment - 1) / alignment * alignment;
+  if (offset + size > frameBegin + frameSize)
+    throw std::runtime_error("frame allocator out of memory");
+  head = offset + size;
+
+  return {
+      .buffer = buffer,
+      .offset = offset,
+      .size = size,
+      .data = static_cast<char *>(allocation.mapped) + offset,
+      .address = baseAddress + offset,
+  };
+}
+
+VKFrameAllocator::~VKFrameAllocator() {
+  VKbuffer::destroyBuffer(vkContext, buffer, allocation);
+}
+
+}; // namespace MAI
@@ -1,73 +1,448 @@
 #include "vk_image.h"
-#include <array>
+#include "vk_defragmenter.h"
+#include "vk_residency.h"
+#include "vk_resource_tracker.h"
+#include <algorithm>
+#include <bit>
 namespace MAI {
 
+static uint32_t getTexelLayoutSize(TexelLayout layout) {
+  switch (layout) {
+  case MAI_TEXELS_RGBA8:
+    return 4;
+  case MAI_TEXELS_RGB8:
+    return 3;
+  case MAI_TEXELS_RGBA32F:
+    return 16;
+  case MAI_TEXELS_RGB32F:
+    return 12;
+  default:
+    return 0;
+  }
+}
+
+FormatBlock getFormatBlock(VkFormat format) {
+  // ASTC formats come in UNORM/SRGB pairs, ordered by block size
+  if (format >= VK_FORMAT_ASTC_4x4_UNORM_BLOCK &&
+      format <= VK_FORMAT_ASTC_12x12_SRGB_BLOCK) {
+    static const uint32_t astc[][2] = {
+        {4, 4},  {5, 4},  {5, 5},   {6, 5},   {6, 6},   {8, 5},   {8, 6},
+        {8, 8},  {10, 5}, {10, 6},  {10, 8},  {10, 10}, {12, 10}, {12, 12},
+    };
+    const uint32_t *size = astc[(format - VK_FORMAT_ASTC_4x4_UNORM_BLOCK) / 2];
+    return {.width = size[0], .height = size[1], .bytes = 16};
+  }
+
+  switch (format) {
+  case VK_FORMAT_R8_UNORM:
+  case VK_FORMAT_R8_SRGB:
+    return {.bytes = 1};
+  case VK_FORMAT_R8G8_UNORM:
+  case VK_FORMAT_R8G8_SRGB:
+  case VK_FORMAT_R16_SFLOAT:
+    return {.bytes = 2};
+  case VK_FORMAT_R8G8B8A8_UNORM:
+  case VK_FORMAT_R8G8B8A8_SRGB:
+  case VK_FORMAT_B8G8R8A8_UNORM:
+  case VK_FORMAT_B8G8R8A8_SRGB:
+  case VK_FORMAT_R16G16_SFLOAT:
+  case VK_FORMAT_R32_SFLOAT:
+  case VK_FORMAT_B10G11R11_UFLOAT_PACK32:
+  case VK_FORMAT_E5B9G9R9_UFLOAT_PACK32:
+  case VK_FORMAT_A2B10G10R10_UNORM_PACK32:
+    return {.bytes = 4};
+  case VK_FORMAT_R16G16B16A16_SFLOAT:
+  case VK_FORMAT_R32G32_SFLOAT:
+    return {.bytes = 8};
+  case VK_FORMAT_R32G32B32A32_SFLOAT:
+    return {.bytes = 16};
+
+  case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+  case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+  case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+  case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+  case VK_FORMAT_BC4_UNORM_BLOCK:
+  case VK_FORMAT_BC4_SNORM_BLOCK:
+  case VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK:
+  case VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK:
+  case VK_FORMAT_ETC2_R8G8B8A1_UNORM_BLOCK:
+  case VK_FORMAT_ETC2_R8G8B8A1_SRGB_BLOCK:
+  case VK_FORMAT_EAC_R11_UNORM_BLOCK:
+  case VK_FORMAT_EAC_R11_SNORM_BLOCK:
+    return {.width = 4, .height = 4, .bytes = 8};
+  case VK_FORMAT_BC2_UNORM_BLOCK:
+  case VK_FORMAT_BC2_SRGB_BLOCK:
+  case VK_FORMAT_BC3_UNORM_BLOCK:
+  case VK_FORMAT_BC3_SRGB_BLOCK:
+  case VK_FORMAT_BC5_UNORM_BLOCK:
+  case VK_FORMAT_BC5_SNORM_BLOCK:
+  case VK_FORMAT_BC6H_UFLOAT_BLOCK:
+  case VK_FORMAT_BC6H_SFLOAT_BLOCK:
+  case VK_FORMAT_BC7_UNORM_BLOCK:
+  case VK_FORMAT_BC7_SRGB_BLOCK:
+  case VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK:
+  case VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK:
+  case VK_FORMAT_EAC_R11G11_UNORM_BLOCK:
+  case VK_FORMAT_EAC_R11G11_SNORM_BLOCK:
+    return {.width = 4, .height = 4, .bytes = 16};
+  default:
+    return {};
+  }
+}
+
+VkDeviceSize getImageSize(VkFormat format, uint32_t width, uint32_t height) {
+  const FormatBlock block = getFormatBlock(format);
+  // in 64 bits, widths near 2^32 must not wrap to an empty level
+  return (VkDeviceSize(width) + block.width - 1) / block.width *
+         ((VkDeviceSize(height) + block.height - 1) / block.height) *
+         block.bytes;
+}
+
 VKTexture::VKTexture(VKContext *vkContext, VKCmd *vkCmd,
                      VKSwapchain *vkSwapChain, TextureInfo info)
-    : vkContext(vkContext), vkCmd(vkCmd), vkSwapChain(vkSwapChain),
-      info_(info) {
-  if (info_.format == MAI_TEXTURE_2D) {
-    createTextureImage();
-    createTextureImageView(VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_VIEW_TYPE_2D,
-                           VK_IMAGE_ASPECT_COLOR_BIT);
-    createTextureSampler();
-  } else if (info_.format == MAI_TEXTURE_CUBE) {
-    createTextureImage();
-    createTextureImageView(VK_FORMAT_R32G32B32A32_SFLOAT,
-                           VK_IMAGE_VIEW_TYPE_CUBE, VK_IMAGE_ASPECT_COLOR_BIT);
-    createTextureSampler();
-  } else if (info_.format == MAI_DEPTH_TEXTURE) {
+    : vkContext(vkContext), vkd(vkContext->getDispatch()), vkCmd(vkCmd),
+      vkSwapChain(vkSwapChain), info_(info) {
+  if (info_.format == MAI_DEPTH_TEXTURE) {
     createDepthResources();
-  } else
-    assert(false);
+  } else {
+    if (isRenderTarget())
+      createRenderTarget();
+    else
+      createTextureImage();
+    createTextureImageView(getColorFormat(), getViewType(), getAspect());
+    createTextureSampler();
+  }
+  vkContext->getResourceTracker()->add(this, MAI_RESOURCE_TEXTURE,
+                                       info_.debugName,
+                                       textureAllocation.size);
 }
 
 void VKTexture::createTextureImage() {
-  VkDeviceSize imageSize = info_.width * info_.height * 4;
-  if (info_.format == MAI_TEXTURE_CUBE)
-    imageSize *= sizeof(float) * 6;
-
   if (!info_.data)
     throw std::runtime_error("failed to load texture image!");
 
-  VkBuffer stagingBuffer;
-  VkDeviceMemory stagingBufferMemory;
+  const VkFormat format = getColorFormat();
+  const FormatBlock block = getFormatBlock(format);
+  const VkFormatFeatureFlags features =
+      vkContext->getFormatProperties(format).optimalTilingFeatures;
+  if (!block.bytes || !(features & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT))
+    throw std::runtime_error("texture format is not supported");
+  const VkPhysicalDeviceLimits &limits = vkContext->getCapabilities().limits();
+  const uint32_t maxDimension = info_.format == MAI_TEXTURE_CUBE
+                                    ? limits.maxImageDimensionCube
+                                    : limits.maxImageDimension2D;
+  if (info_.width > maxDimension || info_.height > maxDimension)
+    throw std::runtime_error("texture image too large");
+  const uint32_t layerCount = getLayerCount();
+  assert(layerCount > 0);
+  if (layerCount > limits.maxImageArrayLayers)
+    throw std::runtime_error("too many texture array layers");
+  mipLevels = pickMipLevels(format);
+  // only the levels in data are uploaded, the rest is blitted from level 0
+  const uint32_t uploadLevels = info_.mipsIncluded ? mipLevels : 1;
+  // buffer offsets are multiples of both the block size and 4
+  const VkDeviceSize alignment = std::max<VkDeviceSize>(block.bytes, 4);
+  // converted formats have 1x1 blocks, staged sizes count texels
+  const TexelConvertFunc convert = pickTexelConvert(format);
+  const uint32_t srcTexelSize = info_.dataLayout == MAI_TEXELS_NATIVE
+                                    ? block.bytes
+                                    : getTexelLayoutSize(info_.dataLayout);
+
+  createImage(info_.width, info_.height, VK_IMAGE_TYPE_2D, format,
+              VK_IMAGE_TILING_OPTIMAL,
+              VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT |
+                  VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+              MAI_MEMORY_GPU_ONLY, texture, textureAllocation);
+
+  // the copy runs on the transfer queue, the final layout transition is
+  // done as a queue family ownership transfer to the graphics queue
+  UploadCmd cmd = vkCmd->beginUploadCommandBuffers();
+
+  transitionImageLayout(cmd.transfer, texture, format,
+                        VK_IMAGE_LAYOUT_UNDEFINED,
+                        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+  VkDeviceSize totalSize = 0;
+  for (uint32_t level = 0; level < uploadLevels; level++)
+    totalSize += getImageSize(format, std::max(1u, info_.width >> level),
+                              std::max(1u, info_.height >> level)) *
+                 layerCount;
+
+  const char *src = static_cast<const char *>(info_.data);
+  // fills size bytes of staging from data, converting on the way
+  auto stageData = [&](void *dst, VkDeviceSize size) {
+    if (!convert) {
+      memcpy(dst, src, (size_t)size);
+      src += size;
+      return;
+    }
+    const size_t texels = (size_t)(size / block.bytes);
+    convert(src, dst, texels);
+    src += texels * srcTexelSize;
+  };
+  std::vector<VkBufferImageCopy> regions;
+  if (totalSize <= vkCmd->getStagingChunkSize()) {
+    // every level and layer in one staging region and one copy
+    StagingRegion region = vkCmd->stage(cmd, totalSize, alignment);
+    stageData(region.data, totalSize);
+    VkDeviceSize offset = region.offset;
+    for (uint32_t level = 0; level < uploadLevels; level++) {
+      const uint32_t width = std::max(1u, info_.width >> level);
+      const uint32_t height = std::max(1u, info_.height >> level);
+      regions.push_back(
+          getCopyRegion(offset, level, 0, layerCount, 0, width, height));
+      offset += getImageSize(format, width, height) * layerCount;
+    }
+    copyBufferToImage(cmd.transfer, region.buffer, texture, regions);
+  } else {
+    // staged through the renderer's ring in bands of whole block rows
+    for (uint32_t level = 0; level < uploadLevels; level++) {
+      const uint32_t width = std::max(1u, info_.width >> level);
+      const uint32_t height = std::max(1u, info_.height >> level);
+      const VkDeviceSize rowPitch = getImageSize(format, width, 1);
+      const uint32_t blockRows = (height + block.height - 1) / block.height;
+      const uint32_t rowsPerChunk = static_cast<uint32_t>(
+          std::max<VkDeviceSize>(1, vkCmd->getStagingChunkSize() / rowPitch));
+      for (uint32_t layer = 0; layer < layerCount; layer++) {
+        for (uint32_t row = 0; row < blockRows; row += rowsPerChunk) {
+          const uint32_t rows = std::min(rowsPerChunk, blockRows - row);
+          const VkDeviceSize size = rows * rowPitch;
+          StagingRegion region = vkCmd->stage(cmd, size, alignment);
+          stageData(region.data, size);
+
+          // the last band of a level ends at the image edge, not a block
+          const uint32_t firstRow = row * block.height;
+          regions.assign(1, getCopyRegion(region.offset, level, layer, 1,
+                                          firstRow, width,
+                                          std::min(rows * block.height,
+                                                   height - firstRow)));
+          copyBufferToImage(cmd.transfer, region.buffer, texture, regions);
+        }
+      }
+    }
+  }
 
-  VKbuffer::createBuffer(vkContext, imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                             VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                         stagingBuffer, stagingBufferMemory);
+  // blits need a graphics queue, the chain is built by the acquire half
+  if (uploadLevels < mipLevels) {
+    releaseToGraphics(cmd, texture, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+    generateMipmaps(cmd.acquire, format);
+  } else
+    releaseToGraphics(cmd, texture, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 
-  void *data;
-  vkMapMemory(vkContext->getDevice(), stagingBufferMemory, 0, imageSize, 0,
-              &data);
-  memcpy(data, info_.data, static_cast<size_t>(imageSize));
-  vkUnmapMemory(vkContext->getDevice(), stagingBufferMemory);
+  vkCmd->endUploadCommandBuffers(cmd);
+}
 
-  createImage(info_.width, info_.height, VK_IMAGE_TYPE_2D,
-              info_.format == MAI_TEXTURE_2D ? VK_FORMAT_R8G8B8A8_SRGB
-                                             : VK_FORMAT_R32G32B32A32_SFLOAT,
+void VKTexture::createRenderTarget() {
+  if (info_.format != MAI_TEXTURE_2D || info_.data)
+    throw std::runtime_error("render targets are 2D textures without data");
+  const bool depth =
+      info_.usage & VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+  const VkFormat format = getColorFormat();
+  const VkFormatFeatureFlags attachment =
+      depth ? VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT
+            : VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT;
+  const VkFormatFeatureFlags features =
+      vkContext->getFormatProperties(format).optimalTilingFeatures;
+  if (!(features & attachment) ||
+      !(features & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT))
+    throw std::runtime_error("render target format is not supported");
+
+  createImage(info_.width, info_.height, VK_IMAGE_TYPE_2D, format,
               VK_IMAGE_TILING_OPTIMAL,
-              VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
-              VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, texture, textureMemory);
-
-  transitionImageLayout(
-      texture,
-      info_.format == MAI_TEXTURE_2D ? VK_FORMAT_R8G8B8A8_SRGB
-                                     : VK_FORMAT_R32G32B32A32_SFLOAT,
-      VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-  copyBufferToImage(stagingBuffer, texture, static_cast<uint32_t>(info_.width),
-                    static_cast<uint32_t>(info_.height));
-
-  transitionImageLayout(texture,
-                        info_.format == MAI_TEXTURE_2D
-                            ? VK_FORMAT_R8G8B8A8_SRGB
-                            : VK_FORMAT_R32G32B32A32_SFLOAT,
-                        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+              info_.usage | VK_IMAGE_USAGE_SAMPLED_BIT, MAI_MEMORY_GPU_ONLY,
+              texture, textureAllocation);
+
+  // nothing to copy, the layout is set on the graphics queue so the slot
+  // can be sampled before the first pass renders to it
+  UploadCmd cmd = vkCmd->beginUploadCommandBuffers();
+  transitionImageLayout(cmd.acquire, texture, format,
+                        VK_IMAGE_LAYOUT_UNDEFINED,
                         VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+  vkCmd->endUploadCommandBuffers(cmd);
+}
+
+bool VKTexture::isRenderTarget() const {
+  return info_.usage & (VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                        VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT);
+}
+
+VkFormat VKTexture::getFormat() const {
+  return info_.format == MAI_DEPTH_TEXTURE ? depthFormat : getColorFormat();
+}
+
+uint32_t VKTexture::getLayerCount() const {
+  if (info_.format == MAI_TEXTURE_CUBE)
+    return 6;
+  return info_.format == MAI_TEXTURE_2D_ARRAY ? info_.layerCount : 1;
+}
+
+VkImageViewType VKTexture::getViewType() const {
+  if (info_.format == MAI_TEXTURE_CUBE)
+    return VK_IMAGE_VIEW_TYPE_CUBE;
+  // a single layer array still needs an array view for sampler2DArray
+  return info_.format == MAI_TEXTURE_2D_ARRAY ? VK_IMAGE_VIEW_TYPE_2D_ARRAY
+                                              : VK_IMAGE_VIEW_TYPE_2D;
+}
 
-  vkDestroyBuffer(vkContext->getDevice(), stagingBuffer, nullptr);
-  vkFreeMemory(vkContext->getDevice(), stagingBufferMemory, nullptr);
+TexelConvertFunc VKTexture::pickTexelConvert(VkFormat format) const {
+  const bool rgba8 =
+      format == VK_FORMAT_R8G8B8A8_UNORM || format == VK_FORMAT_R8G8B8A8_SRGB ||
+      format == VK_FORMAT_B8G8R8A8_UNORM || format == VK_FORMAT_B8G8R8A8_SRGB;
+  const bool premultiply = info_.premultiplyAlpha;
+
+  TexelLayout layout = info_.dataLayout;
+  // premultiplying native data converts it to its own format
+  if (layout == MAI_TEXELS_NATIVE) {
+    if (!premultiply)
+      return nullptr;
+    if (rgba8)
+      layout = MAI_TEXELS_RGBA8;
+    else if (format == VK_FORMAT_R32G32B32A32_SFLOAT)
+      layout = MAI_TEXELS_RGBA32F;
+  }
+
+  // an opaque source ignores premultiplyAlpha, a dropped alpha does not
+  switch (layout) {
+  case MAI_TEXELS_RGBA8:
+    if (rgba8)
+      return premultiply ? premultiplyRGBA8 : nullptr;
+    break;
+  case MAI_TEXELS_RGB8:
+    if (rgba8)
+      return convertRGB8ToRGBA8;
+    break;
+  case MAI_TEXELS_RGBA32F:
+    if (format == VK_FORMAT_R32G32B32A32_SFLOAT)
+      return premultiply ? premultiplyRGBA32F : nullptr;
+    if (format == VK_FORMAT_R16G16B16A16_SFLOAT)
+      return premultiply ? premultiplyRGBA32FToRGBA16F
+                         : convertRGBA32FToRGBA16F;
+    if (premultiply)
+      break;
+    if (format == VK_FORMAT_B10G11R11_UFLOAT_PACK32)
+      return convertRGBA32FToB10G11R11;
+    if (format == VK_FORMAT_E5B9G9R9_UFLOAT_PACK32)
+      return convertRGBA32FToE5B9G9R9;
+    break;
+  case MAI_TEXELS_RGB32F:
+    if (format == VK_FORMAT_R32G32B32A32_SFLOAT)
+      return convertRGB32FToRGBA32F;
+    if (format == VK_FORMAT_R16G16B16A16_SFLOAT)
+      return convertRGB32FToRGBA16F;
+    if (format == VK_FORMAT_B10G11R11_UFLOAT_PACK32)
+      return convertRGB32FToB10G11R11;
+    if (format == VK_FORMAT_E5B9G9R9_UFLOAT_PACK32)
+      return convertRGB32FToE5B9G9R9;
+    break;
+  default:
+    break;
+  }
+  throw std::runtime_error("texture data cannot be converted to its format");
+}
+
+uint32_t VKTexture::pickMipLevels(VkFormat format) const {
+  const uint32_t fullChain =
+      std::bit_width(std::max(info_.width, info_.height));
+  uint32_t levels = info_.numMipLevels == TEXTURE_FULL_MIP_CHAIN
+                        ? fullChain
+                        : std::min(info_.numMipLevels, fullChain);
+  assert(levels > 0);
+  if (levels == 1 || info_.mipsIncluded)
+    return levels;
+
+  constexpr VkFormatFeatureFlags blit =
+      VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT;
+  if ((vkContext->getFormatProperties(format).optimalTilingFeatures & blit) !=
+      blit) {
+    std::cerr << "format " << format
+              << " cannot be blitted, mipmaps are not generated" << std::endl;
+    return 1;
+  }
+  return levels;
+}
+
+void VKTexture::generateMipmaps(VkCommandBuffer commandBuffer,
+                                VkFormat format) {
+  // a linear blit of an sRGB image decodes to linear before averaging and
+  // encodes the result, so the chain stays sRGB correct. formats without
+  // linear filtering (RGBA32F on many devices) fall back to nearest
+  const VkFilter filter =
+      vkContext->getFormatProperties(format).optimalTilingFeatures &
+              VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT
+          ? VK_FILTER_LINEAR
+          : VK_FILTER_NEAREST;
+  const uint32_t layerCount = getLayerCount();
+
+  VkImageMemoryBarrier barrier = {
+      .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+      .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+      .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+      .oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+      .newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+      .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+      .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+      .image = texture,
+      .subresourceRange =
+          {
+              .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+              .levelCount = 1,
+              .baseArrayLayer = 0,
+              .layerCount = layerCount,
+          },
+  };
+
+  int32_t width = static_cast<int32_t>(info_.width);
+  int32_t height = static_cast<int32_t>(info_.height);
+  for (uint32_t level = 1; level < mipLevels; level++) {
+    // the level above is complete, it becomes the blit source
+    barrier.subresourceRange.baseMipLevel = level - 1;
+    vkd.vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                             nullptr, 1, &barrier);
+
+    const int32_t nextWidth = std::max(1, width / 2);
+    const int32_t nextHeight = std::max(1, height / 2);
+    VkImageBlit blit{
+        .srcSubresource =
+            {
+                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                .mipLevel = level - 1,
+                .baseArrayLayer = 0,
+                .layerCount = layerCount,
+            },
+        .srcOffsets = {{0, 0, 0}, {width, height, 1}},
+        .dstSubresource =
+            {
+                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                .mipLevel = level,
+                .baseArrayLayer = 0,
+                .layerCount = layerCount,
+            },
+        .dstOffsets = {{0, 0, 0}, {nextWidth, nextHeight, 1}},
+    };
+    vkd.vkCmdBlitImage(commandBuffer, texture,
+                       VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, texture,
+                       VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, filter);
+    width = nextWidth;
+    height = nextHeight;
+  }
+
+  // every level but the last has been read by a blit, the last written
+  VkImageMemoryBarrier toShader[2] = {barrier, barrier};
+  toShader[0].srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+  toShader[0].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  toShader[0].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+  toShader[0].newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  toShader[0].subresourceRange.baseMipLevel = 0;
+  toShader[0].subresourceRange.levelCount = mipLevels - 1;
+  toShader[1].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  toShader[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  toShader[1].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  toShader[1].newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  toShader[1].subresourceRange.baseMipLevel = mipLevels - 1;
+  vkd.vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                           VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0,
+                           nullptr, 0, nullptr, 2, toShader);
 }
 
 void VKTexture::createTextureImageView(VkFormat format,
@@ -82,52 +457,30 @@ void VKTexture::createTextureImageView(VkFormat format,
           {
               .aspectMask = aspect,
               .baseMipLevel = 0,
-              .levelCount = 1,
+              .levelCount = mipLevels,
               .baseArrayLayer = 0,
-              .layerCount = 1,
+              .layerCount = getLayerCount(),
           },
   };
 
-  if (info_.format == MAI_TEXTURE_CUBE) {
-    viewInfo.subresourceRange.layerCount = 6;
-  }
-
-  if (vkCreateImageView(vkContext->getDevice(), &viewInfo, nullptr,
-                        &textureView) != VK_SUCCESS)
+  if (vkd.vkCreateImageView(vkContext->getDevice(), &viewInfo, nullptr,
+                            &textureView) != VK_SUCCESS)
     throw std::runtime_error("failed to create image view");
 }
 
 void VKTexture::createTextureSampler() {
-  VkPhysicalDeviceProperties properties{};
-  vkGetPhysicalDeviceProperties(vkContext->getPhysicalDevice(), &properties);
-
-  VkSamplerCreateInfo samplerInfo{
-      .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
-      .magFilter = VK_FILTER_LINEAR,
-      .minFilter = VK_FILTER_LINEAR,
-      .mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR,
-      .addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT,
-      .addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT,
-      .addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT,
-      .mipLodBias = 0.0f,
-      .anisotropyEnable = VK_TRUE,
-      .maxAnisotropy = properties.limits.maxSamplerAnisotropy,
-      .compareOp = VK_COMPARE_OP_ALWAYS,
-  };
-
-  if (info_.format == MAI_TEXTURE_CUBE) {
+  SamplerInfo samplerInfo = info_.sampler ? *info_.sampler : SamplerInfo{};
+  if (!info_.sampler &&
+      (info_.format == MAI_TEXTURE_CUBE || isRenderTarget())) {
     samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
     samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
     samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
   }
 
-  samplerInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
-  samplerInfo.compareEnable = VK_FALSE;
-  samplerInfo.unnormalizedCoordinates = VK_FALSE;
-
-  if (vkCreateSampler(vkContext->getDevice(), &samplerInfo, nullptr,
-                      &textureSampler) != VK_SUCCESS)
-    throw std::runtime_error("failed to creat texture sampler");
+  const Sampler sampler =
+      vkContext->getSamplerCache()->getSampler(samplerInfo);
+  textureSampler = sampler.sampler;
+  samplerIndex = sampler.index;
 }
 
 void VKTexture::createDepthResources() {
@@ -136,16 +489,24 @@ void VKTexture::createDepthResources() {
   createImage(extent.width, extent.height, VK_IMAGE_TYPE_2D, depthFormat,
               VK_IMAGE_TILING_OPTIMAL,
               VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
-              VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, texture, textureMemory);
+              MAI_MEMORY_GPU_ONLY, texture, textureAllocation);
   createTextureImageView(depthFormat, VK_IMAGE_VIEW_TYPE_2D,
                          VK_IMAGE_ASPECT_DEPTH_BIT);
 }
 
 void VKTexture::createImage(uint32_t width, uint32_t height, VkImageType type,
                             VkFormat format, VkImageTiling tiling,
-                            VkImageUsageFlags usage,
-                            VkMemoryPropertyFlags properties, VkImage &image,
-                            VkDeviceMemory &imageMemory) {
+                            VkImageUsageFlags usage, MemoryUsage memoryUsage,
+                            VkImage &image, Allocation &imageAllocation) {
+  image = createImageHandle(width, height, type, format, tiling, usage);
+  imageAllocation =
+      vkContext->getAllocator()->allocateImage(image, memoryUsage, tiling);
+}
+
+VkImage VKTexture::createImageHandle(uint32_t width, uint32_t height,
+                                     VkImageType type, VkFormat format,
+                                     VkImageTiling tiling,
+                                     VkImageUsageFlags usage) {
 
   VkImageCreateInfo imageInfo{
       .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
@@ -154,11 +515,11 @@ void VKTexture::createImage(uint32_t width, uint32_t height, VkImageType type,
       .extent =
           {
               .width = width,
-              .height = width,
+              .height = height,
               .depth = 1,
           },
-      .mipLevels = 1,
-      .arrayLayers = 1,
+      .mipLevels = mipLevels,
+      .arrayLayers = getLayerCount(),
       .samples = VK_SAMPLE_COUNT_1_BIT,
       .tiling = tiling,
       .usage = usage,
@@ -166,37 +527,20 @@ void VKTexture::createImage(uint32_t width, uint32_t height, VkImageType type,
       .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
   };
 
-  if (info_.format == MAI::MAI_TEXTURE_CUBE) {
-    imageInfo.arrayLayers = 6;
-    imageInfo.format = VK_FORMAT_R32G32B32A32_SFLOAT;
+  if (info_.format == MAI::MAI_TEXTURE_CUBE)
     imageInfo.flags = VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT;
-  }
 
-  if (vkCreateImage(vkContext->getDevice(), &imageInfo, nullptr, &image) !=
+  VkImage image;
+  if (vkd.vkCreateImage(vkContext->getDevice(), &imageInfo, nullptr, &image) !=
       VK_SUCCESS)
     throw std::runtime_error("failed to create texture image");
-
-  VkMemoryRequirements memRequirements;
-  vkGetImageMemoryRequirements(vkContext->getDevice(), image, &memRequirements);
-
-  VkMemoryAllocateInfo allocInfo{
-      .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-      .allocationSize = memRequirements.size,
-      .memoryTypeIndex = VKbuffer::findMemoryType(
-          vkContext, memRequirements.memoryTypeBits, properties),
-  };
-
-  if (vkAllocateMemory(vkContext->getDevice(), &allocInfo, nullptr,
-                       &imageMemory) != VK_SUCCESS)
-    throw std::runtime_error("failed to allocate image memory");
-
-  vkBindImageMemory(vkContext->getDevice(), image, imageMemory, 0);
+  return image;
 }
 
-void VKTexture::transitionImageLayout(VkImage image, VkFormat format,
+void VKTexture::transitionImageLayout(VkCommandBuffer commandBuffer,
+                                      VkImage image, VkFormat format,
                                       VkImageLayout oldLayout,
                                       VkImageLayout newLayout) {
-  VkCommandBuffer commandBuffer = vkCmd->beginSingleCommandBuffer();
   VkImageMemoryBarrier barrier = {
       .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
       .oldLayout = oldLayout,
@@ -206,12 +550,11 @@ void VKTexture::transitionImageLayout(VkImage image, VkFormat format,
       .image = image,
       .subresourceRange =
           {
-              .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+              .aspectMask = getAspect(),
               .baseMipLevel = 0,
-              .levelCount = 1,
+              .levelCount = mipLevels,
               .baseArrayLayer = 0,
-              .layerCount =
-                  info_.format == MAI_TEXTURE_CUBE ? (uint32_t)6 : (uint32_t)1,
+              .layerCount = getLayerCount(),
           },
   };
 
@@ -232,63 +575,101 @@ void VKTexture::transitionImageLayout(VkImage image, VkFormat format,
 
     sourcesStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
     destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+  } else if (oldLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL &&
+             newLayout == VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL) {
+    barrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+    sourcesStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+    destinationStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+  } else if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED &&
+             newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+    sourcesStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+    destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
   } else
     throw std::invalid_argument("unsupported layout transition!");
 
-  vkCmdPipelineBarrier(commandBuffer, sourcesStage, destinationStage, 0, 0,
-                       nullptr, 0, nullptr, 1, &barrier);
-
-  vkCmd->endSingleCommandBuffer(commandBuffer);
+  vkd.vkCmdPipelineBarrier(commandBuffer, sourcesStage, destinationStage, 0, 0,
+                           nullptr, 0, nullptr, 1, &barrier);
 }
 
-void VKTexture::copyBufferToImage(VkBuffer buffer, VkImage image,
-                                  uint32_t width, uint32_t height) {
-
-  VkCommandBuffer commandBuffer = vkCmd->beginSingleCommandBuffer();
-
-  if (info_.format == MAI_TEXTURE_2D) {
-    VkBufferImageCopy region{
-        .bufferOffset = 0,
-        .bufferRowLength = 0,
-        .bufferImageHeight = 0,
+void VKTexture::releaseToGraphics(UploadCmd &cmd, VkImage image,
+                                  VkImageLayout newLayout) {
+  const bool dedicated = vkContext->hasDedicatedTransferQueue();
+  const QueueFamilyIndices indices = vkContext->getFamilyIndices();
+  const bool toShader = newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 
-        .imageSubresource =
-            {
-                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-                .mipLevel = 0,
-                .baseArrayLayer = 0,
-                .layerCount = 1,
-            },
-        .imageOffset = {0, 0, 0},
-        .imageExtent = {width, height, 1},
-    };
+  VkImageMemoryBarrier barrier = {
+      .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+      .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+      .dstAccessMask =
+          toShader ? VK_ACCESS_SHADER_READ_BIT
+                   : VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT,
+      .oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+      .newLayout = newLayout,
+      .srcQueueFamilyIndex =
+          dedicated ? indices.transferFamily.value() : VK_QUEUE_FAMILY_IGNORED,
+      .dstQueueFamilyIndex =
+          dedicated ? indices.graphcisFamily.value() : VK_QUEUE_FAMILY_IGNORED,
+      .image = image,
+      .subresourceRange =
+          {
+              .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+              .baseMipLevel = 0,
+              .levelCount = mipLevels,
+              .baseArrayLayer = 0,
+              .layerCount = getLayerCount(),
+          },
+  };
 
-    vkCmdCopyBufferToImage(commandBuffer, buffer, image,
-                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
-  } else if (info_.format == MAI_TEXTURE_CUBE) {
-    std::array<VkBufferImageCopy, 6> regions{};
-    VkDeviceSize faceSize = width * height * 4 * sizeof(float);
-    for (uint32_t face = 0; face < 6; face++) {
-      regions[face].bufferOffset = face * faceSize;
-      regions[face].bufferRowLength = 0;
-      regions[face].bufferImageHeight = 0;
-
-      regions[face].imageSubresource = {
-          .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-          .mipLevel = 0,
-          .baseArrayLayer = face,
-          .layerCount = 1,
-      };
-      regions[face].imageOffset = {0, 0, 0};
-      regions[face].imageExtent = {width, height, 1};
-    }
+  // release half, the layout transition happens once across both halves
+  if (dedicated)
+    vkd.vkCmdPipelineBarrier(cmd.transfer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0,
+                             nullptr, 0, nullptr, 1, &barrier);
+
+  VkImageMemoryBarrier acquire = barrier;
+  acquire.srcAccessMask = dedicated ? 0 : VK_ACCESS_TRANSFER_WRITE_BIT;
+  vkd.vkCmdPipelineBarrier(cmd.acquire,
+                           dedicated ? VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT
+                                     : VK_PIPELINE_STAGE_TRANSFER_BIT,
+                           toShader ? VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT
+                                    : VK_PIPELINE_STAGE_TRANSFER_BIT,
+                           0, 0, nullptr, 0, nullptr, 1, &acquire);
+}
 
-    vkCmdCopyBufferToImage(
-        commandBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-        static_cast<uint32_t>(regions.size()), regions.data());
-  }
+VkBufferImageCopy VKTexture::getCopyRegion(VkDeviceSize bufferOffset,
+                                           uint32_t level, uint32_t layer,
+                                           uint32_t layerCount,
+                                           uint32_t firstRow, uint32_t width,
+                                           uint32_t rows) const {
+  return {
+      .bufferOffset = bufferOffset,
+      .bufferRowLength = 0,
+      .bufferImageHeight = 0,
+
+      .imageSubresource =
+          {
+              .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+              .mipLevel = level,
+              .baseArrayLayer = layer,
+              .layerCount = layerCount,
+          },
+      .imageOffset = {0, static_cast<int32_t>(firstRow), 0},
+      .imageExtent = {width, rows, 1},
+  };
+}
 
-  vkCmd->endSingleCommandBuffer(commandBuffer);
+void VKTexture::copyBufferToImage(
+    VkCommandBuffer commandBuffer, VkBuffer buffer, VkImage image,
+    const std::vector<VkBufferImageCopy> &regions) {
+  vkd.vkCmdCopyBufferToImage(commandBuffer, buffer, image,
+                             VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                             static_cast<uint32_t>(regions.size()),
+                             regions.data());
 }
 
 VkFormat VKTexture::findSupportedFormat(VKContext *vkContext,
@@ -296,9 +677,7 @@ VkFormat VKTexture::findSupportedFormat(VKContext *vkContext,
                                         VkImageTiling tiling,
                                         VkFormatFeatureFlags feature) {
   for (const auto format : candidates) {
-    VkFormatProperties props;
-    vkGetPhysicalDeviceFormatProperties(vkContext->getPhysicalDevice(), format,
-                                        &props);
+    const VkFormatProperties &props = vkContext->getFormatProperties(format);
     if (tiling == VK_IMAGE_TILING_LINEAR &&
         (props.linearTilingFeatures & feature) == feature)
       return format;
@@ -316,22 +695,148 @@ bool hasStencilComponent(VkFormat format) {
 }
 
 VkFormat VKTexture::findDepthFormat(VKContext *vkContext) {
-  return findSupportedFormat(
-      vkContext,
-      {VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT,
-       VK_FORMAT_D24_UNORM_S8_UINT},
-      VK_IMAGE_TILING_OPTIMAL, VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT);
+  // probed once with the rest of the device capabilities
+  return vkContext->getCapabilities().depthFormat;
 }
 
-VKTexture::~VKTexture() {
+bool VKTexture::isDeviceLocal() const {
+  return vkContext->getAllocator()->getMemoryFlags(textureAllocation) &
+         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+}
+
+uint32_t VKTexture::getMemoryHeap() const {
+  return vkContext->getAllocator()->getHeapIndex(
+      textureAllocation.memoryType);
+}
+
+VkFormat VKTexture::getColorFormat() const {
+  assert(info_.format != MAI_DEPTH_TEXTURE);
+  if (info_.vkFormat != VK_FORMAT_UNDEFINED)
+    return info_.vkFormat;
+  if (info_.usage & VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT)
+    return findDepthFormat(vkContext);
+  return info_.format == MAI_TEXTURE_CUBE ? VK_FORMAT_R32G32B32A32_SFLOAT
+                                          : VK_FORMAT_R8G8B8A8_SRGB;
+}
+
+VkImageAspectFlags VKTexture::getAspect() const {
+  return info_.format == MAI_DEPTH_TEXTURE ||
+                 (info_.usage & VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT)
+             ? VK_IMAGE_ASPECT_DEPTH_BIT
+             : VK_IMAGE_ASPECT_COLOR_BIT;
+}
+
+void VKTexture::recordCopy(VkCommandBuffer commandBuffer, VkImage image) {
+  const VkFormat format = getColorFormat();
+  std::vector<VkImageCopy> regions(mipLevels);
+  for (uint32_t level = 0; level < mipLevels; level++) {
+    regions[level] = {
+        .srcSubresource =
+            {
+                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                .mipLevel = level,
+                .baseArrayLayer = 0,
+                .layerCount = getLayerCount(),
+            },
+        .extent = {std::max(1u, info_.width >> level),
+                   std::max(1u, info_.height >> level), 1},
+    };
+    regions[level].dstSubresource = regions[level].srcSubresource;
+  }
 
-  if (textureSampler != VK_NULL_HANDLE)
-    vkDestroySampler(vkContext->getDevice(), textureSampler, nullptr);
+  transitionImageLayout(commandBuffer, texture, format,
+                        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+  transitionImageLayout(commandBuffer, image, format,
+                        VK_IMAGE_LAYOUT_UNDEFINED,
+                        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+  vkd.vkCmdCopyImage(commandBuffer, texture,
+                     VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image,
+                     VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                     static_cast<uint32_t>(regions.size()), regions.data());
+  transitionImageLayout(commandBuffer, image, format,
+                        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+}
+
+bool VKTexture::demote() {
+  // render targets are written every frame, host memory would be too slow
+  if (isRenderTarget())
+    return false;
+  const VkFormat format = getColorFormat();
+
+  VkImage image;
+  Allocation imageAllocation;
+  createImage(info_.width, info_.height, VK_IMAGE_TYPE_2D, format,
+              VK_IMAGE_TILING_OPTIMAL,
+              VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT |
+                  VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+              MAI_MEMORY_HOST_FALLBACK, image, imageAllocation);
+  // the image's memoryTypeBits only allow device local memory
+  if (vkContext->getAllocator()->getMemoryFlags(imageAllocation) &
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) {
+    vkd.vkDestroyImage(vkContext->getDevice(), image, nullptr);
+    vkContext->getAllocator()->free(imageAllocation);
+    return false;
+  }
+
+  // the single command buffer waits for the graphics queue to go idle, so
+  // no frame still samples the old image once this returns
+  VkCommandBuffer commandBuffer = vkCmd->beginSingleCommandBuffer();
+  recordCopy(commandBuffer, image);
+  vkCmd->endSingleCommandBuffer(commandBuffer);
+
+  vkd.vkDestroyImageView(vkContext->getDevice(), textureView, nullptr);
+  vkd.vkDestroyImage(vkContext->getDevice(), texture, nullptr);
+  vkContext->getAllocator()->free(textureAllocation);
+
+  texture = image;
+  textureAllocation = imageAllocation;
+  createTextureImageView(format, getViewType(), VK_IMAGE_ASPECT_COLOR_BIT);
+  return true;
+}
+
+bool VKTexture::relocate(VkCommandBuffer commandBuffer, VkImage &oldImage,
+                         VkImageView &oldView, Allocation &oldAllocation) {
+  if (info_.format == MAI_DEPTH_TEXTURE || isRenderTarget() ||
+      textureAllocation.isDedicated())
+    return false;
+  const VkFormat format = getColorFormat();
+
+  VkImage image = createImageHandle(
+      info_.width, info_.height, VK_IMAGE_TYPE_2D, format,
+      VK_IMAGE_TILING_OPTIMAL,
+      VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT |
+          VK_IMAGE_USAGE_TRANSFER_SRC_BIT);
+  Allocation imageAllocation;
+  if (!vkContext->getAllocator()->moveImage(image, textureAllocation,
+                                            imageAllocation)) {
+    vkd.vkDestroyImage(vkContext->getDevice(), image, nullptr);
+    return false;
+  }
+
+  recordCopy(commandBuffer, image);
+
+  oldImage = texture;
+  oldView = textureView;
+  oldAllocation = textureAllocation;
+  texture = image;
+  textureAllocation = imageAllocation;
+  createTextureImageView(format, getViewType(), VK_IMAGE_ASPECT_COLOR_BIT);
+  return true;
+}
+
+VKTexture::~VKTexture() {
+  vkContext->getResourceTracker()->remove(this);
+  if (VKResidency *residency = vkContext->getResidency())
+    residency->removeTexture(this);
+  if (VKDefragmenter *defragmenter = vkContext->getDefragmenter())
+    defragmenter->removeTexture(this);
 
-  vkDestroyImageView(vkContext->getDevice(), textureView, nullptr);
+  vkd.vkDestroyImageView(vkContext->getDevice(), textureView, nullptr);
 
-  vkDestroyImage(vkContext->getDevice(), texture, nullptr);
-  vkFreeMemory(vkContext->getDevice(), textureMemory, nullptr);
+  vkd.vkDestroyImage(vkContext->getDevice(), texture, nullptr);
+  vkContext->getAllocator()->free(textureAllocation);
 }
 
 }; // namespace MAI
@@ -0,0 +1,207 @@
+#include "vk_ktx.h"
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <fstream>
+
+namespace MAI {
+
+// the file is little endian, so is every host this runs on
+struct KTX2Header {
+  uint8_t identifier[12];
+  uint32_t vkFormat;
+  uint32_t typeSize;
+  uint32_t pixelWidth;
+  uint32_t pixelHeight;
+  uint32_t pixelDepth;
+  uint32_t layerCount;
+  uint32_t faceCount;
+  uint32_t levelCount;
+  uint32_t supercompressionScheme;
+  uint32_t dfdByteOffset;
+  uint32_t dfdByteLength;
+  uint32_t kvdByteOffset;
+  uint32_t kvdByteLength;
+  uint64_t sgdByteOffset;
+  uint64_t sgdByteLength;
+};
+static_assert(sizeof(KTX2Header) == 80);
+
+// one entry per level, level 0 first
+struct KTX2Level {
+  uint64_t byteOffset;
+  uint64_t byteLength;
+  uint64_t uncompressedByteLength;
+};
+
+static const uint8_t KTX2_IDENTIFIER[12] = {
+    0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n',
+};
+
+TextureInfo KTXTexture::getTextureInfo(const char *debugName) const {
+  return {
+      .width = width,
+      .height = height,
+      .data = data.data(),
+      .format = getTextureFormat(),
+      .layerCount = std::max(1u, layerCount),
+      .numMipLevels = levelCount ? levelCount : TEXTURE_FULL_MIP_CHAIN,
+      .mipsIncluded = levelCount > 0,
+      .vkFormat = format,
+      .debugName = debugName,
+  };
+}
+
+TextureFormat KTXTexture::getTextureFormat() const {
+  if (faceCount == 6)
+    return MAI_TEXTURE_CUBE;
+  return layerCount ? MAI_TEXTURE_2D_ARRAY : MAI_TEXTURE_2D;
+}
+
+uint32_t KTXTexture::getLayerCount() const {
+  return std::max(1u, layerCount) * faceCount;
+}
+
+VkDeviceSize KTXTexture::getLevelSize(uint32_t level) const {
+  return getImageSize(format, std::max(1u, width >> level),
+                      std::max(1u, height >> level)) *
+         getLayerCount();
+}
+
+static KTXTexture readHeader(const KTX2Header &header, const char *filename) {
+  if (memcmp(header.identifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)))
+    throw std::runtime_error(std::string("not a KTX2 file: ") + filename);
+  // BasisLZ and zstd data would need transcoding first
+  if (header.supercompressionScheme)
+    throw std::runtime_error(std::string("supercompressed KTX2 file: ") +
+                             filename);
+  // 1D, 3D and cube array textures
+  if (!header.pixelHeight || header.pixelDepth ||
+      (header.faceCount != 1 && header.faceCount != 6) ||
+      (header.faceCount == 6 && header.layerCount))
+    throw std::runtime_error(std::string("unsupported KTX2 layout: ") +
+                             filename);
+
+  KTXTexture ktx{
+      .format = static_cast<VkFormat>(header.vkFormat),
+      .width = header.pixelWidth,
+      .height = header.pixelHeight,
+      .faceCount = header.faceCount,
+      .layerCount = header.layerCount,
+      .levelCount = header.levelCount,
+  };
+  if (!getFormatBlock(ktx.format).bytes)
+    throw std::runtime_error(std::string("unsupported KTX2 format: ") +
+                             filename);
+  const uint32_t levels = std::max(1u, ktx.levelCount);
+  const uint32_t fullChain = std::bit_width(std::max(ktx.width, ktx.height));
+  if (levels > fullChain)
+    throw std::runtime_error(std::string("bad KTX2 level count: ") +
+                             filename);
+  return ktx;
+}
+
+// the level index follows the header, one entry per level
+static void readLevels(KTXTexture &ktx, const KTX2Level *index,
+                       uint64_t fileSize, const char *filename) {
+  const uint32_t levels = std::max(1u, ktx.levelCount);
+  ktx.levelOffsets.resize(levels);
+  for (uint32_t level = 0; level < levels; level++) {
+    // no sum, a byteOffset near 2^64 would wrap past the check
+    if (index[level].byteLength != ktx.getLevelSize(level) ||
+        index[level].byteOffset > fileSize ||
+        index[level].byteLength > fileSize - index[level].byteOffset)
+      throw std::runtime_error(std::string("bad KTX2 level size: ") +
+                               filename);
+    ktx.levelOffsets[level] = index[level].byteOffset;
+  }
+}
+
+KTXTexture loadKTX(const char *filename, bool headerOnly) {
+  std::ifstream file(filename, std::ios::binary | std::ios::ate);
+  if (!file.is_open())
+    throw std::runtime_error(std::string("failed to open ") + filename);
+  const uint64_t fileSize = file.tellg();
+  file.seekg(0);
+
+  KTX2Header header;
+  if (!file.read(reinterpret_cast<char *>(&header), sizeof(header)))
+    throw std::runtime_error(std::string("not a KTX2 file: ") + filename);
+  KTXTexture ktx = readHeader(header, filename);
+  if (headerOnly)
+    return ktx;
+
+  std::vector<KTX2Level> index(std::max(1u, ktx.levelCount));
+  if (!file.read(reinterpret_cast<char *>(index.data()),
+                 index.size() * sizeof(KTX2Level)))
+    throw std::runtime_error(std::string("truncated KTX2 file: ") + filename);
+  readLevels(ktx, index.data(), fileSize, filename);
+
+  // levels are stored smallest first in the file, data wants them largest
+  // first like the index
+  VkDeviceSize total = 0;
+  for (uint32_t level = 0; level < index.size(); level++)
+    total += ktx.getLevelSize(level);
+  ktx.data.resize(total);
+  char *dst = ktx.data.data();
+  for (uint32_t level = 0; level < index.size(); level++) {
+    const VkDeviceSize size = ktx.getLevelSize(level);
+    file.seekg(static_cast<std::streamoff>(ktx.levelOffsets[level]));
+    if (!file.read(dst, static_cast<std::streamsize>(size)))
+      throw std::runtime_error(std::string("truncated KTX2 file: ") +
+                               filename);
+    dst += size;
+  }
+  return ktx;
+}
+
+bool isKTX(const char *file, size_t size) {
+  return size >= sizeof(KTX2_IDENTIFIER) &&
+         !memcmp(file, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER));
+}
+
+KTXTexture parseKTX(const char *file, size_t size, const char *filename) {
+  if (size < sizeof(KTX2Header))
+    throw std::runtime_error(std::string("not a KTX2 file: ") + filename);
+  KTX2Header header;
+  memcpy(&header, file, sizeof(header));
+  KTXTexture ktx = readHeader(header, filename);
+
+  std::vector<KTX2Level> index(std::max(1u, ktx.levelCount));
+  const size_t indexSize = index.size() * sizeof(KTX2Level);
+  if (size < sizeof(header) + indexSize)
+    throw std::runtime_error(std::string("truncated KTX2 file: ") + filename);
+  memcpy(index.data(), file + sizeof(header), indexSize);
+  readLevels(ktx, index.data(), size, filename);
+  return ktx;
+}
+
+bool isTextureFormatSupported(VKContext *vkContext, VkFormat format) {
+  const VkPhysicalDeviceFeatures &features = vkContext->getEnabledFeatures();
+  if (format >= VK_FORMAT_BC1_RGB_UNORM_BLOCK &&
+      format <= VK_FORMAT_BC7_SRGB_BLOCK && !features.textureCompressionBC)
+    return false;
+  if (format >= VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK &&
+      format <= VK_FORMAT_EAC_R11G11_SNORM_BLOCK &&
+      !features.textureCompressionETC2)
+    return false;
+  if (format >= VK_FORMAT_ASTC_4x4_UNORM_BLOCK &&
+      format <= VK_FORMAT_ASTC_12x12_SRGB_BLOCK &&
+      !features.textureCompressionASTC_LDR)
+    return false;
+
+  return getFormatBlock(format).bytes &&
+         (vkContext->getFormatProperties(format).optimalTilingFeatures &
+          VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT);
+}
+
+int32_t pickKTX(VKContext *vkContext,
+                const std::vector<const char *> &filenames) {
+  for (size_t i = 0; i < filenames.size(); i++)
+    if (isTextureFormatSupported(vkContext,
+                                 loadKTX(filenames[i], true).format))
+      return static_cast<int32_t>(i);
+  return -1;
+}
+
+}; // namespace MAI
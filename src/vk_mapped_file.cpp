@@ -0,0 +1,43 @@
+#include "vk_mapped_file.h"
+#include <fcntl.h>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace MAI {
+
+VKMappedFile::VKMappedFile(const char *filename) {
+  const int fd = open(filename, O_RDONLY);
+  if (fd < 0)
+    throw std::runtime_error(std::string("failed to open ") + filename);
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    throw std::runtime_error(std::string("failed to map ") + filename);
+  }
+  fileSize = static_cast<size_t>(st.st_size);
+
+  void *data = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+  // the mapping keeps its own reference to the file
+  close(fd);
+  if (data == MAP_FAILED)
+    throw std::runtime_error(std::string("failed to map ") + filename);
+  mapping = static_cast<const char *>(data);
+}
+
+void VKMappedFile::prefetch(size_t offset, size_t size) const {
+  // madvise takes a page aligned start
+  const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  const size_t begin = offset / page * page;
+  madvise(const_cast<char *>(mapping) + begin, offset + size - begin,
+          MADV_WILLNEED);
+}
+
+VKMappedFile::~VKMappedFile() {
+  munmap(const_cast<char *>(mapping), fileSize);
+}
+
+}; // namespace MAI
@@ -5,7 +5,8 @@
 namespace MAI {
 VKPipeline::VKPipeline(VKContext *vkContext, VKSwapchain *vkSwapchain,
                        PipelineInfo info)
-    : vkContext(vkContext), info_(info), vkSwapchain(vkSwapchain) {
+    : vkContext(vkContext), vkd(vkContext->getDispatch()), info_(info),
+      vkSwapchain(vkSwapchain) {
   createPipelineLayout();
   createPipeline();
 }
@@ -27,8 +28,8 @@ void VKPipeline::createPipelineLayout() {
     pipelineLayoutInfo.pSetLayouts = &info_.descriptorSetLayout;
   }
 
-  if (vkCreatePipelineLayout(vkContext->getDevice(), &pipelineLayoutInfo,
-                             nullptr, &pipelineLayout) != VK_SUCCESS)
+  if (vkd.vkCreatePipelineLayout(vkContext->getDevice(), &pipelineLayoutInfo,
+                                 nullptr, &pipelineLayout) != VK_SUCCESS)
     throw std::runtime_error("failed to create pipeline layout");
 }
 
@@ -160,21 +161,33 @@ void VKPipeline::createPipeline() {
     colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
   }
 
+  // no formats given: the swapchain pass
+  AttachmentFormats formats;
+  if (info_.attachments)
+    formats = *info_.attachments;
+  else
+    formats = {
+        .colors = {vkSwapchain->getSwapchainImageFormat()},
+        .depth = VKTexture::findDepthFormat(vkContext),
+    };
+  const uint32_t colorCount = static_cast<uint32_t>(formats.colors.size());
+  // every color attachment blends the same way
+  const std::vector<VkPipelineColorBlendAttachmentState> colorBlendAttachments(
+      colorCount, colorBlendAttachment);
+
   VkPipelineColorBlendStateCreateInfo colorBlending{
       .sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
       .logicOpEnable = VK_FALSE,
       .logicOp = VK_LOGIC_OP_COPY,
-      .attachmentCount = 1,
-      .pAttachments = &colorBlendAttachment,
+      .attachmentCount = colorCount,
+      .pAttachments = colorBlendAttachments.data(),
   };
 
-  VkFormat format = vkSwapchain->getSwapchainImageFormat();
-
   VkPipelineRenderingCreateInfo pipelineRenderCreateInfo = {
       .sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO,
-      .colorAttachmentCount = 1,
-      .pColorAttachmentFormats = &format,
-      .depthAttachmentFormat = VKTexture::findDepthFormat(vkContext),
+      .colorAttachmentCount = colorCount,
+      .pColorAttachmentFormats = formats.colors.data(),
+      .depthAttachmentFormat = formats.depth,
   };
   VkPipelineDepthStencilStateCreateInfo depthStencil{
       .sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO,
@@ -202,15 +215,16 @@ void VKPipeline::createPipeline() {
       .renderPass = nullptr,
   };
 
-  if (vkCreateGraphicsPipelines(vkContext->getDevice(), nullptr, 1, &createInfo,
-                                nullptr, &pipeline) != VK_SUCCESS)
+  if (vkd.vkCreateGraphicsPipelines(vkContext->getDevice(), nullptr, 1,
+                                    &createInfo, nullptr,
+                                    &pipeline) != VK_SUCCESS)
     throw std::runtime_error("failed to create graphics pipeline");
 
   stages.clear();
 } // namespace MAI
 
 VKPipeline::~VKPipeline() {
-  vkDestroyPipelineLayout(vkContext->getDevice(), pipelineLayout, nullptr);
-  vkDestroyPipeline(vkContext->getDevice(), pipeline, nullptr);
+  vkd.vkDestroyPipelineLayout(vkContext->getDevice(), pipelineLayout, nullptr);
+  vkd.vkDestroyPipeline(vkContext->getDevice(), pipeline, nullptr);
 }
 }; // namespace MAI
@@ -0,0 +1,326 @@
+#include "vk_profiler.h"
+#include <algorithm>
+#include <cassert>
+#include <fstream>
+#include <iomanip>
+
+namespace MAI {
+
+// counters are written in bit order of the enabled statistic flags
+constexpr VkQueryPipelineStatisticFlags statisticFlags =
+    VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_CLIPPING_INVOCATIONS_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+constexpr uint32_t statisticCount = 6;
+
+VKProfiler::VKProfiler(VKContext *vkContext, ProfilerInfo info)
+    : vkContext(vkContext), vkd(vkContext->getDispatch()), info_(info),
+      startTime(std::chrono::steady_clock::now()) {
+  const DeviceCapabilities &caps = vkContext->getCapabilities();
+  timestampPeriod = caps.limits().timestampPeriod;
+
+  const uint32_t validBits =
+      caps.queueFamilies[vkContext->getFamilyIndices().graphcisFamily.value()]
+          .timestampValidBits;
+  if (validBits == 0)
+    throw std::runtime_error("graphics queue does not support timestamps");
+  timestampMask = validBits >= 64 ? UINT64_MAX : (1ull << validBits) - 1;
+
+  if (info_.pipelineStatistics &&
+      !vkContext->getEnabledFeatures().pipelineStatisticsQuery) {
+    std::cerr << "pipeline statistics queries are not supported" << std::endl;
+    info_.pipelineStatistics = false;
+  }
+
+  createQueryPools();
+}
+
+void VKProfiler::createQueryPools() {
+  timestampPools.resize(MAX_FRAMES_IN_FLIGHT);
+  frames.resize(MAX_FRAMES_IN_FLIGHT);
+
+  // every scope takes a begin and an end timestamp, plus the frame scope
+  VkQueryPoolCreateInfo timestampInfo{
+      .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+      .queryType = VK_QUERY_TYPE_TIMESTAMP,
+      .queryCount = (info_.maxScopes + 1) * 2,
+  };
+  for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+    if (vkd.vkCreateQueryPool(vkContext->getDevice(), &timestampInfo, nullptr,
+                              &timestampPools[i]) != VK_SUCCESS)
+      throw std::runtime_error("failed to create timestamp query pool");
+
+  if (!info_.pipelineStatistics)
+    return;
+
+  statisticsPools.resize(MAX_FRAMES_IN_FLIGHT);
+  VkQueryPoolCreateInfo statisticsInfo{
+      .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+      .queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS,
+      .queryCount = info_.maxScopes,
+      .pipelineStatistics = statisticFlags,
+  };
+  for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+    if (vkd.vkCreateQueryPool(vkContext->getDevice(), &statisticsInfo, nullptr,
+                              &statisticsPools[i]) != VK_SUCCESS)
+      throw std::runtime_error("failed to create statistics query pool");
+}
+
+double VKProfiler::nowUs() const {
+  return std::chrono::duration<double, std::micro>(
+             std::chrono::steady_clock::now() - startTime)
+      .count();
+}
+
+void VKProfiler::beginFrame(VkCommandBuffer commandBuffer,
+                            uint32_t frameIndex_) {
+  frameIndex = frameIndex_;
+
+  // the caller has waited on this frame's draw fence, so the queries of the
+  // last submission from this slot are available
+  if (frames[frameIndex].pending)
+    resolveFrame(frameIndex);
+
+  FrameQueries &frame = frames[frameIndex];
+  frame.scopes.clear();
+  frame.timestampCount = 0;
+  frame.statisticsCount = 0;
+  frame.pending = false;
+
+  vkd.vkCmdResetQueryPool(commandBuffer, timestampPools[frameIndex], 0,
+                          (info_.maxScopes + 1) * 2);
+  if (info_.pipelineStatistics)
+    vkd.vkCmdResetQueryPool(commandBuffer, statisticsPools[frameIndex], 0,
+                            info_.maxScopes);
+
+  recording = true;
+  beginScope(commandBuffer, "frame");
+}
+
+void VKProfiler::endFrame(VkCommandBuffer commandBuffer) {
+  assert(recording);
+  assert(openScopes.size() == 1 && "unbalanced profiler scopes");
+  endScope(commandBuffer);
+  recording = false;
+}
+
+void VKProfiler::markSubmitted() {
+  frames[frameIndex].submitUs = nowUs();
+  frames[frameIndex].pending = true;
+}
+
+void VKProfiler::beginScope(VkCommandBuffer commandBuffer, const char *name) {
+  assert(recording);
+  FrameQueries &frame = frames[frameIndex];
+  // out of queries, the scope is dropped but nesting stays balanced
+  if (frame.scopes.size() > info_.maxScopes) {
+    openScopes.push_back(UINT32_MAX);
+    return;
+  }
+
+  GpuScope scope = {
+      .name = name,
+      .beginQuery = frame.timestampCount++,
+  };
+  vkd.vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                          timestampPools[frameIndex], scope.beginQuery);
+
+  // only one statistics query may be active, so only the outermost user
+  // scopes are counted
+  if (info_.pipelineStatistics && openScopes.size() == 1) {
+    scope.statisticsQuery = frame.statisticsCount++;
+    vkd.vkCmdBeginQuery(commandBuffer, statisticsPools[frameIndex],
+                        scope.statisticsQuery, 0);
+  }
+
+  openScopes.push_back(static_cast<uint32_t>(frame.scopes.size()));
+  frame.scopes.push_back(std::move(scope));
+}
+
+void VKProfiler::endScope(VkCommandBuffer commandBuffer) {
+  assert(recording);
+  assert(!openScopes.empty());
+  const uint32_t index = openScopes.back();
+  openScopes.pop_back();
+  if (index == UINT32_MAX)
+    return;
+
+  FrameQueries &frame = frames[frameIndex];
+  GpuScope &scope = frame.scopes[index];
+  if (scope.statisticsQuery != UINT32_MAX)
+    vkd.vkCmdEndQuery(commandBuffer, statisticsPools[frameIndex],
+                      scope.statisticsQuery);
+
+  scope.endQuery = frame.timestampCount++;
+  vkd.vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                          timestampPools[frameIndex], scope.endQuery);
+}
+
+void VKProfiler::beginCpuScope(const char *name) {
+  openCpuScopes.push_back({.name = name, .startUs = nowUs()});
+}
+
+void VKProfiler::endCpuScope() {
+  assert(!openCpuScopes.empty());
+  CpuScope &scope = openCpuScopes.back();
+  pushEvent({
+      .name = std::move(scope.name),
+      .startUs = scope.startUs,
+      .durationUs = nowUs() - scope.startUs,
+      .gpu = false,
+  });
+  openCpuScopes.pop_back();
+}
+
+bool VKProfiler::resolveFrame(uint32_t frame) {
+  FrameQueries &queries = frames[frame];
+  if (queries.timestampCount == 0) {
+    queries.pending = false;
+    return true;
+  }
+
+  std::vector<uint64_t> timestamps(queries.timestampCount);
+  // no WAIT bit, from beginFrame() the draw fence already guarantees
+  // availability, otherwise the frame is still running
+  const VkResult result = vkd.vkGetQueryPoolResults(
+      vkContext->getDevice(), timestampPools[frame], 0,
+      queries.timestampCount, timestamps.size() * sizeof(uint64_t),
+      timestamps.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+  if (result == VK_NOT_READY)
+    return false;
+  queries.pending = false;
+  if (result != VK_SUCCESS)
+    return true;
+
+  std::vector<uint64_t> statistics;
+  if (queries.statisticsCount > 0) {
+    statistics.resize(queries.statisticsCount * statisticCount);
+    if (vkd.vkGetQueryPoolResults(
+            vkContext->getDevice(), statisticsPools[frame], 0,
+            queries.statisticsCount, statistics.size() * sizeof(uint64_t),
+            statistics.data(), statisticCount * sizeof(uint64_t),
+            VK_QUERY_RESULT_64_BIT) != VK_SUCCESS)
+      statistics.clear();
+  }
+
+  // GPU time is anchored at the submit of the frame, the frame scope is
+  // always the first one
+  const uint64_t frameBegin = timestamps[0] & timestampMask;
+  auto toUs = [&](uint64_t ticks) {
+    const uint64_t delta = ((ticks & timestampMask) - frameBegin) &
+                           timestampMask;
+    return queries.submitUs + delta * timestampPeriod / 1000.0;
+  };
+
+  for (const GpuScope &scope : queries.scopes) {
+    if (scope.endQuery == UINT32_MAX)
+      continue;
+    ProfilerEvent event = {
+        .name = scope.name,
+        .startUs = toUs(timestamps[scope.beginQuery]),
+        .durationUs = 0.0,
+        .gpu = true,
+    };
+    event.durationUs = toUs(timestamps[scope.endQuery]) - event.startUs;
+
+    if (scope.statisticsQuery != UINT32_MAX && !statistics.empty()) {
+      const uint64_t *counters =
+          &statistics[scope.statisticsQuery * statisticCount];
+      event.hasStatistics = true;
+      event.statistics = {
+          .inputAssemblyVertices = counters[0],
+          .inputAssemblyPrimitives = counters[1],
+          .vertexShaderInvocations = counters[2],
+          .clippingInvocations = counters[3],
+          .clippingPrimitives = counters[4],
+          .fragmentShaderInvocations = counters[5],
+      };
+    }
+    pushEvent(std::move(event));
+  }
+  return true;
+}
+
+void VKProfiler::resolvePending() {
+  // oldest submit first, so the events stay in order
+  std::vector<uint32_t> pending;
+  for (uint32_t i = 0; i < frames.size(); i++)
+    if (frames[i].pending)
+      pending.push_back(i);
+  std::sort(pending.begin(), pending.end(), [&](uint32_t a, uint32_t b) {
+    return frames[a].submitUs < frames[b].submitUs;
+  });
+  for (uint32_t frame : pending)
+    if (!resolveFrame(frame))
+      break;
+}
+
+void VKProfiler::pushEvent(ProfilerEvent event) {
+  if (events.size() >= info_.maxEvents)
+    events.pop_front();
+  events.push_back(std::move(event));
+}
+
+static void writeJsonString(std::ofstream &out, const std::string &value) {
+  out << '"';
+  for (const char c : value) {
+    if (c == '"' || c == '\\')
+      out << '\\' << c;
+    else if (static_cast<unsigned char>(c) < 0x20)
+      out << ' ';
+    else
+      out << c;
+  }
+  out << '"';
+}
+
+bool VKProfiler::writeChromeTrace(const char *filename) {
+  resolvePending();
+
+  std::ofstream out(filename);
+  if (!out.is_open()) {
+    std::cerr << "Failed to open file at path: " << filename << std::endl;
+    return false;
+  }
+
+  out << std::fixed << std::setprecision(3);
+  out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+  out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,"
+         "\"args\":{\"name\":\"CPU\"}},\n";
+  out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,"
+         "\"args\":{\"name\":\"GPU\"}}";
+
+  for (const ProfilerEvent &event : events) {
+    out << ",\n{\"name\":";
+    writeJsonString(out, event.name);
+    out << ",\"cat\":\"" << (event.gpu ? "gpu" : "cpu")
+        << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << (event.gpu ? 2 : 1)
+        << ",\"ts\":" << event.startUs << ",\"dur\":" << event.durationUs;
+    if (event.hasStatistics) {
+      const PipelineStatistics &s = event.statistics;
+      out << ",\"args\":{\"inputAssemblyVertices\":" << s.inputAssemblyVertices
+          << ",\"inputAssemblyPrimitives\":" << s.inputAssemblyPrimitives
+          << ",\"vertexShaderInvocations\":" << s.vertexShaderInvocations
+          << ",\"clippingInvocations\":" << s.clippingInvocations
+          << ",\"clippingPrimitives\":" << s.clippingPrimitives
+          << ",\"fragmentShaderInvocations\":" << s.fragmentShaderInvocations
+          << "}";
+    }
+    out << "}";
+  }
+  out << "\n]}\n";
+
+  return out.good();
+}
+
+VKProfiler::~VKProfiler() {
+  for (VkQueryPool pool : timestampPools)
+    vkd.vkDestroyQueryPool(vkContext->getDevice(), pool, nullptr);
+  for (VkQueryPool pool : statisticsPools)
+    vkd.vkDestroyQueryPool(vkContext->getDevice(), pool, nullptr);
+}
+
+}; // namespace MAI
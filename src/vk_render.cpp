@@ -5,31 +5,61 @@
 namespace MAI {
 
 VKRender::VKRender(VKContext *vkContext, VKSync *vkSyncObj,
-                   VKSwapchain *vkSwapchain, VKCmd *vkCmd, VKTexture *texture)
-    : vkContext(vkContext), vkSync(vkSyncObj), vkSwapchain(vkSwapchain),
-      vkCmd(vkCmd), depthTexture(texture) {}
+                   VKSwapchain *vkSwapchain, VKCmd *vkCmd,
+                   VKRenderTargetPool *renderTargets)
+    : vkContext(vkContext), vkd(vkContext->getDispatch()), vkSync(vkSyncObj),
+      vkSwapchain(vkSwapchain), vkCmd(vkCmd), renderTargets(renderTargets) {
+  // cleared on load and never stored, so it can stay in tile memory
+  depthTarget = renderTargets->acquire({
+      .extent = vkSwapchain->getSwapchainExtent(),
+      .format = VKTexture::findDepthFormat(vkContext),
+      .usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+      .transient = true,
+  });
+}
+
+void VKRender::recreateSwapChain() {
+  // waits for the device, the old depth target is free to go back
+  vkSwapchain->recreateSwapChain();
+  RenderTargetInfo info = depthTarget->info;
+  info.extent = vkSwapchain->getSwapchainExtent();
+  renderTargets->release(depthTarget, true);
+  depthTarget = renderTargets->acquire(info);
+}
 
 void VKRender::acquireSwapChainImageIndex() {
-  if (vkWaitForFences(vkContext->getDevice(), 1,
-                      &vkSync->getDrawFences()[frameIndex], VK_TRUE,
-                      UINT64_MAX) != VK_SUCCESS)
+  if (vkProfiler)
+    vkProfiler->beginCpuScope("acquire");
+
+  if (vkd.vkWaitForFences(vkContext->getDevice(), 1,
+                          &vkSync->getDrawFences()[frameIndex], VK_TRUE,
+                          UINT64_MAX) != VK_SUCCESS)
     throw std::runtime_error("failed to wait for fence");
 
-  vkResetFences(vkContext->getDevice(), 1,
-                &vkSync->getDrawFences()[frameIndex]);
+  vkd.vkResetFences(vkContext->getDevice(), 1,
+                    &vkSync->getDrawFences()[frameIndex]);
+
+  // the headless ring has one image per frame in flight
+  if (vkContext->isHeadless()) {
+    imageIndex = frameIndex;
+    if (vkProfiler)
+      vkProfiler->endCpuScope();
+    return;
+  }
 
-  VkResult result = vkAcquireNextImageKHR(
+  VkResult result = vkd.vkAcquireNextImageKHR(
       vkContext->getDevice(), vkSwapchain->getSwapchain(), UINT64_MAX,
       vkSync->getImageAvailableSemaphores()[frameIndex], nullptr, &imageIndex);
   if (result == VK_ERROR_OUT_OF_DATE_KHR) {
-    vkSwapchain->recreateSwapChain();
-    delete depthTexture;
-    depthTexture = new VKTexture(vkContext, vkCmd, vkSwapchain,
-                                 {.format = MAI_DEPTH_TEXTURE});
+    recreateSwapChain();
   }
+
+  if (vkProfiler)
+    vkProfiler->endCpuScope();
 }
 
-void transition_image_layout(VkImageAspectFlags imageAspect,
+void transition_image_layout(const VKDispatch &vkd,
+                             VkImageAspectFlags imageAspect,
                              VkImageLayout oldLayout, VkImageLayout newLayout,
                              VkAccessFlagBits2 srcAccessMask,
                              VkAccessFlagBits2 dstAccessMask,
@@ -63,7 +93,7 @@ void transition_image_layout(VkImageAspectFlags imageAspect,
       .pImageMemoryBarriers = &barrier,
   };
 
-  vkCmdPipelineBarrier2(commandBuffer, &dependencyInfo);
+  vkd.vkCmdPipelineBarrier2(commandBuffer, &dependencyInfo);
 }
 
 void VKRender::beginFrame(float clearValue[4]) {
@@ -75,33 +105,30 @@ void VKRender::beginFrame(float clearValue[4]) {
       .pInheritanceInfo = nullptr,
   };
 
-  vkBeginCommandBuffer(vkCmd->getCommandBuffers()[frameIndex], &beginInfo);
+  vkd.vkBeginCommandBuffer(vkCmd->getCommandBuffers()[frameIndex],
+                           &beginInfo);
 
-  transition_image_layout(VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_UNDEFINED,
-                          VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, 0,
-                          VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
-                          VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
-                          VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
-                          vkSwapchain->getswapchainImages()[imageIndex],
-                          vkCmd->getCommandBuffers()[frameIndex]);
+  // the draw fence of this frame was waited on above, so the profiler can
+  // read the previous results of this slot without blocking
+  if (vkProfiler) {
+    vkProfiler->beginCpuScope("record");
+    vkProfiler->beginFrame(vkCmd->getCommandBuffers()[frameIndex],
+                           frameIndex);
+  }
 
-  transition_image_layout(VK_IMAGE_ASPECT_DEPTH_BIT, VK_IMAGE_LAYOUT_UNDEFINED,
-                          VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL,
-                          VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
-                          VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
-                          VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT |
-                              VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT,
-                          VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT |
-                              VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT,
-                          depthTexture->getTextureImage(),
-                          vkCmd->getCommandBuffers()[frameIndex]);
+  if (frameUploads)
+    frameUploads(vkCmd->getCommandBuffers()[frameIndex]);
 
-  VkClearValue clearColor = {
+  clearColor = {
       {{clearValue[0], clearValue[1], clearValue[2], clearValue[3]}}};
-  VkClearValue clearDepth = {{{1.0f, 0.0f}}};
-
-  const VkExtent2D &extent = vkSwapchain->getSwapchainExtent();
+  passActive = false;
+  mainPassActive = false;
+  // dynamic state outlives rendering, set once for every pass of the frame
+  cmdBindDepthState(
+      {.compareOp = VK_COMPARE_OP_ALWAYS, .depthWriteEnable = false});
+}
 
+void VKRender::setViewport(VkExtent2D extent) {
   VkViewport viewport = {
       .x = 0.0f,
       .y = 0.0f,
@@ -116,9 +143,41 @@ void VKRender::beginFrame(float clearValue[4]) {
       .extent = extent,
   };
 
+  VkCommandBuffer commandBuffer = vkCmd->getCommandBuffers()[frameIndex];
+  vkd.vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+  vkd.vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+}
+
+void VKRender::beginMainPass() {
+  assert(!passActive && !mainPassActive);
+  mainPassActive = true;
+
+  transition_image_layout(vkd, VK_IMAGE_ASPECT_COLOR_BIT,
+                          VK_IMAGE_LAYOUT_UNDEFINED,
+                          VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, 0,
+                          VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
+                          VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+                          VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+                          vkSwapchain->getswapchainImages()[imageIndex],
+                          vkCmd->getCommandBuffers()[frameIndex]);
+
+  transition_image_layout(vkd, VK_IMAGE_ASPECT_DEPTH_BIT,
+                          VK_IMAGE_LAYOUT_UNDEFINED,
+                          VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL,
+                          VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+                          VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+                          VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT |
+                              VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT,
+                          VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT |
+                              VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT,
+                          depthTarget->image,
+                          vkCmd->getCommandBuffers()[frameIndex]);
+
+  VkClearValue clearDepth = {{{1.0f, 0.0f}}};
+
   VkRenderingAttachmentInfo depthAttachmentInfo{
       .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
-      .imageView = depthTexture->getTextureImageView(),
+      .imageView = depthTarget->view,
       .imageLayout = VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL,
       .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
       .storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
@@ -130,7 +189,7 @@ void VKRender::beginFrame(float clearValue[4]) {
       .imageView = vkSwapchain->getswapchainImageViews()[imageIndex],
       .imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
       .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
-      .storeOp = VK_ATTACHMENT_STORE_OP_NONE,
+      .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
       .clearValue = clearColor,
   };
 
@@ -147,27 +206,161 @@ void VKRender::beginFrame(float clearValue[4]) {
       .pDepthAttachment = &depthAttachmentInfo,
   };
 
-  vkCmdBeginRendering(vkCmd->getCommandBuffers()[frameIndex], &renderingInfo);
+  vkd.vkCmdBeginRendering(vkCmd->getCommandBuffers()[frameIndex],
+                          &renderingInfo);
+  setViewport(vkSwapchain->getSwapchainExtent());
+}
 
-  vkCmdSetViewport(vkCmd->getCommandBuffers()[frameIndex], 0, 1, &viewport);
-  vkCmdSetScissor(vkCmd->getCommandBuffers()[frameIndex], 0, 1, &scissor);
-  cmdBindDepthState(
-      {.compareOp = VK_COMPARE_OP_ALWAYS, .depthWriteEnable = false});
+void VKRender::ensureRendering() {
+  if (!passActive && !mainPassActive)
+    beginMainPass();
+}
+
+void VKRender::beginPass(const RenderPassInfo &info) {
+  assert(!passActive && !mainPassActive);
+  assert(!info.colors.empty() || info.depth.texture);
+  pass = info;
+  passActive = true;
+
+  VkCommandBuffer commandBuffer = vkCmd->getCommandBuffers()[frameIndex];
+  std::vector<VkRenderingAttachmentInfo> colors;
+  colors.reserve(pass.colors.size());
+  for (const PassAttachment &attachment : pass.colors) {
+    assert(attachment.texture && attachment.texture->isRenderTarget());
+    const bool load = attachment.loadOp == VK_ATTACHMENT_LOAD_OP_LOAD;
+    // the last reads were by fragment shaders, sampling the previous result
+    transition_image_layout(
+        vkd, VK_IMAGE_ASPECT_COLOR_BIT,
+        load ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+             : VK_IMAGE_LAYOUT_UNDEFINED,
+        VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, 0,
+        VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT |
+            VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
+        VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT,
+        VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+        attachment.texture->getTextureImage(), commandBuffer);
+    colors.push_back({
+        .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
+        .imageView = attachment.texture->getTextureImageView(),
+        .imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+        .loadOp = attachment.loadOp,
+        .storeOp = attachment.storeOp,
+        .clearValue = attachment.clearValue,
+    });
+  }
+
+  VkRenderingAttachmentInfo depth = {
+      .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
+  };
+  if (VKTexture *texture = pass.depth.texture) {
+    assert(texture->isRenderTarget());
+    const bool load = pass.depth.loadOp == VK_ATTACHMENT_LOAD_OP_LOAD;
+    transition_image_layout(
+        vkd, VK_IMAGE_ASPECT_DEPTH_BIT,
+        load ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+             : VK_IMAGE_LAYOUT_UNDEFINED,
+        VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL, 0,
+        VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+            VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+        VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT,
+        VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT |
+            VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT,
+        texture->getTextureImage(), commandBuffer);
+    depth.imageView = texture->getTextureImageView();
+    depth.imageLayout = VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL;
+    depth.loadOp = pass.depth.loadOp;
+    depth.storeOp = pass.depth.storeOp;
+    depth.clearValue = pass.depth.clearValue;
+  }
+
+  const VkExtent2D extent = pass.colors.empty()
+                                ? pass.depth.texture->getExtent()
+                                : pass.colors[0].texture->getExtent();
+  VkRenderingInfo renderingInfo = {
+      .sType = VK_STRUCTURE_TYPE_RENDERING_INFO,
+      .renderArea =
+          {
+              .offset = {0, 0},
+              .extent = extent,
+          },
+      .layerCount = 1,
+      .colorAttachmentCount = static_cast<uint32_t>(colors.size()),
+      .pColorAttachments = colors.data(),
+      .pDepthAttachment = pass.depth.texture ? &depth : nullptr,
+  };
+
+  vkd.vkCmdBeginRendering(commandBuffer, &renderingInfo);
+  setViewport(extent);
+}
+
+void VKRender::endPass() {
+  assert(passActive);
+  passActive = false;
+
+  VkCommandBuffer commandBuffer = vkCmd->getCommandBuffers()[frameIndex];
+  vkd.vkCmdEndRendering(commandBuffer);
+
+  for (const PassAttachment &attachment : pass.colors)
+    transition_image_layout(vkd, VK_IMAGE_ASPECT_COLOR_BIT,
+                            VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                            VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                            VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
+                            VK_ACCESS_2_SHADER_SAMPLED_READ_BIT,
+                            VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+                            VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT,
+                            attachment.texture->getTextureImage(),
+                            commandBuffer);
+  if (pass.depth.texture)
+    transition_image_layout(vkd, VK_IMAGE_ASPECT_DEPTH_BIT,
+                            VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL,
+                            VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                            VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+                            VK_ACCESS_2_SHADER_SAMPLED_READ_BIT,
+                            VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT |
+                                VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT,
+                            VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT,
+                            pass.depth.texture->getTextureImage(),
+                            commandBuffer);
 }
 
 void VKRender::endFrame() {
-  vkCmdEndRendering(vkCmd->getCommandBuffers()[frameIndex]);
-  transition_image_layout(
-      VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-      VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
-      {}, VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
-      VK_PIPELINE_STAGE_2_BOTTOM_OF_PIPE_BIT,
-      vkSwapchain->getswapchainImages()[imageIndex],
-      vkCmd->getCommandBuffers()[frameIndex]);
-  vkEndCommandBuffer(vkCmd->getCommandBuffers()[frameIndex]);
+  assert(!passActive);
+  // a frame without draws still clears the swapchain image
+  ensureRendering();
+  vkd.vkCmdEndRendering(vkCmd->getCommandBuffers()[frameIndex]);
+  // headless images are never presented, leave them ready for readback
+  if (vkContext->isHeadless())
+    transition_image_layout(
+        vkd, VK_IMAGE_ASPECT_COLOR_BIT,
+        VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT, VK_ACCESS_2_TRANSFER_READ_BIT,
+        VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+        VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+        vkSwapchain->getswapchainImages()[imageIndex],
+        vkCmd->getCommandBuffers()[frameIndex]);
+  else
+    transition_image_layout(
+        vkd, VK_IMAGE_ASPECT_COLOR_BIT,
+        VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+        VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+        VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT, {},
+        VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+        VK_PIPELINE_STAGE_2_BOTTOM_OF_PIPE_BIT,
+        vkSwapchain->getswapchainImages()[imageIndex],
+        vkCmd->getCommandBuffers()[frameIndex]);
+  if (vkProfiler) {
+    vkProfiler->endFrame(vkCmd->getCommandBuffers()[frameIndex]);
+    vkProfiler->endCpuScope();
+  }
+  vkd.vkEndCommandBuffer(vkCmd->getCommandBuffers()[frameIndex]);
 }
 
 void VKRender::submitFrame() {
+  if (vkContext->isHeadless()) {
+    submitHeadlessFrame();
+    return;
+  }
 
   VkSemaphore waitSemaphore[] = {
       vkSync->getImageAvailableSemaphores()[frameIndex],
@@ -190,9 +383,15 @@ void VKRender::submitFrame() {
       .pSignalSemaphores = signalSemaphore,
   };
 
-  if (vkQueueSubmit(vkContext->getGraphicsQueue(), 1, &submitInfo,
-                    vkSync->getDrawFences()[frameIndex]) != VK_SUCCESS)
+  if (vkProfiler)
+    vkProfiler->beginCpuScope("submit");
+  if (vkd.vkQueueSubmit(vkContext->getGraphicsQueue(), 1, &submitInfo,
+                        vkSync->getDrawFences()[frameIndex]) != VK_SUCCESS)
     throw std::runtime_error("failed to submit to the queue");
+  if (vkProfiler) {
+    vkProfiler->markSubmitted();
+    vkProfiler->endCpuScope();
+  }
 
   VkSwapchainKHR swapChains[] = {vkSwapchain->getSwapchain()};
 
@@ -205,66 +404,107 @@ void VKRender::submitFrame() {
       .pImageIndices = &imageIndex,
   };
 
+  if (vkProfiler)
+    vkProfiler->beginCpuScope("present");
   VkResult result =
-      vkQueuePresentKHR(vkContext->getPresentQueue(), &presentInfo);
+      vkd.vkQueuePresentKHR(vkContext->getPresentQueue(), &presentInfo);
+  if (vkProfiler)
+    vkProfiler->endCpuScope();
   if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR ||
       vkContext->frameRsized) {
     vkContext->frameRsized = false;
-    vkSwapchain->recreateSwapChain();
-    delete depthTexture;
-    depthTexture = new VKTexture(vkContext, vkCmd, vkSwapchain,
-                                 {.format = MAI_DEPTH_TEXTURE});
+    recreateSwapChain();
   } else if (result != VK_SUCCESS)
     throw std::runtime_error("failed to present swap chain image");
 
   frameIndex = (frameIndex + 1) % MAX_FRAMES_IN_FLIGHT;
 }
 
+void VKRender::submitHeadlessFrame() {
+  // no acquire or present to wait on, the draw fence is the only sync
+  VkSubmitInfo submitInfo = {
+      .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+      .commandBufferCount = 1,
+      .pCommandBuffers = &vkCmd->getCommandBuffers()[frameIndex],
+  };
+
+  if (vkProfiler)
+    vkProfiler->beginCpuScope("submit");
+  if (vkd.vkQueueSubmit(vkContext->getGraphicsQueue(), 1, &submitInfo,
+                        vkSync->getDrawFences()[frameIndex]) != VK_SUCCESS)
+    throw std::runtime_error("failed to submit to the queue");
+  if (vkProfiler) {
+    vkProfiler->markSubmitted();
+    vkProfiler->endCpuScope();
+  }
+
+  frameIndex = (frameIndex + 1) % MAX_FRAMES_IN_FLIGHT;
+}
+
+void VKRender::cmdBeginProfileScope(const char *name) {
+  if (vkProfiler)
+    vkProfiler->beginScope(vkCmd->getCommandBuffers()[frameIndex], name);
+}
+
+void VKRender::cmdEndProfileScope() {
+  if (vkProfiler)
+    vkProfiler->endScope(vkCmd->getCommandBuffers()[frameIndex]);
+}
+
 void VKRender::bindPipline(VkPipelineBindPoint bindPoint, VkPipeline pipeline) {
-  vkCmdBindPipeline(vkCmd->getCommandBuffers()[frameIndex], bindPoint,
-                    pipeline);
+  vkd.vkCmdBindPipeline(vkCmd->getCommandBuffers()[frameIndex], bindPoint,
+                        pipeline);
 }
 
 void VKRender::cmdBindDescriptorSets(
     VkPipelineBindPoint bindPoint, VkPipelineLayout piplineLayout,
     const std::vector<VkDescriptorSet> &descriptorSets) {
-  vkCmdBindDescriptorSets(vkCmd->getCommandBuffers()[frameIndex], bindPoint,
-                          piplineLayout, 0, 1, &descriptorSets[frameIndex], 0,
-                          nullptr);
+  vkd.vkCmdBindDescriptorSets(vkCmd->getCommandBuffers()[frameIndex],
+                              bindPoint, piplineLayout, 0, 1,
+                              &descriptorSets[frameIndex], 0, nullptr);
 }
 
 void VKRender::cmdDraw(uint32_t vertexCount, uint32_t instanceCount,
                        uint32_t firstVertex, uint32_t firstInstance) {
-  vkCmdDraw(vkCmd->getCommandBuffers()[frameIndex], vertexCount, instanceCount,
-            firstVertex, firstInstance);
+  ensureRendering();
+  vkd.vkCmdDraw(vkCmd->getCommandBuffers()[frameIndex], vertexCount,
+                instanceCount, firstVertex, firstInstance);
+}
+
+void VKRender::cmdDrawIndirect(VkBuffer buffer, VkDeviceSize offset,
+                               uint32_t drawCount, uint32_t stride) {
+  ensureRendering();
+  vkd.vkCmdDrawIndirect(vkCmd->getCommandBuffers()[frameIndex], buffer,
+                        offset, drawCount, stride);
 }
 
 void VKRender::cmdBindVertexBuffers(uint32_t firstBinding,
                                     uint32_t bindingCount,
                                     const VkBuffer *pBuffers,
                                     const VkDeviceSize *offsets) {
-  vkCmdBindVertexBuffers(vkCmd->getCommandBuffers()[frameIndex], firstBinding,
-                         bindingCount, pBuffers, offsets);
+  vkd.vkCmdBindVertexBuffers(vkCmd->getCommandBuffers()[frameIndex],
+                             firstBinding, bindingCount, pBuffers, offsets);
 }
 
 void VKRender::cmdBindIndexBuffer(VkBuffer buffer, VkDeviceSize offset,
                                   VkIndexType indexType) {
-  vkCmdBindIndexBuffer(vkCmd->getCommandBuffers()[frameIndex], buffer, offset,
-                       indexType);
+  vkd.vkCmdBindIndexBuffer(vkCmd->getCommandBuffers()[frameIndex], buffer,
+                           offset, indexType);
 }
 
 void VKRender::cmdDrawIndex(uint32_t indexCount, uint32_t instanceCount,
                             uint32_t firstIndex, int32_t vertexOffset,
                             uint32_t firstInstance) {
-  vkCmdDrawIndexed(vkCmd->getCommandBuffers()[frameIndex], indexCount,
-                   instanceCount, firstIndex, vertexOffset, firstInstance);
+  ensureRendering();
+  vkd.vkCmdDrawIndexed(vkCmd->getCommandBuffers()[frameIndex], indexCount,
+                       instanceCount, firstIndex, vertexOffset, firstInstance);
 }
 
 void VKRender::cmdPushConstants(VkPipelineLayout pipelineLayout,
                                 VkShaderStageFlags shaderStage, uint32_t offset,
                                 uint32_t size, const void *value) {
-  vkCmdPushConstants(vkCmd->getCommandBuffers()[frameIndex], pipelineLayout,
-                     shaderStage, offset, size, value);
+  vkd.vkCmdPushConstants(vkCmd->getCommandBuffers()[frameIndex],
+                         pipelineLayout, shaderStage, offset, size, value);
 }
 
 void VKRender::cmdBindDepthState(DepthInfo info) {
@@ -273,15 +513,15 @@ void VKRender::cmdBindDepthState(DepthInfo info) {
   // vkCmdSetDepthTestEnable(wrapper_->cmdBuf_, (op != VK_COMPARE_OP_ALWAYS ||
   // desc.isDepthWriteEnabled) ? VK_TRUE : VK_FALSE);
 
-  vkCmdSetDepthWriteEnable(vkCmd->getCommandBuffers()[frameIndex],
-                           info.depthWriteEnable);
-  vkCmdSetDepthTestEnable(
+  vkd.vkCmdSetDepthWriteEnable(vkCmd->getCommandBuffers()[frameIndex],
+                               info.depthWriteEnable);
+  vkd.vkCmdSetDepthTestEnable(
       vkCmd->getCommandBuffers()[frameIndex],
       (info.compareOp != VK_COMPARE_OP_ALWAYS && info.depthWriteEnable)
           ? VK_TRUE
           : VK_FALSE);
 }
 
-VKRender::~VKRender() { delete depthTexture; }
+VKRender::~VKRender() { renderTargets->release(depthTarget); }
 
 } // namespace MAI
@@ -0,0 +1,171 @@
+#include "vk_render_target.h"
+#include <algorithm>
+
+namespace MAI {
+
+static bool sameInfo(const RenderTargetInfo &a, const RenderTargetInfo &b) {
+  return a.extent.width == b.extent.width &&
+         a.extent.height == b.extent.height && a.format == b.format &&
+         a.usage == b.usage && a.transient == b.transient;
+}
+
+// any extent
+static bool sameKind(const RenderTargetInfo &a, const RenderTargetInfo &b) {
+  return a.format == b.format && a.usage == b.usage &&
+         a.transient == b.transient;
+}
+
+static VkImageAspectFlags aspectForFormat(VkFormat format) {
+  switch (format) {
+  case VK_FORMAT_D16_UNORM:
+  case VK_FORMAT_X8_D24_UNORM_PACK32:
+  case VK_FORMAT_D32_SFLOAT:
+  case VK_FORMAT_D16_UNORM_S8_UINT:
+  case VK_FORMAT_D24_UNORM_S8_UINT:
+  case VK_FORMAT_D32_SFLOAT_S8_UINT:
+    // attachments are rendered through their depth aspect
+    return VK_IMAGE_ASPECT_DEPTH_BIT;
+  case VK_FORMAT_S8_UINT:
+    return VK_IMAGE_ASPECT_STENCIL_BIT;
+  default:
+    return VK_IMAGE_ASPECT_COLOR_BIT;
+  }
+}
+
+VKRenderTargetPool::VKRenderTargetPool(VKContext *vkContext)
+    : vkContext(vkContext), vkd(vkContext->getDispatch()) {}
+
+RenderTarget *VKRenderTargetPool::acquire(const RenderTargetInfo &info) {
+  // the most recently released match, the oldest ones are the next to go
+  for (auto it = cached.rbegin(); it != cached.rend(); it++)
+    if (sameInfo(it->target->info, info) && it->reuseFrame <= frame) {
+      RenderTarget *target = it->target;
+      cached.erase(std::next(it).base());
+      return target;
+    }
+  return createTarget(info);
+}
+
+void VKRenderTargetPool::release(RenderTarget *target, bool idle) {
+  if (!target)
+    return;
+  cached.push_back({
+      .target = target,
+      .reuseFrame = idle ? frame : frame + MAX_FRAMES_IN_FLIGHT,
+  });
+  trim();
+}
+
+void VKRenderTargetPool::trim() {
+  struct Kind {
+    const RenderTargetInfo *info;
+    uint32_t count;
+  };
+  std::vector<Kind> kinds;
+  std::vector<bool> drop(cached.size());
+  // newest first, so the most recent sizes of a kind stay
+  for (size_t i = cached.size(); i-- > 0;) {
+    const RenderTargetInfo &info = cached[i].target->info;
+    auto it = std::find_if(kinds.begin(), kinds.end(), [&](const Kind &kind) {
+      return sameKind(*kind.info, info);
+    });
+    if (it == kinds.end())
+      kinds.push_back({.info = &info, .count = 1});
+    else if (++it->count > RENDER_TARGET_MAX_CACHED &&
+             cached[i].reuseFrame <= frame)
+      drop[i] = true;
+  }
+
+  size_t kept = 0;
+  for (size_t i = 0; i < cached.size(); i++) {
+    if (drop[i])
+      destroyTarget(cached[i].target);
+    else
+      cached[kept++] = cached[i];
+  }
+  cached.resize(kept);
+}
+
+void VKRenderTargetPool::nextFrame() {
+  frame++;
+  std::erase_if(cached, [&](const Cached &entry) {
+    if (entry.reuseFrame + RENDER_TARGET_IDLE_FRAMES > frame)
+      return false;
+    destroyTarget(entry.target);
+    return true;
+  });
+  // targets still in flight when they went over the cap
+  trim();
+}
+
+RenderTarget *VKRenderTargetPool::createTarget(const RenderTargetInfo &info) {
+  assert(info.extent.width && info.extent.height);
+  RenderTarget *target = new RenderTarget{.info = info};
+
+  VkImageCreateInfo imageInfo{
+      .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+      .imageType = VK_IMAGE_TYPE_2D,
+      .format = info.format,
+      .extent =
+          {
+              .width = info.extent.width,
+              .height = info.extent.height,
+              .depth = 1,
+          },
+      .mipLevels = 1,
+      .arrayLayers = 1,
+      .samples = VK_SAMPLE_COUNT_1_BIT,
+      .tiling = VK_IMAGE_TILING_OPTIMAL,
+      .usage = info.usage,
+      .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+      .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+  };
+  if (info.transient)
+    imageInfo.usage |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+
+  if (vkd.vkCreateImage(vkContext->getDevice(), &imageInfo, nullptr,
+                        &target->image) != VK_SUCCESS) {
+    delete target;
+    throw std::runtime_error("failed to create render target image");
+  }
+  target->allocation = vkContext->getAllocator()->allocateImage(
+      target->image,
+      info.transient ? MAI_MEMORY_TRANSIENT : MAI_MEMORY_GPU_ONLY);
+
+  VkImageViewCreateInfo viewInfo{
+      .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+      .image = target->image,
+      .viewType = VK_IMAGE_VIEW_TYPE_2D,
+      .format = info.format,
+      .subresourceRange =
+          {
+              .aspectMask = aspectForFormat(info.format),
+              .baseMipLevel = 0,
+              .levelCount = 1,
+              .baseArrayLayer = 0,
+              .layerCount = 1,
+          },
+  };
+  if (vkd.vkCreateImageView(vkContext->getDevice(), &viewInfo, nullptr,
+                            &target->view) != VK_SUCCESS) {
+    destroyTarget(target);
+    throw std::runtime_error("failed to create render target view");
+  }
+  return target;
+}
+
+void VKRenderTargetPool::destroyTarget(RenderTarget *target) {
+  if (target->view != VK_NULL_HANDLE)
+    vkd.vkDestroyImageView(vkContext->getDevice(), target->view, nullptr);
+  vkd.vkDestroyImage(vkContext->getDevice(), target->image, nullptr);
+  vkContext->getAllocator()->free(target->allocation);
+  delete target;
+}
+
+VKRenderTargetPool::~VKRenderTargetPool() {
+  // targets still acquired belong to their users, who release them first
+  for (const Cached &entry : cached)
+    destroyTarget(entry.target);
+}
+
+}; // namespace MAI
@@ -0,0 +1,77 @@
+#include "vk_residency.h"
+#include "vk_buffer.h"
+#include "vk_image.h"
+#include <algorithm>
+
+namespace MAI {
+
+VKResidency::VKResidency(VKContext *vkContext) : vkContext(vkContext) {}
+
+void VKResidency::touch(VKTexture *texture) {
+  auto it = textures.find(texture);
+  if (it != textures.end())
+    it->second = frame;
+}
+
+void VKResidency::touch(VKbuffer *buffer) {
+  auto it = buffers.find(buffer);
+  if (it != buffers.end())
+    it->second = frame;
+}
+
+bool VKResidency::evict(uint32_t heap, VkDeviceSize size) {
+  if (evicting)
+    return false;
+  evicting = true;
+
+  struct Candidate {
+    uint64_t lastUsed;
+    VKTexture *texture;
+    VKbuffer *buffer;
+  };
+  std::vector<Candidate> candidates;
+  for (const auto &[texture, lastUsed] : textures)
+    if (lastUsed < frame && texture->getMemoryHeap() == heap &&
+        texture->isDeviceLocal())
+      candidates.push_back({lastUsed, texture, nullptr});
+  for (const auto &[buffer, lastUsed] : buffers)
+    if (lastUsed < frame && buffer->getMemoryHeap() == heap &&
+        buffer->isDeviceLocal())
+      candidates.push_back({lastUsed, nullptr, buffer});
+  std::sort(candidates.begin(), candidates.end(),
+            [](const Candidate &a, const Candidate &b) {
+              return a.lastUsed < b.lastUsed;
+            });
+
+  VkDeviceSize freed = 0;
+  for (const Candidate &candidate : candidates) {
+    if (freed >= size)
+      break;
+
+    if (candidate.texture) {
+      const VkDeviceSize bytes = candidate.texture->getMemorySize();
+      if (!candidate.texture->demote())
+        continue;
+      freed += bytes;
+      // system memory is as low as it goes, stop tracking it
+      textures.erase(candidate.texture);
+      if (textureMoved)
+        textureMoved(candidate.texture);
+    } else {
+      const VkDeviceSize bytes = candidate.buffer->getMemorySize();
+      if (!candidate.buffer->demote())
+        continue;
+      freed += bytes;
+      buffers.erase(candidate.buffer);
+    }
+  }
+
+  if (freed)
+    std::cerr << "over the memory budget of heap " << heap << ", moved "
+              << freed << " bytes to system memory" << std::endl;
+
+  evicting = false;
+  return freed > 0;
+}
+
+}; // namespace MAI
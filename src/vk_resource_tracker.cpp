@@ -0,0 +1,65 @@
+#include "vk_resource_tracker.h"
+#include <algorithm>
+#include <vector>
+
+namespace MAI {
+
+MemoryCounter &VKResourceTracker::kindCounter(ResourceKind kind) {
+  return kind == MAI_RESOURCE_BUFFER ? stats.buffers : stats.textures;
+}
+
+void VKResourceTracker::add(const void *resource, ResourceKind kind,
+                            const char *debugName, VkDeviceSize bytes) {
+  std::lock_guard<std::mutex> lock(mutex);
+  Record record{
+      .kind = kind,
+      .name = debugName ? debugName : "unnamed",
+      .bytes = bytes,
+      .serial = nextSerial++,
+  };
+  kindCounter(kind).add(bytes);
+  stats.names[record.name].add(bytes);
+  records[resource] = std::move(record);
+}
+
+void VKResourceTracker::remove(const void *resource) {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto it = records.find(resource);
+  if (it == records.end())
+    return;
+  kindCounter(it->second.kind).remove(it->second.bytes);
+  stats.names[it->second.name].remove(it->second.bytes);
+  records.erase(it);
+}
+
+ResourceStats VKResourceTracker::getStats() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return stats;
+}
+
+bool VKResourceTracker::reportLeaks(std::ostream &out) {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (records.empty())
+    return false;
+
+  std::vector<const Record *> leaks;
+  for (const auto &[resource, record] : records)
+    leaks.push_back(&record);
+  std::sort(leaks.begin(), leaks.end(),
+            [](const Record *a, const Record *b) {
+              return a->serial < b->serial;
+            });
+
+  VkDeviceSize bytes = 0;
+  for (const Record *leak : leaks)
+    bytes += leak->bytes;
+  out << leaks.size() << " resources were never deleted, " << bytes
+      << " bytes:" << std::endl;
+  for (const Record *leak : leaks)
+    out << "  " << (leak->kind == MAI_RESOURCE_BUFFER ? "buffer" : "texture")
+        << " '" << leak->name << "' " << leak->bytes << " bytes"
+        << std::endl;
+  return true;
+}
+
+}; // namespace MAI
@@ -0,0 +1,75 @@
+#include "vk_sampler.h"
+#include <algorithm>
+
+namespace MAI {
+
+VKSamplerCache::VKSamplerCache(VKContext *vkContext) : vkContext(vkContext) {
+  const SamplerInfo clamp{
+      .addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+      .addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+      .addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+  };
+  // SAMPLER_REPEAT and SAMPLER_CLAMP, in that order
+  getSampler({});
+  getSampler(clamp);
+}
+
+Sampler VKSamplerCache::getSampler(const SamplerInfo &info) {
+  // a handful of entries, a linear search beats hashing every field
+  for (uint32_t i = 0; i < samplers.size(); i++)
+    if (samplers[i].info == info)
+      return {.sampler = samplers[i].sampler, .index = i};
+
+  if (samplers.size() == MAX_SAMPLERS)
+    throw std::runtime_error("sampler table is full");
+
+  const float maxAnisotropy =
+      vkContext->getCapabilities().limits().maxSamplerAnisotropy;
+  VkSamplerCreateInfo samplerInfo{
+      .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+      .magFilter = info.magFilter,
+      .minFilter = info.minFilter,
+      .mipmapMode = info.mipmapMode,
+      .addressModeU = info.addressModeU,
+      .addressModeV = info.addressModeV,
+      .addressModeW = info.addressModeW,
+      .mipLodBias = info.mipLodBias,
+      .anisotropyEnable = info.anisotropyEnable,
+      .maxAnisotropy = info.maxAnisotropy > 0.0f
+                           ? std::min(info.maxAnisotropy, maxAnisotropy)
+                           : maxAnisotropy,
+      .compareEnable = info.compareEnable,
+      .compareOp = info.compareOp,
+      .minLod = info.minLod,
+      .maxLod = info.maxLod,
+      .borderColor = info.borderColor,
+      .unnormalizedCoordinates = info.unnormalizedCoordinates,
+  };
+
+  VkSampler sampler;
+  if (vkContext->getDispatch().vkCreateSampler(vkContext->getDevice(),
+                                               &samplerInfo, nullptr,
+                                               &sampler) != VK_SUCCESS)
+    throw std::runtime_error("failed to creat texture sampler");
+
+  const uint32_t index = static_cast<uint32_t>(samplers.size());
+  samplers.push_back({.info = info, .sampler = sampler});
+  if (samplerAdded)
+    samplerAdded(sampler, index);
+  return {.sampler = sampler, .index = index};
+}
+
+void VKSamplerCache::setSamplerAddedCallback(SamplerAddedFunc func) {
+  samplerAdded = func;
+  if (samplerAdded)
+    for (uint32_t i = 0; i < samplers.size(); i++)
+      samplerAdded(samplers[i].sampler, i);
+}
+
+VKSamplerCache::~VKSamplerCache() {
+  for (const Entry &entry : samplers)
+    vkContext->getDispatch().vkDestroySampler(vkContext->getDevice(),
+                                              entry.sampler, nullptr);
+}
+
+}; // namespace MAI
@@ -5,7 +5,8 @@
 namespace MAI {
 VKShader::VKShader(VKContext *vkContext, const char *filename,
                    VkShaderStageFlagBits stage)
-    : vkContext(vkContext), filename(filename), stage(stage) {
+    : vkContext(vkContext), vkd(vkContext->getDispatch()), filename(filename),
+      stage(stage) {
   createShaderModule();
 }
 
@@ -32,13 +33,13 @@ void VKShader::createShaderModule() {
       .codeSize = static_cast<uint32_t>(code.size()),
       .pCode = reinterpret_cast<const uint32_t *>(code.data()),
   };
-  if (vkCreateShaderModule(vkContext->getDevice(), &createInfo, nullptr,
-                           &shaderModule) != VK_SUCCESS)
+  if (vkd.vkCreateShaderModule(vkContext->getDevice(), &createInfo, nullptr,
+                               &shaderModule) != VK_SUCCESS)
     throw std::runtime_error("failed to create shader module!");
 }
 
 VKShader::~VKShader() {
-  vkDestroyShaderModule(vkContext->getDevice(), shaderModule, nullptr);
+  vkd.vkDestroyShaderModule(vkContext->getDevice(), shaderModule, nullptr);
 }
 
 }; // namespace MAI
@@ -0,0 +1,73 @@
+#include "vk_staging.h"
+#include "vk_buffer.h"
+#include <cassert>
+
+namespace MAI {
+
+VKStagingRing::VKStagingRing(VKContext *vkContext, VkDeviceSize capacity)
+    : vkContext(vkContext), capacity(capacity) {
+  assert(capacity > 0);
+  VKbuffer::createBuffer(vkContext, capacity, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                         MAI_MEMORY_UPLOAD, buffer, allocation);
+}
+
+bool VKStagingRing::allocate(VkDeviceSize size, VkDeviceSize alignment,
+                             uint64_t uploadId, StagingRegion &region) {
+  assert(size > 0 && alignment > 0);
+  if (size > capacity)
+    return false;
+
+  VkDeviceSize offset = 0;
+  if (!entries.empty()) {
+    const VkDeviceSize head = entries.back().end;
+    const VkDeviceSize tail = entries.front().begin;
+    offset = (head + alignment - 1) / alignment * alignment;
+    if (tail < head) {
+      // used space is [tail, head), try the end first and wrap to 0
+      if (offset + size > capacity) {
+        if (size > tail)
+          return false;
+        offset = 0;
+      }
+    } else if (offset + size > tail) {
+      // already wrapped, free space is [head, tail)
+      return false;
+    }
+  }
+
+  // consecutive chunks of one upload share an entry, alignment padding
+  // included
+  if (!entries.empty() && entries.back().uploadId == uploadId &&
+      !entries.back().retired && offset >= entries.back().end)
+    entries.back().end = offset + size;
+  else
+    entries.push_back({.uploadId = uploadId,
+                       .begin = offset,
+                       .end = offset + size});
+
+  region = {
+      .buffer = buffer,
+      .offset = offset,
+      .size = size,
+      .data = static_cast<char *>(allocation.mapped) + offset,
+  };
+  return true;
+}
+
+void VKStagingRing::retire(uint64_t uploadId) {
+  for (Entry &entry : entries)
+    if (entry.uploadId == uploadId)
+      entry.retired = true;
+  while (!entries.empty() && entries.front().retired)
+    entries.pop_front();
+}
+
+uint64_t VKStagingRing::getOldestUpload() const {
+  return entries.empty() ? 0 : entries.front().uploadId;
+}
+
+VKStagingRing::~VKStagingRing() {
+  VKbuffer::destroyBuffer(vkContext, buffer, allocation);
+}
+
+}; // namespace MAI
@@ -5,8 +5,13 @@
 #include <limits>
 
 namespace MAI {
-VKSwapchain::VKSwapchain(VKContext *vkContext_) : vkContext(vkContext_) {
-  createSwapChain();
+VKSwapchain::VKSwapchain(VKContext *vkContext_, VkExtent2D headlessExtent)
+    : vkContext(vkContext_), vkd(vkContext_->getDispatch()),
+      headlessExtent(headlessExtent) {
+  if (vkContext->isHeadless())
+    createHeadlessImages();
+  else
+    createSwapChain();
   createSwapChainImageViews();
 }
 
@@ -108,20 +113,64 @@ void VKSwapchain::createSwapChain() {
       .oldSwapchain = nullptr,
   };
 
-  if (vkCreateSwapchainKHR(vkContext->getDevice(), &createInfo, nullptr,
-                           &swapchain) != VK_SUCCESS)
+  if (vkd.vkCreateSwapchainKHR(vkContext->getDevice(), &createInfo, nullptr,
+                               &swapchain) != VK_SUCCESS)
     throw std::runtime_error("failed to create swap chain");
 
-  vkGetSwapchainImagesKHR(vkContext->getDevice(), swapchain, &imageCount,
-                          nullptr);
+  vkd.vkGetSwapchainImagesKHR(vkContext->getDevice(), swapchain, &imageCount,
+                              nullptr);
   swapchainImages.resize(imageCount);
-  vkGetSwapchainImagesKHR(vkContext->getDevice(), swapchain, &imageCount,
-                          swapchainImages.data());
+  vkd.vkGetSwapchainImagesKHR(vkContext->getDevice(), swapchain, &imageCount,
+                              swapchainImages.data());
 
   swapchainImageFormat = surfaceFormat.format;
   swapchainExtent = extents;
 }
 
+void VKSwapchain::createHeadlessImages() {
+  if (headlessExtent.width == 0 || headlessExtent.height == 0)
+    throw std::runtime_error("headless extent must be greater than 0");
+
+  // prefer the format a surface would usually give us so pipelines behave
+  // the same with and without a window
+  swapchainImageFormat = VK_FORMAT_B8G8R8A8_SRGB;
+  const VkFormatProperties &props =
+      vkContext->getFormatProperties(swapchainImageFormat);
+  if (!(props.optimalTilingFeatures &
+        VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT))
+    swapchainImageFormat = VK_FORMAT_R8G8B8A8_SRGB;
+  swapchainExtent = headlessExtent;
+
+  // one image per frame in flight, so the draw fence of a frame also guards
+  // its image
+  swapchainImages.resize(MAX_FRAMES_IN_FLIGHT);
+  headlessImageAllocations.resize(MAX_FRAMES_IN_FLIGHT);
+
+  for (size_t i = 0; i < swapchainImages.size(); i++) {
+    VkImageCreateInfo imageInfo{
+        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+        .imageType = VK_IMAGE_TYPE_2D,
+        .format = swapchainImageFormat,
+        .extent = {swapchainExtent.width, swapchainExtent.height, 1},
+        .mipLevels = 1,
+        .arrayLayers = 1,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .tiling = VK_IMAGE_TILING_OPTIMAL,
+        .usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                 VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+    };
+
+    if (vkd.vkCreateImage(vkContext->getDevice(), &imageInfo, nullptr,
+                          &swapchainImages[i]) != VK_SUCCESS)
+      throw std::runtime_error("failed to create headless image");
+
+    headlessImageAllocations[i] = vkContext->getAllocator()->allocateImage(
+        swapchainImages[i], MAI_MEMORY_GPU_ONLY);
+  }
+}
+
 void VKSwapchain::createSwapChainImageViews() {
 
   swapchainImageViews.resize(swapchainImages.size());
@@ -141,28 +190,41 @@ void VKSwapchain::createSwapChainImageViews() {
                 .layerCount = 1,
             },
     };
-    if (vkCreateImageView(vkContext->getDevice(), &createInfo, nullptr,
-                          &swapchainImageViews[i]) != VK_SUCCESS)
+    if (vkd.vkCreateImageView(vkContext->getDevice(), &createInfo, nullptr,
+                              &swapchainImageViews[i]) != VK_SUCCESS)
       throw std::runtime_error("failed to create swap image view");
   }
 }
 
 void VKSwapchain::recreateSwapChain() {
 
-  vkDeviceWaitIdle(vkContext->getDevice());
+  vkd.vkDeviceWaitIdle(vkContext->getDevice());
 
   cleanupSwapchain();
 
-  createSwapChain();
+  if (vkContext->isHeadless())
+    createHeadlessImages();
+  else
+    createSwapChain();
   createSwapChainImageViews();
 }
 
 void VKSwapchain::cleanupSwapchain() {
 
   for (size_t i = 0; i < swapchainImages.size(); i++)
-    vkDestroyImageView(vkContext->getDevice(), swapchainImageViews[i], nullptr);
+    vkd.vkDestroyImageView(vkContext->getDevice(), swapchainImageViews[i],
+                           nullptr);
+
+  if (vkContext->isHeadless()) {
+    for (size_t i = 0; i < swapchainImages.size(); i++) {
+      vkd.vkDestroyImage(vkContext->getDevice(), swapchainImages[i], nullptr);
+      vkContext->getAllocator()->free(headlessImageAllocations[i]);
+    }
+    headlessImageAllocations.clear();
+    return;
+  }
 
-  vkDestroySwapchainKHR(vkContext->getDevice(), swapchain, nullptr);
+  vkd.vkDestroySwapchainKHR(vkContext->getDevice(), swapchain, nullptr);
 }
 
 VKSwapchain::~VKSwapchain() { cleanupSwapchain(); }
@@ -3,7 +3,8 @@
 
 namespace MAI {
 
-VKSync::VKSync(VKContext *vkContext_) : vkContext(vkContext_) {
+VKSync::VKSync(VKContext *vkContext_)
+    : vkContext(vkContext_), vkd(vkContext_->getDispatch()) {
   createSyncObjects();
 }
 
@@ -20,23 +21,23 @@ void VKSync::createSyncObjects() {
       .flags = VK_FENCE_CREATE_SIGNALED_BIT,
   };
   for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
-    if (vkCreateSemaphore(vkContext->getDevice(), &semaphoreInfo, nullptr,
-                          &imageAvailableSemaphores[i]) ||
-        vkCreateSemaphore(vkContext->getDevice(), &semaphoreInfo, nullptr,
-                          &renderFinishSemaphores[i]) ||
-        vkCreateFence(vkContext->getDevice(), &fenceInfo, nullptr,
-                      &drawFences[i]) != VK_SUCCESS)
+    if (vkd.vkCreateSemaphore(vkContext->getDevice(), &semaphoreInfo, nullptr,
+                              &imageAvailableSemaphores[i]) ||
+        vkd.vkCreateSemaphore(vkContext->getDevice(), &semaphoreInfo, nullptr,
+                              &renderFinishSemaphores[i]) ||
+        vkd.vkCreateFence(vkContext->getDevice(), &fenceInfo, nullptr,
+                          &drawFences[i]) != VK_SUCCESS)
       throw std::runtime_error("failed to create sync objects");
 }
 
 VKSync::~VKSync() {
 
   for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-    vkDestroySemaphore(vkContext->getDevice(), imageAvailableSemaphores[i],
-                       nullptr);
-    vkDestroySemaphore(vkContext->getDevice(), renderFinishSemaphores[i],
-                       nullptr);
-    vkDestroyFence(vkContext->getDevice(), drawFences[i], nullptr);
+    vkd.vkDestroySemaphore(vkContext->getDevice(), imageAvailableSemaphores[i],
+                           nullptr);
+    vkd.vkDestroySemaphore(vkContext->getDevice(), renderFinishSemaphores[i],
+                           nullptr);
+    vkd.vkDestroyFence(vkContext->getDevice(), drawFences[i], nullptr);
   }
 }
 }; // namespace MAI
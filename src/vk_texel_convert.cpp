@@ -0,0 +1,438 @@
+#include "vk_texel_convert.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define MAI_TEXEL_SIMD 1
+#include <immintrin.h>
+// the library is built for the baseline ISA, the SIMD kernels only run
+// once the CPU has been checked
+#define MAI_TARGET(features) __attribute__((target(features)))
+#endif
+
+namespace MAI {
+
+static uint32_t floatBits(float value) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+static float bitsFloat(uint32_t bits) {
+  float value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+// rounds to nearest even like F16C, NaN payloads are kept the same way
+static uint16_t floatToHalf(float value) {
+  uint32_t f = floatBits(value);
+  const uint16_t sign = (f >> 16) & 0x8000;
+  f &= 0x7FFFFFFF;
+
+  uint16_t half;
+  if (f >= 0x47800000) {
+    // too large, infinity or NaN
+    half = f > 0x7F800000 ? 0x7E00 | ((f >> 13) & 0x3FF) : 0x7C00;
+  } else if (f < 0x38800000) {
+    // denormal or zero, adding 0.5 lets the FPU do the rounding
+    half = static_cast<uint16_t>(floatBits(bitsFloat(f) + 0.5f) - 0x3F000000);
+  } else {
+    const uint32_t odd = (f >> 13) & 1;
+    // rebias the exponent from 127 to 15, round the dropped bits
+    f += 0xC8000FFF + odd;
+    half = static_cast<uint16_t>(f >> 13);
+  }
+  return half | sign;
+}
+
+// the 11 and 10 bit floats of B10G11R11: no sign, 5 exponent bits and
+// mantissa bits of mantissa
+template <uint32_t mantissa> static uint32_t floatToSmallFloat(float value) {
+  constexpr uint32_t shift = 23 - mantissa;
+  // NaN and negatives fail the comparison
+  if (!(value > 0.0f))
+    return 0;
+  uint32_t i = std::min(floatBits(value), 0x47800000u - (1u << shift));
+  if (i < 0x38800000) {
+    const uint32_t exponentShift = 113 - (i >> 23);
+    if (exponentShift > 24)
+      return 0;
+    i = (0x800000 | (i & 0x7FFFFF)) >> exponentShift;
+  } else
+    i += 0xC8000000;
+  return ((i + (1u << (shift - 1)) - 1 + ((i >> shift) & 1)) >> shift) &
+         ((1u << (mantissa + 5)) - 1);
+}
+
+static uint32_t floatToB10G11R11(const float *texel) {
+  return floatToSmallFloat<6>(texel[0]) | floatToSmallFloat<6>(texel[1]) << 11 |
+         floatToSmallFloat<5>(texel[2]) << 22;
+}
+
+// the shared exponent encoding of the Vulkan spec, 9 bit mantissas
+static uint32_t floatToE5B9G9R9(const float *texel) {
+  constexpr float maxValue = 65408.0f;
+  float rgb[3];
+  for (uint32_t c = 0; c < 3; c++)
+    rgb[c] = texel[c] > 0.0f ? std::min(texel[c], maxValue) : 0.0f;
+  const float maxc = std::max({rgb[0], rgb[1], rgb[2]});
+
+  // floor(log2(maxc)) from the exponent bits, at least -16
+  int32_t exponent =
+      std::max(static_cast<int32_t>(floatBits(maxc) >> 23) - 127, -16) + 16;
+  float scale = bitsFloat(static_cast<uint32_t>(151 - exponent) << 23);
+  if (std::floor(maxc * scale + 0.5f) == 512.0f) {
+    exponent++;
+    scale *= 0.5f;
+  }
+
+  uint32_t packed = static_cast<uint32_t>(exponent) << 27;
+  for (uint32_t c = 0; c < 3; c++)
+    packed |= static_cast<uint32_t>(std::floor(rgb[c] * scale + 0.5f))
+              << (9 * c);
+  return packed;
+}
+
+// RGBA8 channels times alpha / 255, rounded
+static uint8_t premultiply(uint32_t channel, uint32_t alpha) {
+  const uint32_t t = channel * alpha + 128;
+  return static_cast<uint8_t>((t + (t >> 8)) >> 8);
+}
+
+#ifdef MAI_TEXEL_SIMD
+
+static bool hasSSE41() {
+  static const bool supported = [] {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.1");
+  }();
+  return supported;
+}
+
+static bool hasAVX2() {
+  static const bool supported = [] {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("f16c");
+  }();
+  return supported;
+}
+
+// the SIMD kernels convert a prefix of the texels and return its length,
+// the scalar loop does the rest
+
+MAI_TARGET("sse4.1")
+static size_t convertRGB8ToRGBA8SSE(const uint8_t *src, uint8_t *dst,
+                                    size_t texels) {
+  const __m128i expand =
+      _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+  const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xFF000000));
+  size_t i = 0;
+  // 4 texels a step, the 16 byte load reads into the next two
+  for (; i + 6 <= texels; i += 4) {
+    const __m128i rgb =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i * 3));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i * 4),
+                     _mm_or_si128(_mm_shuffle_epi8(rgb, expand), alpha));
+  }
+  return i;
+}
+
+MAI_TARGET("sse4.1")
+static __m128i premultiplyRGBA8x2(__m128i texels) {
+  // alpha to every channel, 255 to the alpha channel itself
+  __m128i alpha =
+      _mm_shufflehi_epi16(_mm_shufflelo_epi16(texels, 0xFF), 0xFF);
+  alpha = _mm_blend_epi16(alpha, _mm_set1_epi16(255), 0x88);
+  __m128i t = _mm_add_epi16(_mm_mullo_epi16(texels, alpha),
+                            _mm_set1_epi16(128));
+  return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+MAI_TARGET("sse4.1")
+static size_t premultiplyRGBA8SSE(const uint8_t *src, uint8_t *dst,
+                                  size_t texels) {
+  const __m128i zero = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 4 <= texels; i += 4) {
+    const __m128i rgba =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i * 4));
+    const __m128i lo = premultiplyRGBA8x2(_mm_unpacklo_epi8(rgba, zero));
+    const __m128i hi = premultiplyRGBA8x2(_mm_unpackhi_epi8(rgba, zero));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i * 4),
+                     _mm_packus_epi16(lo, hi));
+  }
+  return i;
+}
+
+MAI_TARGET("sse4.1")
+static size_t convertRGB32FToRGBA32FSSE(const float *src, float *dst,
+                                        size_t texels) {
+  const __m128 one = _mm_set1_ps(1.0f);
+  size_t i = 0;
+  // the 4 float load reads the next texel's red
+  for (; i + 1 < texels; i++)
+    _mm_storeu_ps(dst + i * 4,
+                  _mm_blend_ps(_mm_loadu_ps(src + i * 3), one, 0x8));
+  return i;
+}
+
+MAI_TARGET("sse4.1")
+static size_t premultiplyRGBA32FSSE(const float *src, float *dst,
+                                    size_t texels) {
+  for (size_t i = 0; i < texels; i++) {
+    const __m128 rgba = _mm_loadu_ps(src + i * 4);
+    const __m128 alpha = _mm_shuffle_ps(rgba, rgba, 0xFF);
+    _mm_storeu_ps(dst + i * 4,
+                  _mm_blend_ps(_mm_mul_ps(rgba, alpha), rgba, 0x8));
+  }
+  return texels;
+}
+
+template <uint32_t channels, bool premultiplied>
+MAI_TARGET("avx2,f16c")
+static size_t convertToRGBA16FAVX2(const float *src, uint16_t *dst,
+                                   size_t texels) {
+  size_t i = 0;
+  if constexpr (channels == 4) {
+    // 2 texels a step
+    for (; i + 2 <= texels; i += 2) {
+      __m256 rgba = _mm256_loadu_ps(src + i * 4);
+      if constexpr (premultiplied)
+        rgba = _mm256_blend_ps(
+            _mm256_mul_ps(rgba, _mm256_permute_ps(rgba, 0xFF)), rgba, 0x88);
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i * 4),
+                       _mm256_cvtps_ph(rgba, _MM_FROUND_TO_NEAREST_INT));
+    }
+  } else {
+    const __m128 one = _mm_set1_ps(1.0f);
+    // the 4 float load reads the next texel's red
+    for (; i + 1 < texels; i++) {
+      const __m128 rgba = _mm_blend_ps(_mm_loadu_ps(src + i * 3), one, 0x8);
+      _mm_storel_epi64(reinterpret_cast<__m128i *>(dst + i * 4),
+                       _mm_cvtps_ph(rgba, _MM_FROUND_TO_NEAREST_INT));
+    }
+  }
+  return i;
+}
+
+// floatToSmallFloat() for 8 values
+template <uint32_t mantissa>
+MAI_TARGET("avx2")
+static __m256i floatToSmallFloatAVX2(__m256 value) {
+  constexpr uint32_t shift = 23 - mantissa;
+  // max returns its second operand for NaN
+  __m256i i = _mm256_castps_si256(_mm256_max_ps(value, _mm256_setzero_ps()));
+  i = _mm256_min_epu32(i, _mm256_set1_epi32(0x47800000 - (1u << shift)));
+
+  // shifts past 31 give 0, as the scalar early out does
+  const __m256i exponentShift =
+      _mm256_sub_epi32(_mm256_set1_epi32(113), _mm256_srli_epi32(i, 23));
+  const __m256i denormal = _mm256_srlv_epi32(
+      _mm256_or_si256(_mm256_set1_epi32(0x800000),
+                      _mm256_and_si256(i, _mm256_set1_epi32(0x7FFFFF))),
+      exponentShift);
+  const __m256i normal =
+      _mm256_add_epi32(i, _mm256_set1_epi32(static_cast<int>(0xC8000000)));
+  i = _mm256_blendv_epi8(
+      normal, denormal,
+      _mm256_cmpgt_epi32(_mm256_set1_epi32(0x38800000), i));
+
+  const __m256i round = _mm256_add_epi32(
+      _mm256_set1_epi32((1u << (shift - 1)) - 1),
+      _mm256_and_si256(_mm256_srli_epi32(i, shift), _mm256_set1_epi32(1)));
+  return _mm256_and_si256(_mm256_srli_epi32(_mm256_add_epi32(i, round), shift),
+                          _mm256_set1_epi32((1u << (mantissa + 5)) - 1));
+}
+
+// floor(channel * scale + 0.5), no FMA so it rounds like the scalar code
+MAI_TARGET("avx2")
+static __m256 quantizeAVX2(__m256 channel, __m256 scale) {
+  return _mm256_floor_ps(
+      _mm256_add_ps(_mm256_mul_ps(channel, scale), _mm256_set1_ps(0.5f)));
+}
+
+// floatToE5B9G9R9() for 8 texels
+MAI_TARGET("avx2")
+static __m256i floatToE5B9G9R9AVX2(__m256 r, __m256 g, __m256 b) {
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 maxValue = _mm256_set1_ps(65408.0f);
+  r = _mm256_min_ps(_mm256_max_ps(r, zero), maxValue);
+  g = _mm256_min_ps(_mm256_max_ps(g, zero), maxValue);
+  b = _mm256_min_ps(_mm256_max_ps(b, zero), maxValue);
+  const __m256 maxc = _mm256_max_ps(_mm256_max_ps(r, g), b);
+
+  __m256i exponent = _mm256_sub_epi32(
+      _mm256_srli_epi32(_mm256_castps_si256(maxc), 23), _mm256_set1_epi32(127));
+  exponent = _mm256_max_epi32(exponent, _mm256_set1_epi32(-16));
+  exponent = _mm256_add_epi32(exponent, _mm256_set1_epi32(16));
+  __m256 scale = _mm256_castsi256_ps(_mm256_slli_epi32(
+      _mm256_sub_epi32(_mm256_set1_epi32(151), exponent), 23));
+
+  const __m256 overflow = _mm256_cmp_ps(quantizeAVX2(maxc, scale),
+                                       _mm256_set1_ps(512.0f), _CMP_EQ_OQ);
+  // the mask is -1 where the exponent goes up
+  exponent = _mm256_sub_epi32(exponent, _mm256_castps_si256(overflow));
+  scale = _mm256_blendv_ps(
+      scale, _mm256_mul_ps(scale, _mm256_set1_ps(0.5f)), overflow);
+
+  const __m256i rs = _mm256_cvttps_epi32(quantizeAVX2(r, scale));
+  const __m256i gs = _mm256_cvttps_epi32(quantizeAVX2(g, scale));
+  const __m256i bs = _mm256_cvttps_epi32(quantizeAVX2(b, scale));
+  __m256i packed = _mm256_or_si256(_mm256_slli_epi32(exponent, 27), rs);
+  packed = _mm256_or_si256(packed, _mm256_slli_epi32(gs, 9));
+  return _mm256_or_si256(packed, _mm256_slli_epi32(bs, 18));
+}
+
+template <uint32_t channels, bool sharedExponent>
+MAI_TARGET("avx2")
+static size_t convertToPackedAVX2(const float *src, uint32_t *dst,
+                                  size_t texels) {
+  // 8 texels a step, each channel gathered into its own register
+  const __m256i index = _mm256_mullo_epi32(
+      _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(channels));
+  size_t i = 0;
+  for (; i + 8 <= texels; i += 8) {
+    const float *texel = src + i * channels;
+    const __m256 r = _mm256_i32gather_ps(texel, index, 4);
+    const __m256 g = _mm256_i32gather_ps(texel + 1, index, 4);
+    const __m256 b = _mm256_i32gather_ps(texel + 2, index, 4);
+
+    __m256i packed;
+    if constexpr (sharedExponent)
+      packed = floatToE5B9G9R9AVX2(r, g, b);
+    else
+      packed = _mm256_or_si256(
+          _mm256_or_si256(
+              floatToSmallFloatAVX2<6>(r),
+              _mm256_slli_epi32(floatToSmallFloatAVX2<6>(g), 11)),
+          _mm256_slli_epi32(floatToSmallFloatAVX2<5>(b), 22));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), packed);
+  }
+  return i;
+}
+
+#endif
+
+void convertRGB8ToRGBA8(const void *src, void *dst, size_t texels) {
+  const uint8_t *in = static_cast<const uint8_t *>(src);
+  uint8_t *out = static_cast<uint8_t *>(dst);
+  size_t i = 0;
+#ifdef MAI_TEXEL_SIMD
+  if (hasSSE41())
+    i = convertRGB8ToRGBA8SSE(in, out, texels);
+#endif
+  for (; i < texels; i++) {
+    memcpy(out + i * 4, in + i * 3, 3);
+    out[i * 4 + 3] = 255;
+  }
+}
+
+void premultiplyRGBA8(const void *src, void *dst, size_t texels) {
+  const uint8_t *in = static_cast<const uint8_t *>(src);
+  uint8_t *out = static_cast<uint8_t *>(dst);
+  size_t i = 0;
+#ifdef MAI_TEXEL_SIMD
+  if (hasSSE41())
+    i = premultiplyRGBA8SSE(in, out, texels);
+#endif
+  for (; i < texels; i++) {
+    const uint8_t alpha = in[i * 4 + 3];
+    for (uint32_t c = 0; c < 3; c++)
+      out[i * 4 + c] = premultiply(in[i * 4 + c], alpha);
+    out[i * 4 + 3] = alpha;
+  }
+}
+
+void convertRGB32FToRGBA32F(const void *src, void *dst, size_t texels) {
+  const float *in = static_cast<const float *>(src);
+  float *out = static_cast<float *>(dst);
+  size_t i = 0;
+#ifdef MAI_TEXEL_SIMD
+  if (hasSSE41())
+    i = convertRGB32FToRGBA32FSSE(in, out, texels);
+#endif
+  for (; i < texels; i++) {
+    memcpy(out + i * 4, in + i * 3, 3 * sizeof(float));
+    out[i * 4 + 3] = 1.0f;
+  }
+}
+
+void premultiplyRGBA32F(const void *src, void *dst, size_t texels) {
+  const float *in = static_cast<const float *>(src);
+  float *out = static_cast<float *>(dst);
+  size_t i = 0;
+#ifdef MAI_TEXEL_SIMD
+  if (hasSSE41())
+    i = premultiplyRGBA32FSSE(in, out, texels);
+#endif
+  for (; i < texels; i++) {
+    const float alpha = in[i * 4 + 3];
+    for (uint32_t c = 0; c < 3; c++)
+      out[i * 4 + c] = in[i * 4 + c] * alpha;
+    out[i * 4 + 3] = alpha;
+  }
+}
+
+template <uint32_t channels, bool premultiplied>
+static void convertToRGBA16F(const void *src, void *dst, size_t texels) {
+  const float *in = static_cast<const float *>(src);
+  uint16_t *out = static_cast<uint16_t *>(dst);
+  size_t i = 0;
+#ifdef MAI_TEXEL_SIMD
+  if (hasAVX2())
+    i = convertToRGBA16FAVX2<channels, premultiplied>(in, out, texels);
+#endif
+  for (; i < texels; i++) {
+    const float *texel = in + i * channels;
+    const float alpha = channels == 4 ? texel[3] : 1.0f;
+    for (uint32_t c = 0; c < 3; c++)
+      out[i * 4 + c] = floatToHalf(premultiplied ? texel[c] * alpha : texel[c]);
+    out[i * 4 + 3] = floatToHalf(alpha);
+  }
+}
+
+void convertRGBA32FToRGBA16F(const void *src, void *dst, size_t texels) {
+  convertToRGBA16F<4, false>(src, dst, texels);
+}
+
+void premultiplyRGBA32FToRGBA16F(const void *src, void *dst, size_t texels) {
+  convertToRGBA16F<4, true>(src, dst, texels);
+}
+
+void convertRGB32FToRGBA16F(const void *src, void *dst, size_t texels) {
+  convertToRGBA16F<3, false>(src, dst, texels);
+}
+
+template <uint32_t channels, bool sharedExponent>
+static void convertToPacked(const void *src, void *dst, size_t texels) {
+  const float *in = static_cast<const float *>(src);
+  uint32_t *out = static_cast<uint32_t *>(dst);
+  size_t i = 0;
+#ifdef MAI_TEXEL_SIMD
+  if (hasAVX2())
+    i = convertToPackedAVX2<channels, sharedExponent>(in, out, texels);
+#endif
+  for (; i < texels; i++)
+    out[i] = sharedExponent ? floatToE5B9G9R9(in + i * channels)
+                            : floatToB10G11R11(in + i * channels);
+}
+
+void convertRGBA32FToB10G11R11(const void *src, void *dst, size_t texels) {
+  convertToPacked<4, false>(src, dst, texels);
+}
+
+void convertRGB32FToB10G11R11(const void *src, void *dst, size_t texels) {
+  convertToPacked<3, false>(src, dst, texels);
+}
+
+void convertRGBA32FToE5B9G9R9(const void *src, void *dst, size_t texels) {
+  convertToPacked<4, true>(src, dst, texels);
+}
+
+void convertRGB32FToE5B9G9R9(const void *src, void *dst, size_t texels) {
+  convertToPacked<3, true>(src, dst, texels);
+}
+
+}; // namespace MAI
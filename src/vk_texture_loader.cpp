@@ -0,0 +1,416 @@
+#include "vk_texture_loader.h"
+#include "vk_ktx.h"
+#include "vk_mapped_file.h"
+#include "vk_residency.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string_view>
+
+namespace MAI {
+
+bool decodeKTX(const char *data, size_t size, DecodedTexture &out) {
+  if (!isKTX(data, size))
+    return false;
+  const KTXTexture ktx = parseKTX(data, size, "KTX2 data");
+  if (out.maxDimension &&
+      (ktx.width > out.maxDimension || ktx.height > out.maxDimension))
+    throw std::runtime_error("KTX2 image too large");
+
+  // levels are stored smallest first, the image wants them largest first
+  const uint32_t levels = std::max(1u, ktx.levelCount);
+  VkDeviceSize total = 0;
+  for (uint32_t level = 0; level < levels; level++)
+    total += ktx.getLevelSize(level);
+  out.pixels.resize(total);
+  char *dst = out.pixels.data();
+  for (uint32_t level = 0; level < levels; level++) {
+    memcpy(dst, data + ktx.levelOffsets[level], ktx.getLevelSize(level));
+    dst += ktx.getLevelSize(level);
+  }
+  out.info = ktx.getTextureInfo();
+  return true;
+}
+
+// one scanline of RGBE texels. new style lines start with 2 2 and the
+// width and hold each channel run length encoded, anything else is flat
+static const uint8_t *readScanline(const uint8_t *src, const uint8_t *end,
+                                   uint8_t *rgbe, uint32_t width) {
+  const size_t lineSize = static_cast<size_t>(width) * 4;
+  if (width < 8 || width > 0x7FFF || end - src < 4 || src[0] != 2 ||
+      src[1] != 2 || (src[2] & 0x80)) {
+    if (static_cast<size_t>(end - src) < lineSize)
+      throw std::runtime_error("truncated HDR data");
+    memcpy(rgbe, src, lineSize);
+    return src + lineSize;
+  }
+  if (static_cast<uint32_t>(src[2] << 8 | src[3]) != width)
+    throw std::runtime_error("bad HDR scanline");
+  src += 4;
+
+  for (uint32_t c = 0; c < 4; c++) {
+    for (uint32_t x = 0; x < width;) {
+      if (src == end)
+        throw std::runtime_error("truncated HDR data");
+      uint32_t count = *src++;
+      // above 128 a run of one value, else count literal values
+      const bool run = count > 128;
+      if (run)
+        count -= 128;
+      if (!count || count > width - x ||
+          static_cast<size_t>(end - src) < (run ? 1 : count))
+        throw std::runtime_error("bad HDR scanline");
+      for (; count; count--, x++)
+        rgbe[static_cast<size_t>(x) * 4 + c] = run ? *src : *src++;
+      if (run)
+        src++;
+    }
+  }
+  return src;
+}
+
+bool decodeHDR(const char *data, size_t size, DecodedTexture &out) {
+  const std::string_view file(data, size);
+  if (!file.starts_with("#?RADIANCE\n") && !file.starts_with("#?RGBE\n"))
+    return false;
+
+  // header lines up to an empty one, then the resolution line
+  const size_t headerEnd = file.find("\n\n");
+  if (headerEnd == std::string_view::npos)
+    throw std::runtime_error("truncated HDR header");
+  const std::string_view header = file.substr(0, headerEnd);
+  if (header.find("FORMAT=") != std::string_view::npos &&
+      header.find("FORMAT=32-bit_rle_rgbe") == std::string_view::npos)
+    throw std::runtime_error("unsupported HDR pixel format");
+  const size_t lineEnd = file.find('\n', headerEnd + 2);
+  if (lineEnd == std::string_view::npos)
+    throw std::runtime_error("truncated HDR header");
+  // rows top to bottom, texels left to right, the only common orientation
+  const std::string line(file.substr(headerEnd + 2, lineEnd - headerEnd - 2));
+  uint32_t width = 0;
+  uint32_t height = 0;
+  if (sscanf(line.c_str(), "-Y %u +X %u", &height, &width) != 2 || !width ||
+      !height)
+    throw std::runtime_error("unsupported HDR orientation: " + line);
+  if (out.maxDimension &&
+      (width > out.maxDimension || height > out.maxDimension))
+    throw std::runtime_error("HDR image too large: " + line);
+
+  const uint8_t *src = reinterpret_cast<const uint8_t *>(data) + lineEnd + 1;
+  const uint8_t *end = reinterpret_cast<const uint8_t *>(data) + size;
+  std::vector<uint8_t> rgbe(static_cast<size_t>(width) * 4);
+  out.pixels.resize(static_cast<size_t>(width) * height * 3 * sizeof(float));
+  float *dst = reinterpret_cast<float *>(out.pixels.data());
+  for (uint32_t y = 0; y < height; y++) {
+    src = readScanline(src, end, rgbe.data(), width);
+    for (uint32_t x = 0; x < width; x++, dst += 3) {
+      const uint8_t *texel = &rgbe[static_cast<size_t>(x) * 4];
+      // a shared exponent, 8 bit mantissas
+      const float scale =
+          texel[3] ? std::ldexp(1.0f, static_cast<int>(texel[3]) - 136) : 0.0f;
+      for (uint32_t c = 0; c < 3; c++)
+        dst[c] = texel[c] * scale;
+    }
+  }
+
+  out.info = {
+      .width = width,
+      .height = height,
+      .vkFormat = VK_FORMAT_R16G16B16A16_SFLOAT,
+      .dataLayout = MAI_TEXELS_RGB32F,
+  };
+  return true;
+}
+
+VKTextureLoader::VKTextureLoader(VKContext *vkContext, VKCmd *vkCmd,
+                                 TextureLoaderInfo info)
+    : vkContext(vkContext), vkCmd(vkCmd), info_(info),
+      decoders({decodeKTX, decodeHDR}) {
+  uint32_t count = info_.workerCount;
+  if (!count)
+    count = std::max(1u, std::thread::hardware_concurrency()) - 1;
+  count = std::max(1u, count);
+  for (uint32_t i = 0; i < count; i++)
+    workers.emplace_back(&VKTextureLoader::work, this);
+}
+
+void VKTextureLoader::addDecoder(TextureDecodeFunc decoder) {
+  std::lock_guard<std::mutex> lock(mutex);
+  decoders.insert(decoders.begin(), decoder);
+}
+
+VKAsyncTexture *VKTextureLoader::load(AsyncTextureInfo info) {
+  assert(info.filename || (info.data && info.size));
+  assert(info.format != MAI_DEPTH_TEXTURE);
+  VKAsyncTexture *texture = new VKAsyncTexture();
+  texture->format = info.format;
+  textures.push_back(texture);
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    queued.push_back({
+        .texture = texture,
+        .info = info,
+        .filename = info.filename ? info.filename : "",
+    });
+  }
+  wake.notify_one();
+  return texture;
+}
+
+void VKTextureLoader::setTextureIndex(VKAsyncTexture *texture,
+                                      uint32_t index) {
+  texture->textureIndex = index;
+  if (texture->texture)
+    texture->texture->setTextureIndex(index);
+}
+
+VKTexture *VKTextureLoader::getPlaceholder(TextureFormat format) {
+  assert(format != MAI_DEPTH_TEXTURE);
+  VKTexture *&placeholder = placeholders[format];
+  if (!placeholder) {
+    // mid grey, enough for every face of a cube
+    uint8_t grey[6 * 4];
+    for (uint32_t i = 0; i < sizeof(grey); i++)
+      grey[i] = i % 4 == 3 ? 255 : 128;
+    placeholder = new VKTexture(vkContext, vkCmd, nullptr,
+                                {
+                                    .width = 1,
+                                    .height = 1,
+                                    .data = grey,
+                                    .format = format,
+                                    .vkFormat = VK_FORMAT_R8G8B8A8_UNORM,
+                                    .debugName = "texture placeholder",
+                                });
+  }
+  return placeholder;
+}
+
+void VKTextureLoader::destroyTexture(VKAsyncTexture *texture) {
+  std::erase(textures, texture);
+  std::erase_if(fixups,
+                [&](const Fixup &fixup) { return fixup.texture == texture; });
+  // a worker still decodes it
+  if (texture->state == MAI_TEXTURE_DECODING) {
+    texture->destroyed = true;
+    return;
+  }
+  retire(texture);
+  delete texture;
+}
+
+void VKTextureLoader::update(uint32_t frameIndex) {
+  frame++;
+  release(false);
+  fixDescriptors(frameIndex);
+  swapIn(frameIndex);
+  // a caller's batch would submit the new images after this frame
+  if (vkCmd->isUploadBatchOpen())
+    return;
+
+  // one batch for every texture of the frame, nothing waits on the GPU
+  std::vector<VKAsyncTexture *> created;
+  bool batchOpen = false;
+  VkDeviceSize bytes = 0;
+  for (;;) {
+    Job job;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (decoded.empty() ||
+          (bytes && bytes + decoded.front().decoded.pixels.size() >
+                        info_.maxBytesPerFrame))
+        break;
+      job = std::move(decoded.front());
+      decoded.pop_front();
+    }
+
+    VKAsyncTexture *texture = job.texture;
+    if (texture->destroyed) {
+      delete texture;
+      continue;
+    }
+    if (!job.error.empty()) {
+      fail(texture, job.error);
+      continue;
+    }
+
+    if (!batchOpen) {
+      vkCmd->beginUploadBatch();
+      batchOpen = true;
+    }
+    bytes += job.decoded.pixels.size();
+    create(job);
+    if (texture->texture)
+      created.push_back(texture);
+  }
+  if (!batchOpen)
+    return;
+
+  const uint64_t id = vkCmd->endUploadBatch();
+  for (VKAsyncTexture *texture : created) {
+    texture->state = MAI_TEXTURE_UPLOADING;
+    texture->uploadId = id;
+  }
+}
+
+void VKTextureLoader::create(Job &job) {
+  VKAsyncTexture *texture = job.texture;
+  TextureInfo info = job.decoded.info;
+  if (info.format != texture->format) {
+    fail(texture, job.filename + ": not the requested kind of texture");
+    return;
+  }
+  info.data = job.decoded.pixels.data();
+  if (job.info.vkFormat != VK_FORMAT_UNDEFINED &&
+      info.dataLayout != MAI_TEXELS_NATIVE)
+    info.vkFormat = job.info.vkFormat;
+  info.premultiplyAlpha = job.info.premultiplyAlpha;
+  if (job.info.sampler)
+    info.sampler = &*job.info.sampler;
+  info.debugName = job.info.debugName;
+
+  try {
+    texture->texture = new VKTexture(vkContext, vkCmd, nullptr, info);
+  } catch (const std::exception &e) {
+    fail(texture, job.filename + ": " + e.what());
+    return;
+  }
+  texture->texture->setTextureIndex(texture->textureIndex);
+}
+
+void VKTextureLoader::swapIn(uint32_t frameIndex) {
+  // this frame's set can change now, the others once their frame begins
+  const uint32_t others =
+      ((1u << MAX_FRAMES_IN_FLIGHT) - 1) & ~(1u << frameIndex);
+  for (VKAsyncTexture *texture : textures) {
+    if (texture->state != MAI_TEXTURE_UPLOADING ||
+        !vkCmd->isUploadComplete(texture->uploadId))
+      continue;
+    texture->state = MAI_TEXTURE_READY;
+    if (others)
+      fixups.push_back({.texture = texture, .frames = others});
+    if (descriptorFixup)
+      descriptorFixup(texture->texture, frameIndex);
+    // from here on it can be moved or copied out by an eviction
+    if (VKResidency *residency = vkContext->getResidency())
+      residency->addTexture(texture->texture);
+  }
+}
+
+void VKTextureLoader::work() {
+  for (;;) {
+    Job job;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      wake.wait(lock, [&] { return stopping || !queued.empty(); });
+      if (stopping)
+        return;
+      job = std::move(queued.front());
+      queued.pop_front();
+    }
+
+    try {
+      decode(job);
+    } catch (const std::exception &e) {
+      job.error = job.filename + ": " + e.what();
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    decoded.push_back(std::move(job));
+  }
+}
+
+void VKTextureLoader::decode(Job &job) const {
+  const char *data = static_cast<const char *>(job.info.data);
+  size_t size = job.info.size;
+  // the decoders copy out of the mapping, the page faults happen here
+  std::optional<VKMappedFile> file;
+  if (!job.filename.empty()) {
+    file.emplace(job.filename.c_str());
+    data = file->getData();
+    size = file->getSize();
+  } else
+    job.filename = "texture data";
+  job.decoded.maxDimension =
+      vkContext->getCapabilities().limits().maxImageDimension2D;
+
+  for (const TextureDecodeFunc &decoder : decoders)
+    if (decoder(data, size, job.decoded))
+      return;
+  throw std::runtime_error("no decoder takes this image");
+}
+
+size_t VKTextureLoader::getPendingCount() const {
+  size_t count = 0;
+  for (const VKAsyncTexture *texture : textures)
+    count += texture->state == MAI_TEXTURE_DECODING ||
+             texture->state == MAI_TEXTURE_UPLOADING;
+  return count;
+}
+
+void VKTextureLoader::fail(VKAsyncTexture *texture, const std::string &error) {
+  std::cerr << "texture load failed: " << error << std::endl;
+  texture->state = MAI_TEXTURE_FAILED;
+  texture->error = error;
+}
+
+void VKTextureLoader::retire(VKAsyncTexture *texture) {
+  if (!texture->texture)
+    return;
+  if (VKResidency *residency = vkContext->getResidency())
+    residency->removeTexture(texture->texture);
+  if (VKDefragmenter *defragmenter = vkContext->getDefragmenter())
+    defragmenter->removeTexture(texture->texture);
+  retired.push_back({
+      .frame = frame,
+      .texture = texture->texture,
+      .uploadId = texture->uploadId,
+  });
+}
+
+void VKTextureLoader::release(bool all) {
+  // the fence of the last frame that could sample it has been waited on
+  std::erase_if(retired, [&](const Retired &old) {
+    if (!all && (old.frame + MAX_FRAMES_IN_FLIGHT > frame ||
+                 !vkCmd->isUploadComplete(old.uploadId)))
+      return false;
+    delete old.texture;
+    return true;
+  });
+}
+
+void VKTextureLoader::fixDescriptors(uint32_t frameIndex) {
+  for (Fixup &fixup : fixups)
+    if (fixup.frames & (1u << frameIndex)) {
+      fixup.frames &= ~(1u << frameIndex);
+      if (descriptorFixup)
+        descriptorFixup(fixup.texture->texture, frameIndex);
+    }
+  std::erase_if(fixups, [](const Fixup &fixup) { return !fixup.frames; });
+}
+
+VKTextureLoader::~VKTextureLoader() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  wake.notify_all();
+  for (std::thread &worker : workers)
+    worker.join();
+
+  // the caller has waited for the device. jobs that never came back may
+  // belong to textures destroyed meanwhile
+  for (const std::deque<Job> *jobs : {&queued, &decoded})
+    for (const Job &job : *jobs)
+      if (job.texture->destroyed)
+        delete job.texture;
+  for (VKAsyncTexture *texture : textures) {
+    retire(texture);
+    delete texture;
+  }
+  release(true);
+  for (VKTexture *placeholder : placeholders)
+    delete placeholder;
+}
+
+}; // namespace MAI
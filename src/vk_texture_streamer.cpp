@@ -0,0 +1,281 @@
+#include "vk_texture_streamer.h"
+#include "vk_residency.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace MAI {
+
+VKTextureStreamer::VKTextureStreamer(VKContext *vkContext, VKCmd *vkCmd,
+                                     StreamingInfo info)
+    : vkContext(vkContext), vkCmd(vkCmd), info_(info) {
+  worker = std::thread(&VKTextureStreamer::work, this);
+}
+
+VKStreamedTexture *VKTextureStreamer::createTexture(StreamedTextureInfo info) {
+  assert(info.residentLevels > 0);
+  VKStreamedTexture *texture = new VKStreamedTexture();
+  texture->debugName = info.debugName;
+  try {
+    texture->file = new VKMappedFile(info.filename);
+    texture->ktx = parseKTX(texture->file->getData(),
+                            texture->file->getSize(), info.filename);
+    if (!texture->ktx.levelCount)
+      throw std::runtime_error(
+          std::string("streamed KTX2 file without levels: ") + info.filename);
+  } catch (...) {
+    delete texture->file;
+    delete texture;
+    throw;
+  }
+
+  const uint32_t levels = texture->ktx.levelCount;
+  texture->lowestLevel = levels - std::min(info.residentLevels, levels);
+  texture->residentLevel = texture->lowestLevel;
+  texture->wantedLevel = texture->lowestLevel;
+  texture->texture = createImage(texture, texture->lowestLevel,
+                                 readLevels(texture, texture->lowestLevel));
+  textures.push_back(texture);
+  return texture;
+}
+
+void VKTextureStreamer::setTextureIndex(VKStreamedTexture *texture,
+                                        uint32_t index) {
+  texture->textureIndex = index;
+  texture->texture->setTextureIndex(index);
+}
+
+void VKTextureStreamer::destroyTexture(VKStreamedTexture *texture) {
+  std::erase(textures, texture);
+  std::erase_if(fixups,
+                [&](const Fixup &fixup) { return fixup.texture == texture; });
+  // the worker still reads its mapping
+  if (texture->loading) {
+    texture->destroyed = true;
+    return;
+  }
+  free(texture);
+}
+
+void VKTextureStreamer::requestLevel(VKStreamedTexture *texture,
+                                     uint32_t level) {
+  assert(!texture->destroyed);
+  texture->wantedLevel = std::min(level, texture->lowestLevel);
+  if (!texture->loading && texture->needsLoad())
+    queueLoad(texture, texture->wantedLevel);
+}
+
+uint32_t VKTextureStreamer::levelForDistance(float distance,
+                                             float fullDetailDistance) {
+  assert(fullDetailDistance > 0.0f);
+  if (distance <= fullDetailDistance)
+    return 0;
+  return static_cast<uint32_t>(std::log2(distance / fullDetailDistance));
+}
+
+void VKTextureStreamer::update(uint32_t frameIndex) {
+  frame++;
+  release(false);
+  fixDescriptors(frameIndex);
+  // a caller's batch would submit the new images after this frame
+  if (vkCmd->isUploadBatchOpen())
+    return;
+
+  // one batch for every swap of the frame, nothing waits on the GPU
+  std::vector<VKTexture *> swapped;
+  VkDeviceSize bytes = 0;
+  for (;;) {
+    Load load;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (loaded.empty() || (bytes && bytes + loaded.front().data.size() >
+                                           info_.maxBytesPerFrame))
+        break;
+      load = std::move(loaded.front());
+      loaded.pop_front();
+    }
+
+    VKStreamedTexture *texture = load.texture;
+    texture->loading = false;
+    if (texture->destroyed) {
+      free(texture);
+      continue;
+    }
+
+    if (swapped.empty())
+      vkCmd->beginUploadBatch();
+    swapped.push_back(swapIn(texture, load.level, load.data, frameIndex));
+    bytes += load.data.size();
+    // the camera moved on while the level was loading
+    if (texture->needsLoad())
+      queueLoad(texture, texture->wantedLevel);
+  }
+  if (swapped.empty())
+    return;
+  vkCmd->endUploadBatch();
+
+  // submitted: from here on they can be copied out by an eviction
+  if (VKResidency *residency = vkContext->getResidency())
+    for (VKTexture *image : swapped)
+      residency->addTexture(image);
+}
+
+VKTexture *VKTextureStreamer::swapIn(VKStreamedTexture *texture,
+                                     uint32_t level,
+                                     const std::vector<char> &data,
+                                     uint32_t frameIndex) {
+  VKTexture *image = createImage(texture, level, data);
+  retire(texture->texture);
+  texture->texture = image;
+  texture->residentLevel = level;
+
+  // this frame's set can change now, the others once their frame begins
+  const uint32_t others =
+      ((1u << MAX_FRAMES_IN_FLIGHT) - 1) & ~(1u << frameIndex);
+  auto it =
+      std::find_if(fixups.begin(), fixups.end(), [&](const Fixup &fixup) {
+        return fixup.texture == texture;
+      });
+  if (it == fixups.end())
+    fixups.push_back({.texture = texture, .frames = others});
+  else
+    it->frames = others;
+  if (descriptorFixup)
+    descriptorFixup(image, frameIndex);
+  return image;
+}
+
+VKTexture *VKTextureStreamer::createImage(VKStreamedTexture *texture,
+                                          uint32_t level,
+                                          const std::vector<char> &data) {
+  const KTXTexture &ktx = texture->ktx;
+  VKTexture *image = new VKTexture(
+      vkContext, vkCmd, nullptr,
+      {
+          .width = std::max(1u, ktx.width >> level),
+          .height = std::max(1u, ktx.height >> level),
+          .data = data.data(),
+          .format = ktx.getTextureFormat(),
+          .layerCount = std::max(1u, ktx.layerCount),
+          .numMipLevels = ktx.levelCount - level,
+          .mipsIncluded = true,
+          .vkFormat = ktx.format,
+          .debugName = texture->debugName,
+      });
+  image->setTextureIndex(texture->textureIndex);
+  return image;
+}
+
+std::vector<char>
+VKTextureStreamer::readLevels(const VKStreamedTexture *texture,
+                              uint32_t level) {
+  const KTXTexture &ktx = texture->ktx;
+  VkDeviceSize size = 0;
+  for (uint32_t i = level; i < ktx.levelCount; i++) {
+    texture->file->prefetch(ktx.levelOffsets[i], ktx.getLevelSize(i));
+    size += ktx.getLevelSize(i);
+  }
+
+  // the levels are stored smallest first, the image wants largest first
+  std::vector<char> data(size);
+  char *dst = data.data();
+  for (uint32_t i = level; i < ktx.levelCount; i++) {
+    memcpy(dst, texture->file->getData() + ktx.levelOffsets[i],
+           ktx.getLevelSize(i));
+    dst += ktx.getLevelSize(i);
+  }
+  return data;
+}
+
+void VKTextureStreamer::queueLoad(VKStreamedTexture *texture,
+                                  uint32_t level) {
+  texture->loading = true;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    queued.push_back({.texture = texture, .level = level});
+  }
+  wake.notify_one();
+}
+
+void VKTextureStreamer::work() {
+  for (;;) {
+    Load load;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      wake.wait(lock, [&] { return stopping || !queued.empty(); });
+      if (stopping)
+        return;
+      load = std::move(queued.front());
+      queued.pop_front();
+    }
+
+    // the page faults happen here, the mapping and level offsets of a
+    // texture never change while it loads
+    load.data = readLevels(load.texture, load.level);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    loaded.push_back(std::move(load));
+  }
+}
+
+size_t VKTextureStreamer::getPendingCount() const {
+  size_t count = 0;
+  for (const VKStreamedTexture *texture : textures)
+    count += texture->loading;
+  return count;
+}
+
+void VKTextureStreamer::retire(VKTexture *image) {
+  if (VKResidency *residency = vkContext->getResidency())
+    residency->removeTexture(image);
+  if (VKDefragmenter *defragmenter = vkContext->getDefragmenter())
+    defragmenter->removeTexture(image);
+  retired.push_back({.frame = frame, .texture = image});
+}
+
+void VKTextureStreamer::release(bool all) {
+  // the fence of the last frame that could sample it has been waited on
+  std::erase_if(retired, [&](const Retired &old) {
+    if (!all && old.frame + MAX_FRAMES_IN_FLIGHT > frame)
+      return false;
+    delete old.texture;
+    return true;
+  });
+}
+
+void VKTextureStreamer::fixDescriptors(uint32_t frameIndex) {
+  for (Fixup &fixup : fixups)
+    if (fixup.frames & (1u << frameIndex)) {
+      fixup.frames &= ~(1u << frameIndex);
+      if (descriptorFixup)
+        descriptorFixup(fixup.texture->texture, frameIndex);
+    }
+  std::erase_if(fixups, [](const Fixup &fixup) { return !fixup.frames; });
+}
+
+void VKTextureStreamer::free(VKStreamedTexture *texture) {
+  retire(texture->texture);
+  delete texture->file;
+  delete texture;
+}
+
+VKTextureStreamer::~VKTextureStreamer() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  wake.notify_all();
+  worker.join();
+
+  // the caller has waited for the device. loads that never came back may
+  // belong to textures destroyed meanwhile
+  for (const std::deque<Load> *loads : {&queued, &loaded})
+    for (const Load &load : *loads)
+      if (load.texture->destroyed)
+        free(load.texture);
+  for (VKStreamedTexture *texture : textures)
+    free(texture);
+  release(true);
+}
+
+}; // namespace MAI
@@ -0,0 +1,219 @@
+// creates and destroys buffers and textures of mixed sizes and memory
+// usages in random order, round after round. once a round has freed
+// everything, the allocation stats and the fragmentation of the pools must
+// be back where they started, and the VkDeviceMemory objects the
+// allocator keeps must not grow from one round to the next
+
+#include "vk_buffer.h"
+#include "vk_image.h"
+#include "vk_resource_tracker.h"
+#include <cstdio>
+#include <random>
+
+namespace {
+
+constexpr uint32_t ROUND_COUNT = 100;
+constexpr uint32_t STEPS_PER_ROUND = 200;
+constexpr uint32_t MAX_LIVE = 64;
+// ctest counts the run as skipped, see SKIP_RETURN_CODE
+constexpr int SKIP = 77;
+
+struct Resource {
+  MAI::VKbuffer *buffer = nullptr;
+  MAI::VKTexture *texture = nullptr;
+};
+
+uint64_t countMemory(const MAI::MemoryStats &stats) {
+  uint64_t count = 0;
+  for (const MAI::MemoryCounter &counter : stats.deviceMemoryTypes)
+    count += counter.count;
+  return count;
+}
+
+bool sameAllocations(const MAI::MemoryStats &a, const MAI::MemoryStats &b) {
+  for (size_t i = 0; i < a.allocationTypes.size(); i++)
+    if (a.allocationTypes[i].count != b.allocationTypes[i].count ||
+        a.allocationTypes[i].bytes != b.allocationTypes[i].bytes)
+      return false;
+  for (uint32_t i = 0; i < MAI::MEMORY_USAGE_COUNT; i++)
+    if (a.allocationUsages[i].count != b.allocationUsages[i].count ||
+        a.allocationUsages[i].bytes != b.allocationUsages[i].bytes)
+      return false;
+  return true;
+}
+
+struct Churn {
+  MAI::VKContext *vkContext;
+  MAI::VKCmd *vkCmd;
+  std::mt19937 random{1234};
+  std::vector<Resource> live;
+  std::vector<char> pixels;
+  std::vector<char> bytes;
+
+  uint32_t pick(uint32_t count) { return random() % count; }
+
+  void create() {
+    Resource resource;
+    switch (pick(6)) {
+    case 0:
+    case 1: {
+      // small to medium device local buffers, staged
+      const VkDeviceSize size = 256 + pick(4u << 20);
+      bytes.resize(size);
+      resource.buffer = new MAI::VKbuffer(vkContext, vkCmd,
+                                          {
+                                              .size = size,
+                                              .data = bytes.data(),
+                                          });
+      break;
+    }
+    case 2: {
+      // host visible, written in place
+      const VkDeviceSize size = 64 + pick(1u << 20);
+      resource.buffer = new MAI::VKbuffer(vkContext, vkCmd,
+                                          {
+                                              .size = size,
+                                              .data = nullptr,
+                                              .memoryUsage =
+                                                  MAI::MAI_MEMORY_DYNAMIC,
+                                          });
+      break;
+    }
+    case 3: {
+      // larger than a block, dedicated
+      const VkDeviceSize size = MAI::ALLOCATOR_BLOCK_SIZE + pick(16u << 20);
+      resource.buffer = new MAI::VKbuffer(vkContext, vkCmd,
+                                          {
+                                              .size = size,
+                                              .data = nullptr,
+                                          });
+      break;
+    }
+    default: {
+      // optimal images of odd and power of two sizes, up to 8 levels
+      const uint32_t width = 1 + pick(1024);
+      const uint32_t height = 1 + pick(1024);
+      pixels.resize(size_t(width) * height * 4);
+      resource.texture = new MAI::VKTexture(
+          vkContext, vkCmd, nullptr,
+          {
+              .width = width,
+              .height = height,
+              .data = pixels.data(),
+              .numMipLevels = 1 + pick(8),
+              .vkFormat = VK_FORMAT_R8G8B8A8_UNORM,
+          });
+      break;
+    }
+    }
+    live.push_back(resource);
+  }
+
+  void destroy(size_t index) {
+    delete live[index].buffer;
+    delete live[index].texture;
+    live[index] = live.back();
+    live.pop_back();
+  }
+};
+
+} // namespace
+
+int main() {
+  MAI::VKContext *vkContext;
+  try {
+    vkContext = new MAI::VKContext({.appName = "mai_allocator_stress"});
+  } catch (const std::exception &e) {
+    std::fprintf(stderr, "no Vulkan device, skipped: %s\n", e.what());
+    return SKIP;
+  }
+  // waits for each upload, what a renderer frame would do is not needed
+  MAI::VKCmd *vkCmd = new MAI::VKCmd(vkContext);
+  MAI::VKStagingRing *stagingRing =
+      new MAI::VKStagingRing(vkContext, 16ull << 20);
+  vkCmd->setStagingRing(stagingRing);
+  MAI::VKAllocator *allocator = vkContext->getAllocator();
+
+  const MAI::MemoryStats start = allocator->getStats();
+  const MAI::FragmentationStats startFragmentation =
+      allocator->getFragmentation();
+  // every pool keeps at most one empty block, on top of one block per
+  // live resource in the worst case
+  const uint32_t poolCount =
+      vkContext->getCapabilities().memoryProperties.memoryTypeCount * 2;
+  const uint64_t memoryBound = countMemory(start) + MAX_LIVE + poolCount;
+  uint64_t idleMemory = 0;
+  int failures = 0;
+
+  Churn churn{.vkContext = vkContext, .vkCmd = vkCmd};
+  for (uint32_t round = 0; round < ROUND_COUNT; round++) {
+    for (uint32_t step = 0; step < STEPS_PER_ROUND; step++) {
+      if (churn.live.size() < MAX_LIVE &&
+          (churn.live.empty() || churn.pick(3)))
+        churn.create();
+      else
+        churn.destroy(churn.pick(churn.live.size()));
+      vkCmd->pollUploads();
+
+      const uint64_t memory = countMemory(allocator->getStats());
+      if (memory > memoryBound) {
+        std::fprintf(stderr,
+                     "round %u: %llu device memory objects, bound %llu\n",
+                     round, (unsigned long long)memory,
+                     (unsigned long long)memoryBound);
+        failures++;
+      }
+    }
+    while (!churn.live.empty())
+      churn.destroy(churn.live.size() - 1);
+    vkCmd->pollUploads();
+
+    const MAI::MemoryStats stats = allocator->getStats();
+    const MAI::FragmentationStats fragmentation =
+        allocator->getFragmentation();
+    if (!sameAllocations(stats, start)) {
+      std::fprintf(stderr, "round %u: allocations left behind\n", round);
+      failures++;
+    }
+    if (fragmentation.used != startFragmentation.used ||
+        fragmentation.stranded != startFragmentation.stranded) {
+      std::fprintf(stderr,
+                   "round %u: fragmentation %llu used %llu stranded, "
+                   "started at %llu %llu\n",
+                   round, (unsigned long long)fragmentation.used,
+                   (unsigned long long)fragmentation.stranded,
+                   (unsigned long long)startFragmentation.used,
+                   (unsigned long long)startFragmentation.stranded);
+      failures++;
+    }
+    // the first round leaves the empty blocks churn reuses from then on
+    const uint64_t memory = countMemory(stats);
+    if (round == 0)
+      idleMemory = memory;
+    else if (memory > idleMemory) {
+      std::fprintf(stderr,
+                   "round %u: %llu idle device memory objects, was %llu\n",
+                   round, (unsigned long long)memory,
+                   (unsigned long long)idleMemory);
+      failures++;
+    }
+    if (failures)
+      break;
+  }
+
+  const MAI::ResourceStats resources =
+      vkContext->getResourceTracker()->getStats();
+  if (resources.buffers.count || resources.textures.count) {
+    std::fprintf(stderr, "resources still tracked\n");
+    failures++;
+  }
+
+  delete vkCmd;
+  delete stagingRing;
+  delete vkContext;
+  if (failures)
+    return 1;
+  std::printf("%u rounds of %u steps, %llu idle device memory objects\n",
+              ROUND_COUNT, STEPS_PER_ROUND, (unsigned long long)idleMemory);
+  return 0;
+}